@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hashtools.h"
+
+/**
+ * Separate chaining: the "chain" strategy.
+ *
+ * Unlike the other strategies this is a different engine rather than a
+ * different probe order.  Each slot of the table is a node holding up
+ * to CHAIN_NODE_ENTRIES entries, and a slot that fills up chains on
+ * further overflow nodes.  A node is laid out so that the hashes of all
+ * its entries share its first cache line with the link and count; the
+ * keys and values are in its second.  A search that misses therefore
+ * reads one cache line per node, and as the first node of each chain is
+ * in the table itself and the table is sized so that few chains overflow,
+ * that is usually a single cache line in all.
+ *
+ * Entries are packed towards the front of a chain, so only its last
+ * node is ever partly full: an insert adds to the last node, or chains
+ * a new one after it when it is full, and a delete fills its hole with
+ * the last entry of the chain.  Nothing is left behind by a delete, so
+ * churn does not slow searches down.
+ *
+ * Overflow nodes come from a pool owned by the array, carved from large
+ * aligned chunks, and go back to its free list when emptied.  Every key
+ * is kept in the key arena, as a node has no room to hold one inline.
+ */
+
+/**
+ * One node of a chain: two cache lines.  Keys are limited to 32-bit
+ * lengths to make room for four entries.
+ */
+typedef struct ChainNode {
+	struct ChainNode *next;
+	uint32_t nEntries;
+	uint32_t keylen[CHAIN_NODE_ENTRIES];
+	HashIndex hash[CHAIN_NODE_ENTRIES];
+	AAKeyType key[CHAIN_NODE_ENTRIES];
+	void *value[CHAIN_NODE_ENTRIES];
+} __attribute__((aligned(CHAIN_NODE_ALIGN))) ChainNode;
+
+/** the hashes must fall in the first cache line, with the header */
+_Static_assert(sizeof(ChainNode) == 2 * CHAIN_NODE_ALIGN,
+		"a chain node should fill exactly two cache lines");
+
+/** number of nodes carved from each chunk of the pool */
+#define	CHAIN_CHUNK_NODES	511
+
+typedef struct ChainChunk {
+	struct ChainChunk *next;
+	ChainNode nodes[CHAIN_CHUNK_NODES];
+} ChainChunk;
+
+
+/** set up a pool holding no nodes */
+void chainPoolInit(ChainPool *pool)
+{
+	pool->chunks = NULL;
+	pool->freeNodes = NULL;
+	pool->nChunks = 0;
+	pool->nodesInUse = 0;
+}
+
+/** give back every chunk, and so every node, in the pool */
+void chainPoolDestroy(ChainPool *pool)
+{
+	ChainChunk *chunk, *next;
+
+	for (chunk = pool->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	chainPoolInit(pool);
+}
+
+/** carve another chunk of nodes onto the pool's free list */
+static int
+addChunk(ChainPool *pool)
+{
+	ChainChunk *chunk;
+	int i;
+
+	chunk = (ChainChunk *) aligned_alloc(CHAIN_NODE_ALIGN, sizeof(ChainChunk));
+	if (chunk == NULL) {
+		return -1;
+	}
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	pool->nChunks++;
+
+	for (i = CHAIN_CHUNK_NODES - 1; i >= 0; i--) {
+		chunk->nodes[i].next = pool->freeNodes;
+		pool->freeNodes = &chunk->nodes[i];
+	}
+	return 0;
+}
+
+/** make sure at least nNodes can be taken without needing memory */
+static int
+reserveNodes(ChainPool *pool, size_t nNodes)
+{
+	while (pool->nChunks * CHAIN_CHUNK_NODES - pool->nodesInUse < nNodes) {
+		if (addChunk(pool) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** take an empty node from the pool, adding a chunk if it has none */
+static ChainNode *
+allocNode(ChainPool *pool)
+{
+	ChainNode *node;
+
+	if (pool->freeNodes == NULL && addChunk(pool) < 0) {
+		return NULL;
+	}
+
+	node = pool->freeNodes;
+	pool->freeNodes = node->next;
+	node->next = NULL;
+	node->nEntries = 0;
+	pool->nodesInUse++;
+	return node;
+}
+
+/** return an empty node to the pool's free list */
+static void
+freeNode(ChainPool *pool, ChainNode *node)
+{
+	node->next = pool->freeNodes;
+	pool->freeNodes = node;
+	pool->nodesInUse--;
+}
+
+/**
+ * Allocate the first node of every chain for one generation of the
+ * table, all empty
+ *
+ *  @return      0 on success, or -1 if no memory is left
+ */
+int chainCreateBuckets(SlotTable *table)
+{
+	if (table->size > ((size_t) -1) / sizeof(ChainNode)) {
+		table->buckets = NULL;
+		return -1;
+	}
+
+	table->buckets = (ChainNode *) aligned_alloc(CHAIN_NODE_ALIGN,
+			table->size * sizeof(ChainNode));
+	if (table->buckets == NULL) {
+		return -1;
+	}
+	memset(table->buckets, 0, table->size * sizeof(ChainNode));
+	return 0;
+}
+
+/** the bytes taken by the first nodes of one generation's chains */
+size_t chainTableBytes(const SlotTable *table)
+{
+	return table->size * sizeof(ChainNode);
+}
+
+/**
+ * the bytes of the overflow nodes in use, and of every chunk the pool
+ * has carved, free nodes included
+ */
+void chainPoolBytes(const ChainPool *pool, size_t *inUse, size_t *reserved)
+{
+	*inUse = pool->nodesInUse * sizeof(ChainNode);
+	*reserved = pool->nChunks * sizeof(ChainChunk);
+}
+
+/**
+ * the last node of a chain, the only one that may have room, counting
+ * each node passed on the way as a probe
+ */
+static ChainNode *
+chainTail(SlotTable *table, HashIndex bucket, int *cost)
+{
+	ChainNode *tail = &table->buckets[bucket];
+
+	(*cost)++;
+	while (tail->next != NULL) {
+		tail = tail->next;
+		(*cost)++;
+	}
+	return tail;
+}
+
+/** fill the next entry of a node known to have room for it */
+static void
+fillEntry(AssociativeArray *aarray, SlotTable *table, ChainNode *node,
+		AAKeyType key, size_t keylen, HashIndex hash, void *value)
+{
+	uint32_t i = node->nEntries++;
+
+	node->keylen[i] = (uint32_t) keylen;
+	node->hash[i] = hash;
+	node->key[i] = key;
+	node->value[i] = value;
+	SHARED_ADD(aarray, table->nUsed, 1);
+}
+
+/** add an entry whose key is already in the arena to a chain */
+static int
+linkEntry(AssociativeArray *aarray, SlotTable *table, HashIndex bucket,
+		AAKeyType key, size_t keylen, HashIndex hash, void *value)
+{
+	ChainNode *tail;
+	int cost = 0;
+
+	tail = chainTail(table, bucket, &cost);
+	if (tail->nEntries == CHAIN_NODE_ENTRIES) {
+		lockStore(aarray);
+		tail->next = allocNode(&aarray->nodes);
+		unlockStore(aarray);
+		if (tail->next == NULL) {
+			return -1;
+		}
+		tail = tail->next;
+	}
+
+	fillEntry(aarray, table, tail, key, keylen, hash, value);
+	return 0;
+}
+
+/**
+ * Add an entry to the current table, copying its key into the array's
+ * key arena.  The key's length is checked, and a node taken if its
+ * chain is full, before the key is copied, so an insert that fails
+ * leaves nothing behind in the arena or the pool.
+ *
+ *  @return      the chain the entry went into, or (HashIndex) -1 if
+ *				 the key is too long or no memory is left
+ */
+HashIndex chainPlace(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *cost)
+{
+	SlotTable *table = aarray->table;
+	HashIndex bucket = tableIndex(table, hash);
+	ChainNode *tail, *node = NULL;
+	AAKeyType copiedKey;
+
+	if (keylen > UINT32_MAX) {
+		fprintf(stderr, "Key of %zu bytes is too long to chain\n", keylen);
+		return (HashIndex) -1;
+	}
+
+	tail = chainTail(table, bucket, cost);
+	lockStore(aarray);
+	if (tail->nEntries == CHAIN_NODE_ENTRIES) {
+		node = allocNode(&aarray->nodes);
+		if (node == NULL) {
+			unlockStore(aarray);
+			fprintf(stderr, "Cannot allocate another chain node\n");
+			return (HashIndex) -1;
+		}
+	}
+	copiedKey = arenaCopyKey(&aarray->keys, key, keylen);
+	if (copiedKey == NULL && node != NULL) {
+		freeNode(&aarray->nodes, node);
+	}
+	unlockStore(aarray);
+	if (copiedKey == NULL) {
+		return (HashIndex) -1;
+	}
+
+	if (node != NULL) {
+		tail->next = node;
+		tail = node;
+	}
+	fillEntry(aarray, table, tail, copiedKey, keylen, hash, value);
+	return bucket;
+}
+
+/**
+ * Find the node and position holding the key in its chain.  The stored
+ * hash and length are compared first; they are in the node's first
+ * cache line, and the key bytes are only read when both match.
+ *
+ *  @return      the node holding the key, or NULL if it is not there
+ */
+static ChainNode *
+findInChain(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, uint32_t *position, int *cost)
+{
+	ChainNode *node;
+	uint32_t i;
+
+	for (node = &table->buckets[tableIndex(table, hash)];
+			node != NULL; node = node->next) {
+		(*cost)++;
+		for (i = 0; i < node->nEntries; i++) {
+			if (node->hash[i] != hash || node->keylen[i] != keylen) {
+				STATS_ADD(aarray, statsBlock(aarray)->hashMismatches, 1);
+				continue;
+			}
+			STATS_ADD(aarray, statsBlock(aarray)->keyCompares, 1);
+			if (memcmp(node->key[i], key, keylen) == 0) {
+				*position = i;
+				return node;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Look up a key in one generation of the table
+ *
+ *  @return      1 if the key was found, with its value in *value,
+ *				 or 0 if it was not
+ */
+int chainLookup(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, void **value, int *cost)
+{
+	ChainNode *node;
+	uint32_t i;
+
+	node = findInChain(aarray, table, key, keylen, hash, &i, cost);
+	if (node == NULL) {
+		return 0;
+	}
+	*value = node->value[i];
+	return 1;
+}
+
+/** start fetching the first node of the chain a hash falls in */
+void chainPrefetch(const SlotTable *table, HashIndex hash)
+{
+#ifdef	__GNUC__
+	__builtin_prefetch(&table->buckets[tableIndex(table, hash)]);
+#endif
+}
+
+/**
+ * Remove a key from one generation of the table.  The hole is filled
+ * with the last entry of the chain, whose node is released once empty
+ * unless it is the one in the table.
+ *
+ *  @return      1 if the key was found, with its value in *value,
+ *				 or 0 if it was not
+ */
+int chainRemove(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, void **value, int *cost)
+{
+	ChainNode *node, *tail, *beforeTail = NULL;
+	uint32_t i, last;
+
+	node = findInChain(aarray, table, key, keylen, hash, &i, cost);
+	if (node == NULL) {
+		return 0;
+	}
+	*value = node->value[i];
+
+	for (tail = &table->buckets[tableIndex(table, hash)];
+			tail->next != NULL; tail = tail->next) {
+		beforeTail = tail;
+	}
+	last = --tail->nEntries;
+	node->keylen[i] = tail->keylen[last];
+	node->hash[i] = tail->hash[last];
+	node->key[i] = tail->key[last];
+	node->value[i] = tail->value[last];
+
+	if (tail->nEntries == 0 && beforeTail != NULL) {
+		beforeTail->next = NULL;
+		lockStore(aarray);
+		freeNode(&aarray->nodes, tail);
+		unlockStore(aarray);
+	}
+	SHARED_ADD(aarray, table->nUsed, -1);
+	return 1;
+}
+
+/**
+ * Move every entry of one chain of a draining table into the current
+ * table, using the hash stored with it, and release the chain's nodes.
+ * The keys stay where they are in the arena.
+ *
+ *  @return      0 on success, or -1 if no memory is left for the
+ *				 nodes, in which case the chain is left where it is
+ */
+int chainDrainBucket(AssociativeArray *aarray, SlotTable *old,
+		HashIndex bucket)
+{
+	SlotTable *table = aarray->table;
+	ChainNode *first = &old->buckets[bucket], *node, *next;
+	size_t nEntries = 0;
+	uint32_t i;
+
+	/** each entry may overflow its new chain, so have a node ready for each */
+	for (node = first; node != NULL; node = node->next) {
+		nEntries += node->nEntries;
+	}
+	if (reserveNodes(&aarray->nodes, nEntries) < 0) {
+		return -1;
+	}
+
+	for (node = first; node != NULL; node = next) {
+		next = node->next;
+		for (i = 0; i < node->nEntries; i++) {
+			linkEntry(aarray, table,
+					tableIndex(table, node->hash[i]), node->key[i],
+					node->keylen[i], node->hash[i], node->value[i]);
+			aarray->rehashesAvoided++;
+			old->nUsed--;
+		}
+		if (node != first) {
+			freeNode(&aarray->nodes, node);
+		}
+	}
+	first->nEntries = 0;
+	first->next = NULL;
+	return 0;
+}
+
+/**
+ * Copy the keys of every entry into a fresh arena with room for them
+ * all; see arenaRebuild() in hash-table.c
+ */
+void chainRebuildKeys(SlotTable *table, KeyArena *fresh)
+{
+	ChainNode *node;
+	HashIndex b;
+	uint32_t i;
+
+	for (b = 0; b < table->size; b++) {
+		for (node = &table->buckets[b]; node != NULL; node = node->next) {
+			for (i = 0; i < node->nEntries; i++) {
+				node->key[i] = arenaCopyKey(fresh, node->key[i],
+						node->keylen[i]);
+			}
+		}
+	}
+}
+
+/**
+ * Visit each entry of one generation of the table, with its hash
+ */
+int chainVisit(SlotTable *table, EntryVisitor visitor, void *userdata)
+{
+	ChainNode *node;
+	HashIndex b;
+	uint32_t i;
+
+	for (b = 0; b < table->size; b++) {
+		for (node = &table->buckets[b]; node != NULL; node = node->next) {
+			for (i = 0; i < node->nEntries; i++) {
+				if ((*visitor)(node->key[i], node->keylen[i], node->hash[i],
+						node->value[i], userdata) < 0) {
+					return -1;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/**
+ * Print out one generation of the table, a line per chain
+ */
+void chainPrint(FILE *fp, SlotTable *table, char *tag)
+{
+	char keybuffer[128];
+	ChainNode *node;
+	HashIndex b;
+	uint32_t i;
+
+	for (b = 0; b < table->size; b++) {
+		fprintf(fp, "%s  %zu :", tag, b);
+		if (table->buckets[b].nEntries == 0) {
+			fprintf(fp, " empty (NULL)\n");
+			continue;
+		}
+		for (node = &table->buckets[b]; node != NULL; node = node->next) {
+			fprintf(fp, " [");
+			for (i = 0; i < node->nEntries; i++) {
+				printableKey(keybuffer, 128, node->key[i], node->keylen[i]);
+				fprintf(fp, "%s'%s'", i > 0 ? " " : "", keybuffer);
+			}
+			fprintf(fp, "]");
+		}
+		fprintf(fp, "\n");
+	}
+}
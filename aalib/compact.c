@@ -0,0 +1,595 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hashtools.h"
+
+/**
+ * The compact engine: the "compact" strategy.
+ *
+ * This engine keeps an entry in the fewest bytes it can, for tables of
+ * many millions of entries where memory, rather than probing, is what
+ * runs out first.  A slot is 16 bytes: 32 bits of the key's hash, a
+ * 32-bit reference to the key and the value pointer.  There are no
+ * control bytes; the two smallest references, which no key can have,
+ * mark a slot empty or deleted.  Slots are probed linearly, comparing
+ * the 32 bits of hash before anything else, so four slots are tested
+ * for each cache line read and the key is hardly ever read on a miss.
+ *
+ * Every key is kept in the array's key heap: one buffer in which each
+ * record is the key's length, in as few bytes as it fits (one, up to
+ * 63 bytes), followed by the key bytes, with no NUL and no padding.
+ * The length also carries a bit marking keys that came in through the
+ * integer key interface.  A reference is the byte offset of a record,
+ * so the heap can hold up to 4GiB of keys; shard the array to hold
+ * more.  The heap grows by a quarter at a time, as the keys of a large
+ * table would take too long to copy to a buffer twice the size, and it
+ * is rebuilt to fit once deletes have left enough of it dead, as the
+ * key arena is.
+ *
+ * The slot's 32 bits of hash also choose where the entry goes, so an
+ * entry is moved to a new table without its key being read again; the
+ * table is never made larger than 2^32 slots, which those bits could
+ * not reach.  The rest of the hash is not kept at all: visiting the
+ * entries, which is rare, hashes each key again as the interface it
+ * came in through did.
+ *
+ * On a million keys, at the default load factor, an entry takes 34.8
+ * bytes rather than the 72.7 of the "linear" strategy for integer keys
+ * and short strings, and 127 rather than 167 for URLs, whose key bytes
+ * both keep alike.  A hit always reads its key from the heap, where
+ * "linear" finds short keys in the slot, so hits take about 1.3 to 1.4
+ * times as long, at one million keys and at eight.
+ */
+
+/** one slot of the table */
+typedef struct CompactSlot {
+	uint32_t hash;
+	uint32_t keyRef;
+	void *value;
+} CompactSlot;
+
+/** the key references that mark a slot empty or deleted */
+#define	COMPACT_EMPTY	0
+#define	COMPACT_DELETED	1
+
+/** the bit of a record's length prefix that marks an integer key */
+#define	COMPACT_INTEGER_KEY	1
+
+/** the largest heap that 32-bit references can reach */
+#define	COMPACT_HEAP_MAX_BYTES	((size_t) UINT32_MAX + 1)
+
+/** the bits of a full hash kept in the slot */
+static inline uint32_t
+slotHash(HashIndex hash)
+{
+	return (uint32_t) hash;
+}
+
+static inline int
+slotIsUsed(const CompactSlot *slot)
+{
+	return slot->keyRef > COMPACT_DELETED;
+}
+
+/** the bytes the length prefix of a record takes */
+static inline size_t
+prefixBytes(uint64_t prefix)
+{
+	size_t n = 1;
+
+	while (prefix >= 0x80) {
+		prefix >>= 7;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * The length prefix of a record, seven bits to a byte, low bits first,
+ * with the top bit of every byte but the last set.  It holds the key's
+ * length shifted up by one, with the integer key bit below it.
+ */
+static inline uint64_t
+recordPrefix(size_t keylen, int flags)
+{
+	return (uint64_t) keylen << 1 | flags;
+}
+
+/** the bytes taken by the record of a key */
+static inline size_t
+recordBytes(size_t keylen, int flags)
+{
+	return prefixBytes(recordPrefix(keylen, flags)) + keylen;
+}
+
+/**
+ * Read the record a key reference points at
+ *
+ *  @return      the key bytes, with their length in *keylen and the
+ *				 integer key bit in *flags
+ */
+static inline AAKeyType
+recordKey(const CompactHeap *heap, uint32_t keyRef, size_t *keylen,
+		int *flags)
+{
+	const unsigned char *bytes = heap->bytes + keyRef;
+	uint64_t prefix = 0;
+	int shift = 0;
+
+	while (*bytes & 0x80) {
+		prefix |= (uint64_t) (*bytes++ & 0x7F) << shift;
+		shift += 7;
+	}
+	prefix |= (uint64_t) *bytes++ << shift;
+
+	*keylen = (size_t) (prefix >> 1);
+	*flags = (int) (prefix & COMPACT_INTEGER_KEY);
+	return (AAKeyType) bytes;
+}
+
+/** the hash the integer key interface gives a key of these bytes */
+static HashIndex
+integerKeyHash(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	uint32_t key32;
+	uint64_t key64;
+
+	if (keylen == sizeof(key32)) {
+		memcpy(&key32, key, sizeof(key32));
+		key64 = key32;
+	} else {
+		memcpy(&key64, key, sizeof(key64));
+	}
+	return mixInteger(key64 ^ aarray->hashSeed.k0);
+}
+
+/**
+ * The integer key bit for a key hashed as it was: set if the key came
+ * in through the integer key interface, which its whole hash tells
+ */
+static int
+keyFlags(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash)
+{
+	if ((keylen == sizeof(uint32_t) || keylen == sizeof(uint64_t))
+			&& integerKeyHash(aarray, key, keylen) == hash) {
+		return COMPACT_INTEGER_KEY;
+	}
+	return 0;
+}
+
+/**
+ * the whole hash of a stored key, which the table does not keep: the
+ * key is hashed again as the interface it came in through hashed it
+ */
+static HashIndex
+keyHash(AssociativeArray *aarray, AAKeyType key, size_t keylen, int flags)
+{
+	if (flags & COMPACT_INTEGER_KEY) {
+		return integerKeyHash(aarray, key, keylen);
+	}
+	return aarray->hashAlgorithmPrimary(key, keylen, &aarray->hashSeed);
+}
+
+
+/**
+ * Set up an empty heap.  The first record starts past the offsets of
+ * the references that mark slots empty or deleted.
+ */
+void compactHeapInit(CompactHeap *heap)
+{
+	heap->bytes = NULL;
+	heap->bytesReserved = 0;
+	heap->bytesUsed = COMPACT_DELETED + 1;
+	heap->bytesLive = 0;
+	heap->bytesDead = 0;
+}
+
+/** give back the heap, and so every key in it */
+void compactHeapDestroy(CompactHeap *heap)
+{
+	free(heap->bytes);
+	compactHeapInit(heap);
+}
+
+/**
+ * Make sure the heap has room for nBytes more
+ *
+ *  @return      0 on success, or -1 if the heap cannot grow that far
+ */
+static int
+heapReserve(CompactHeap *heap, size_t nBytes)
+{
+	size_t needed = heap->bytesUsed + nBytes, size;
+	unsigned char *bytes;
+
+	if (needed <= heap->bytesReserved) {
+		return 0;
+	}
+	if (needed > COMPACT_HEAP_MAX_BYTES) {
+		return -1;
+	}
+
+	size = heap->bytesReserved + heap->bytesReserved / 4;
+	if (size < COMPACT_HEAP_MIN_BYTES) {
+		size = COMPACT_HEAP_MIN_BYTES;
+	}
+	if (size < needed) {
+		size = needed;
+	}
+	if (size > COMPACT_HEAP_MAX_BYTES) {
+		size = COMPACT_HEAP_MAX_BYTES;
+	}
+
+	bytes = (unsigned char *) realloc(heap->bytes, size);
+	if (bytes == NULL) {
+		return -1;
+	}
+	heap->bytes = bytes;
+	heap->bytesReserved = size;
+	return 0;
+}
+
+/**
+ * Copy a key into the heap behind its length prefix, with nothing
+ * after it
+ *
+ *  @return      the reference to the key, or 0 if there is no room
+ */
+static uint32_t
+heapAddKey(CompactHeap *heap, AAKeyType key, size_t keylen, int flags)
+{
+	uint64_t prefix = recordPrefix(keylen, flags);
+	size_t nBytes = recordBytes(keylen, flags);
+	unsigned char *bytes;
+	uint32_t keyRef;
+
+	if (heapReserve(heap, nBytes) < 0) {
+		return 0;
+	}
+
+	keyRef = (uint32_t) heap->bytesUsed;
+	bytes = heap->bytes + keyRef;
+	while (prefix >= 0x80) {
+		*bytes++ = (unsigned char) (prefix | 0x80);
+		prefix >>= 7;
+	}
+	*bytes++ = (unsigned char) prefix;
+	memcpy(bytes, key, keylen);
+	heap->bytesUsed += nBytes;
+	heap->bytesLive += nBytes;
+	return keyRef;
+}
+
+/** note that the key of a slot just emptied is no longer in use */
+static void
+heapReleaseKey(CompactHeap *heap, uint32_t keyRef)
+{
+	size_t keylen, nBytes;
+	int flags;
+
+	recordKey(heap, keyRef, &keylen, &flags);
+	nBytes = recordBytes(keylen, flags);
+
+	heap->bytesLive -= nBytes;
+	heap->bytesDead += nBytes;
+}
+
+/**
+ * Allocate the slots of one generation of the table, all empty
+ *
+ *  @return      0 on success, or -1 if the table is too large to index
+ *				 with 32 bits of hash or no memory is left
+ */
+int compactCreateSlots(SlotTable *table)
+{
+	if (table->size > (HashIndex) UINT32_MAX + 1) {
+		fprintf(stderr, "Cannot make a compact table of %zu slots"
+				" - the most is 2^32\n", table->size);
+		table->packed = NULL;
+		return -1;
+	}
+
+	table->packed = (CompactSlot *) calloc(table->size, sizeof(CompactSlot));
+	return table->packed == NULL ? -1 : 0;
+}
+
+/** the bytes taken by the slots of one generation of the table */
+size_t compactTableBytes(const SlotTable *table)
+{
+	return table->size * sizeof(CompactSlot);
+}
+
+/**
+ * Put an entry whose key is already in the heap into the first free
+ * slot of the current table from its home, reusing tombstones
+ *
+ *  @return      the slot used, or (HashIndex) -1 if the table is full
+ */
+static HashIndex
+placeSlot(SlotTable *table, uint32_t hash, uint32_t keyRef, void *value,
+		int *cost)
+{
+	HashIndex index = tableIndex(table, hash), n;
+	CompactSlot *slot;
+
+	for (n = 0; n < table->size; n++) {
+		slot = &table->packed[index];
+		(*cost)++;
+		if ( ! slotIsUsed(slot)) {
+			if (slot->keyRef == COMPACT_DELETED) {
+				table->nDeleted--;
+			}
+			slot->hash = hash;
+			slot->keyRef = keyRef;
+			slot->value = value;
+			table->nUsed++;
+			return index;
+		}
+		index = nextTableIndex(table, index);
+	}
+	return (HashIndex) -1;
+}
+
+/**
+ * Add an entry to the current table, copying its key into the heap
+ *
+ *  @return      the slot the entry went into, or (HashIndex) -1 if
+ *				 the heap or the table is full
+ */
+HashIndex compactPlace(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *cost)
+{
+	HashIndex index;
+	uint32_t keyRef;
+
+	keyRef = heapAddKey(&aarray->heap, key, keylen,
+			keyFlags(aarray, key, keylen, hash));
+	if (keyRef == 0) {
+		fprintf(stderr, "No room for another key in a key heap of %zu bytes\n",
+				aarray->heap.bytesReserved);
+		return (HashIndex) -1;
+	}
+
+	index = placeSlot(aarray->table, slotHash(hash), keyRef, value, cost);
+	if (index == (HashIndex) -1) {
+		fprintf(stderr, "No room for key in a full table of %zu\n",
+				aarray->table->size);
+		heapReleaseKey(&aarray->heap, keyRef);
+	}
+	return index;
+}
+
+/**
+ * Find the slot holding a key in one generation of the table.  The
+ * key's record is only read once the slot's 32 bits of hash match; the
+ * length, at its head, is compared before the key bytes.  A byte
+ * string and an integer key with the same bytes are told apart by the
+ * integer key bit, which is only worked out once the bytes match.
+ *
+ *  @return      the slot index, or (HashIndex) -1 if the key is not there
+ */
+static HashIndex
+findSlot(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, int *cost)
+{
+	uint32_t wanted = slotHash(hash);
+	HashIndex index = tableIndex(table, wanted), n;
+	CompactSlot *slot;
+	AAKeyType stored;
+	size_t storedLen;
+	int flags;
+
+	for (n = 0; n < table->size; n++) {
+		slot = &table->packed[index];
+		(*cost)++;
+		if (slot->keyRef == COMPACT_EMPTY) {
+			break;
+		}
+		if (slot->keyRef != COMPACT_DELETED && slot->hash == wanted) {
+			stored = recordKey(&aarray->heap, slot->keyRef, &storedLen,
+					&flags);
+			if (storedLen == keylen) {
+				STATS_ADD(aarray, statsBlock(aarray)->keyCompares, 1);
+				if (memcmp(stored, key, keylen) == 0
+						&& flags == keyFlags(aarray, key, keylen, hash)) {
+					return index;
+				}
+			} else {
+				STATS_ADD(aarray, statsBlock(aarray)->hashMismatches, 1);
+			}
+		}
+		index = nextTableIndex(table, index);
+	}
+	return (HashIndex) -1;
+}
+
+/**
+ * Look up a key in one generation of the table
+ *
+ *  @return      1 if the key was found, with its value in *value,
+ *				 or 0 if it was not
+ */
+int compactLookup(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, void **value, int *cost)
+{
+	HashIndex index;
+
+	index = findSlot(aarray, table, key, keylen, hash, cost);
+	if (index == (HashIndex) -1) {
+		return 0;
+	}
+	*value = table->packed[index].value;
+	return 1;
+}
+
+/** start fetching the home slot of a hash */
+void compactPrefetch(const SlotTable *table, HashIndex hash)
+{
+#ifdef	__GNUC__
+	__builtin_prefetch(&table->packed[tableIndex(table, slotHash(hash))]);
+#endif
+}
+
+/**
+ * Remove a key from one generation of the table, leaving a tombstone
+ * so that the probe runs through its slot are not broken
+ *
+ *  @return      1 if the key was found, with its value in *value,
+ *				 or 0 if it was not
+ */
+int compactRemove(AssociativeArray *aarray, SlotTable *table, AAKeyType key,
+		size_t keylen, HashIndex hash, void **value, int *cost)
+{
+	CompactSlot *slot;
+	HashIndex index;
+
+	index = findSlot(aarray, table, key, keylen, hash, cost);
+	if (index == (HashIndex) -1) {
+		return 0;
+	}
+
+	slot = &table->packed[index];
+	*value = slot->value;
+	heapReleaseKey(&aarray->heap, slot->keyRef);
+	slot->keyRef = COMPACT_DELETED;
+	table->nUsed--;
+	table->nDeleted++;
+	return 1;
+}
+
+/**
+ * Move the entry of one slot of a draining table, if it holds one,
+ * into the current table.  Its key stays where it is in the heap, and
+ * the slot is left a tombstone, as entries further along still need
+ * their probe runs to pass through it until they are drained too.
+ */
+void compactDrainSlot(AssociativeArray *aarray, SlotTable *old,
+		HashIndex index)
+{
+	CompactSlot *slot = &old->packed[index];
+	int cost = 0;
+
+	if ( ! slotIsUsed(slot)) {
+		return;
+	}
+
+	/** cannot fail, the new table is larger than all entries */
+	placeSlot(aarray->table, slot->hash, slot->keyRef, slot->value, &cost);
+	aarray->rehashesAvoided++;
+	slot->keyRef = COMPACT_DELETED;
+	old->nUsed--;
+	old->nDeleted++;
+}
+
+/**
+ * Give back the space of deleted keys and the unused end of the heap,
+ * by copying the live keys into a fresh heap of just the right size.
+ * This may only be done when no table is being drained.
+ */
+void compactRebuildHeap(AssociativeArray *aarray)
+{
+	SlotTable *table = aarray->table;
+	CompactHeap *old = &aarray->heap, fresh;
+	size_t keylen, nBytes;
+	uint32_t keyRef;
+	HashIndex i;
+	int flags;
+
+	if (old->bytesDead == 0 && old->bytesUsed >= old->bytesReserved) {
+		return;
+	}
+
+	compactHeapInit(&fresh);
+	if (old->bytesLive > 0) {
+		fresh.bytes = (unsigned char *) malloc(fresh.bytesUsed + old->bytesLive);
+		if (fresh.bytes == NULL) {
+			return; // no memory to spare; keep the old heap
+		}
+		fresh.bytesReserved = fresh.bytesUsed + old->bytesLive;
+	}
+
+	for (i = 0; i < table->size; i++) {
+		if (slotIsUsed(&table->packed[i])) {
+			keyRef = table->packed[i].keyRef;
+			recordKey(old, keyRef, &keylen, &flags);
+			nBytes = recordBytes(keylen, flags);
+			memcpy(fresh.bytes + fresh.bytesUsed, old->bytes + keyRef, nBytes);
+			table->packed[i].keyRef = (uint32_t) fresh.bytesUsed;
+			fresh.bytesUsed += nBytes;
+		}
+	}
+	fresh.bytesLive = old->bytesLive;
+
+	compactHeapDestroy(old);
+	*old = fresh;
+}
+
+/**
+ * Visit each entry of one generation of the table, with its hash.  The
+ * heap keeps no NUL after a key, so each is passed as a copy with one.
+ */
+int compactVisit(AssociativeArray *aarray, SlotTable *table,
+		EntryVisitor visitor, void *userdata)
+{
+	unsigned char *copy = NULL, *grown;
+	size_t keylen, room = 0;
+	CompactSlot *slot;
+	AAKeyType key;
+	HashIndex i;
+	int flags, result = 1;
+
+	for (i = 0; i < table->size && result > 0; i++) {
+		slot = &table->packed[i];
+		if ( ! slotIsUsed(slot)) {
+			continue;
+		}
+		key = recordKey(&aarray->heap, slot->keyRef, &keylen, &flags);
+		if (keylen + 1 > room) {
+			grown = (unsigned char *) realloc(copy, keylen + 1);
+			if (grown == NULL) {
+				result = -1;
+				break;
+			}
+			copy = grown;
+			room = keylen + 1;
+		}
+		memcpy(copy, key, keylen);
+		copy[keylen] = '\0';
+		if ((*visitor)(copy, keylen, keyHash(aarray, key, keylen, flags),
+				slot->value, userdata) < 0) {
+			result = -1;
+		}
+	}
+	free(copy);
+	return result;
+}
+
+/**
+ * Print out one generation of the table, a line per slot.  The key of
+ * a tombstone is not kept, as its record may have been reclaimed.
+ */
+void compactPrint(FILE *fp, AssociativeArray *aarray, SlotTable *table,
+		char *tag)
+{
+	char keybuffer[128];
+	CompactSlot *slot;
+	AAKeyType key;
+	size_t keylen;
+	HashIndex i;
+	int flags;
+
+	for (i = 0; i < table->size; i++) {
+		slot = &table->packed[i];
+		fprintf(fp, "%s  ", tag);
+		if (slot->keyRef == COMPACT_EMPTY) {
+			fprintf(fp, "%zu : empty (NULL)\n", i);
+		} else if (slot->keyRef == COMPACT_DELETED) {
+			fprintf(fp, "%zu : empty (deleted)\n", i);
+		} else {
+			key = recordKey(&aarray->heap, slot->keyRef, &keylen, &flags);
+			printableKey(keybuffer, 128, key, keylen);
+			fprintf(fp, "%zu : in use : '%s'\n", i, keybuffer);
+		}
+	}
+}
@@ -0,0 +1,205 @@
+/**
+ * The locks that let several threads share an array; see
+ * aaSetConcurrency() in hash-table.c for how the operations use them.
+ *
+ * Each of these does nothing for an array that is not in concurrent
+ * mode, so callers need not check first.
+ *
+ * The stripes divide the slots of the current table into nStripes
+ * ranges of consecutive slots.  An entry of the chained engine never
+ * leaves the chain of its home slot, so its writers and lookups lock
+ * just the stripe of that slot.  Under "linear" and "simd" a writer
+ * locks the stripes its probe runs through (see stripeWalkStart()),
+ * and lookups lock none, as entries there are written in the order a
+ * lookup taking no locks relies on.  The other open addressing engines
+ * may probe anywhere or move entries about, so their writers hold the
+ * whole table instead.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtools.h"
+
+/**
+ * Create the locks for an array in concurrent mode
+ *
+ *  @return      the locks, or NULL if no memory is left
+ */
+ConcurrencyControl *
+concurrencyCreate(int nStripes)
+{
+	ConcurrencyControl *cc;
+	int i;
+
+	cc = (ConcurrencyControl *) malloc(sizeof(ConcurrencyControl));
+	if (cc == NULL) {
+		return NULL;
+	}
+	cc->stripes = (StripeLock *) aligned_alloc(sizeof(StripeLock),
+			nStripes * sizeof(StripeLock));
+	cc->threadStats = (ThreadStats *) aligned_alloc(__alignof__(ThreadStats),
+			STATS_BLOCKS * sizeof(ThreadStats));
+	if (cc->stripes == NULL || cc->threadStats == NULL) {
+		free(cc->stripes);
+		free(cc->threadStats);
+		free(cc);
+		return NULL;
+	}
+	memset(cc->threadStats, 0, STATS_BLOCKS * sizeof(ThreadStats));
+
+	pthread_rwlock_init(&cc->tableLock, NULL);
+	pthread_mutex_init(&cc->storeLock, NULL);
+	for (i = 0; i < nStripes; i++) {
+		pthread_mutex_init(&cc->stripes[i].mutex, NULL);
+	}
+	cc->nStripes = nStripes;
+	cc->lockFreeReads = 0;
+	cc->published = NULL;
+	cc->retired = NULL;
+	cc->nRetired = 0;
+	return cc;
+}
+
+/** release the locks of an array, which no thread may be holding */
+void concurrencyDestroy(AssociativeArray *aarray)
+{
+	ConcurrencyControl *cc = aarray->concurrency;
+	int i;
+
+	if (cc == NULL) {
+		return;
+	}
+
+	reclaimRetired(aarray, 1);
+	for (i = 0; i < cc->nStripes; i++) {
+		pthread_mutex_destroy(&cc->stripes[i].mutex);
+	}
+	pthread_mutex_destroy(&cc->storeLock);
+	pthread_rwlock_destroy(&cc->tableLock);
+	free(cc->stripes);
+	free(cc->threadStats);
+	free(cc);
+	aarray->concurrency = NULL;
+}
+
+/** take the whole table, to change it in ways no stripe covers */
+void lockTable(AssociativeArray *aarray)
+{
+	if (aarray->concurrency != NULL) {
+		pthread_rwlock_wrlock(&aarray->concurrency->tableLock);
+	}
+}
+
+/** share the table with other readers and stripe holders */
+void lockTableShared(AssociativeArray *aarray)
+{
+	if (aarray->concurrency != NULL) {
+		pthread_rwlock_rdlock(&aarray->concurrency->tableLock);
+	}
+}
+
+void unlockTable(AssociativeArray *aarray)
+{
+	if (aarray->concurrency != NULL) {
+		pthread_rwlock_unlock(&aarray->concurrency->tableLock);
+	}
+}
+
+/** the stripe of the current table that a slot falls in */
+static int
+stripeOf(AssociativeArray *aarray, HashIndex index)
+{
+	HashIndex size = aarray->table->size;
+	int nStripes = aarray->concurrency->nStripes;
+
+	return (int) (index / ((size + nStripes - 1) / nStripes));
+}
+
+/**
+ * Lock the stripe of the current table that the home slot of a hash
+ * falls in.  The table must be held shared, so that it cannot be
+ * replaced while the stripe is held.
+ *
+ *  @return      the lock taken, to be passed to pthread_mutex_unlock(),
+ *				 or NULL if the array is not in concurrent mode
+ */
+pthread_mutex_t *
+lockStripe(AssociativeArray *aarray, HashIndex hash)
+{
+	ConcurrencyControl *cc = aarray->concurrency;
+	pthread_mutex_t *lock;
+
+	if (cc == NULL) {
+		return NULL;
+	}
+
+	lock = &cc->stripes[stripeOf(aarray, tableIndex(aarray->table, hash))].mutex;
+	pthread_mutex_lock(lock);
+	return lock;
+}
+
+/**
+ * Lock the stripe of a writer's home slot, to begin a walk along the
+ * linear sequence under "linear" or "simd".  The walk takes each
+ * further stripe as it steps into it (stripeWalkReach()), so stripes
+ * are only ever taken in ascending order and two walks cannot wait on
+ * each other.  The table must be held shared, and the array must be in
+ * concurrent mode.
+ */
+void
+stripeWalkStart(AssociativeArray *aarray, StripeWalk *walk, HashIndex index)
+{
+	walk->first = walk->last = stripeOf(aarray, index);
+	pthread_mutex_lock(&aarray->concurrency->stripes[walk->first].mutex);
+}
+
+/**
+ * Make sure the walk holds the stripe of the slot it has stepped to.
+ *
+ *  @return      0 if it does, or -1 if the walk has wrapped around the
+ *				 end of the table into a stripe below the first it holds,
+ *				 which it cannot take without risking a deadlock; the
+ *				 writer must then end the walk and take the whole table
+ */
+int
+stripeWalkReach(AssociativeArray *aarray, StripeWalk *walk, HashIndex index)
+{
+	int stripe = stripeOf(aarray, index);
+
+	if (stripe >= walk->first && stripe <= walk->last) {
+		return 0;
+	}
+	if (stripe != walk->last + 1) {
+		return -1;
+	}
+	pthread_mutex_lock(&aarray->concurrency->stripes[stripe].mutex);
+	walk->last = stripe;
+	return 0;
+}
+
+/** release every stripe a walk holds */
+void
+stripeWalkEnd(AssociativeArray *aarray, StripeWalk *walk)
+{
+	int i;
+
+	for (i = walk->first; i <= walk->last; i++) {
+		pthread_mutex_unlock(&aarray->concurrency->stripes[i].mutex);
+	}
+}
+
+/** guard the key arena and node pool, which all stripes share */
+void lockStore(AssociativeArray *aarray)
+{
+	if (aarray->concurrency != NULL) {
+		pthread_mutex_lock(&aarray->concurrency->storeLock);
+	}
+}
+
+void unlockStore(AssociativeArray *aarray)
+{
+	if (aarray->concurrency != NULL) {
+		pthread_mutex_unlock(&aarray->concurrency->storeLock);
+	}
+}
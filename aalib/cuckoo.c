@@ -0,0 +1,234 @@
+#include <stdio.h>
+
+#include "hashtools.h"
+
+/**
+ * Bucketized cuckoo hashing: the "cuckoo" probing strategy.
+ *
+ * The table is cut into buckets of BUCKET_SLOTS consecutive slots, and
+ * every key may live in just two of them: the bucket holding its home
+ * slot, chosen by the primary hash, and a second one chosen by the
+ * secondary hash (mixed with the primary, so that a weak secondary
+ * such as "len" still spreads keys about).  A search looks in those two
+ * buckets and in the table's small stash, and nowhere else, so its
+ * worst case is fixed however full the table is or however keys
+ * collide.  The control bytes of a bucket are checked before any of
+ * its key/value pairs are read.
+ *
+ * Only that check is held to two cache lines: the four control bytes
+ * of a bucket never straddle a line, so a miss reads one line for each
+ * bucket, plus a pair for each fragment that matches by chance (one
+ * bucket in 32).  The pairs of a bucket span about three lines, so a
+ * hit also reads the line or two under the matching pair, and the
+ * arena line of a long key; the worst case is bounded, but by the
+ * eight pairs of both buckets and the stash rather than by two lines.
+ *
+ * An insert that finds both buckets full evicts an entry from one of
+ * them to its own other bucket, and so on, for up to MAX_KICKS moves.
+ * Should that fail, the entry goes into the stash; should the stash be
+ * full as well, every move is undone and the insert fails, so that the
+ * array grows and tries again.
+ *
+ * Lookups never follow a chain, so deleting simply empties the slot.
+ */
+
+#define	BUCKET_SLOTS	4
+#define	MAX_KICKS		128
+#define	NO_SLOT			((HashIndex) -1)
+
+/** the first slot of the bucket a hash falls in */
+static inline HashIndex
+bucketStart(const SlotTable *table, HashIndex hash)
+{
+	return tableIndex(table, hash) & ~(HashIndex) (BUCKET_SLOTS - 1);
+}
+
+/** one past the last slot of a bucket; the last bucket may be short */
+static inline HashIndex
+bucketEnd(const SlotTable *table, HashIndex start)
+{
+	return start + BUCKET_SLOTS < table->size ? start + BUCKET_SLOTS : table->size;
+}
+
+/** the hash that picks the second bucket of a key */
+static inline HashIndex
+alternateHash(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash)
+{
+	return mixInteger(hash
+			^ aarray->hashAlgorithmSecondary(key, keylen, &aarray->hashSeed));
+}
+
+/** the bucket an entry may move to from the one it is in */
+static HashIndex
+otherBucket(AssociativeArray *aarray, const SlotTable *table,
+		KeyDataPair *entry, HashIndex current)
+{
+	HashIndex first = bucketStart(table, entry->hash);
+
+	if (first != current) {
+		return first;
+	}
+	return bucketStart(table, alternateHash(aarray,
+			slotKey(entry), entry->keylen, entry->hash));
+}
+
+/** the first unused slot in a bucket, if there is one */
+static HashIndex
+freeSlotIn(const SlotTable *table, HashIndex start)
+{
+	HashIndex i, end = bucketEnd(table, start);
+
+	for (i = start; i < end; i++) {
+		if ( ! HASH_IS_USED(table->ctrl[i])) {
+			return i;
+		}
+	}
+	return NO_SLOT;
+}
+
+/** look through one bucket for the key */
+static HashIndex
+searchBucket(AssociativeArray *aarray, SlotTable *table, HashIndex start,
+		AAKeyType key, size_t keylen, HashIndex hash)
+{
+	unsigned char fragment = hashFragment(hash);
+	HashIndex i, end = bucketEnd(table, start);
+
+	for (i = start; i < end; i++) {
+		if (table->ctrl[i] == fragment
+				&& slotMatches(aarray, table, i, key, keylen, hash)) {
+			return i;
+		}
+	}
+	return NO_SLOT;
+}
+
+/** store an entry in a slot, over whatever was there */
+static void
+putEntry(SlotTable *table, HashIndex index, KeyDataPair *entry)
+{
+	table->slots[index] = *entry;
+	setCtrl(table, index, hashFragment(entry->hash));
+}
+
+/**
+ * Place an entry in one of its two buckets, making room by moving
+ * other entries to their other bucket if need be.
+ *
+ *  @return      the slot the new entry went to, or (HashIndex) -1 if
+ *				 no room could be made
+ *  @see    HashPlace
+ */
+HashIndex cuckooPlace(AssociativeArray *aarray, KeyDataPair *entry, int *cost)
+{
+	SlotTable *table = aarray->table;
+	KeyDataPair carried = *entry, displaced;
+	HashIndex path[MAX_KICKS];
+	HashIndex bucket, slot, choice = entry->hash;
+	int kick = 0;
+
+	bucket = bucketStart(table, carried.hash);
+	slot = freeSlotIn(table, bucket);
+	(*cost)++;
+	if (slot == NO_SLOT) {
+		bucket = otherBucket(aarray, table, &carried, bucket);
+		slot = freeSlotIn(table, bucket);
+		(*cost)++;
+	}
+
+	while (slot == NO_SLOT && kick < MAX_KICKS) {
+		/** pick a victim pseudo-randomly, so that moves do not cycle */
+		choice = choice * UINT64_C(6364136223846793005)
+				+ UINT64_C(1442695040888963407);
+		slot = bucket + (HashIndex) (choice >> 33)
+				% (bucketEnd(table, bucket) - bucket);
+
+		displaced = table->slots[slot];
+		putEntry(table, slot, &carried);
+		path[kick++] = slot;
+		carried = displaced;
+
+		bucket = otherBucket(aarray, table, &carried, bucket);
+		slot = freeSlotIn(table, bucket);
+		(*cost)++;
+	}
+
+	if (slot == NO_SLOT && table->nStash < STASH_SLOTS) {
+		slot = table->size + table->nStash++;
+	}
+
+	if (slot == NO_SLOT) {
+		/** put everything back where it was, leaving carried == *entry */
+		while (kick-- > 0) {
+			displaced = table->slots[path[kick]];
+			putEntry(table, path[kick], &carried);
+			carried = displaced;
+		}
+		return NO_SLOT;
+	}
+
+	if (slot < table->size) {
+		if (table->ctrl[slot] == HASH_DELETED) {
+			table->nDeleted--;
+		}
+		putEntry(table, slot, &carried);
+	} else {
+		table->slots[slot] = carried;
+	}
+	table->nUsed++;
+
+	return kick > 0 ? path[0] : slot;
+}
+
+/**
+ * Locate the slot holding the given key: it is in one of its two
+ * buckets, or in the stash.
+ *
+ *  @see    HashSearch
+ */
+HashIndex cuckooSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex first = bucketStart(table, hash), second, index;
+
+	(*cost)++;
+	index = searchBucket(aarray, table, first, key, keylen, hash);
+	if (index != NO_SLOT) {
+		return index;
+	}
+
+	second = bucketStart(table, alternateHash(aarray, key, keylen, hash));
+	if (second != first) {
+		(*cost)++;
+		index = searchBucket(aarray, table, second, key, keylen, hash);
+		if (index != NO_SLOT) {
+			return index;
+		}
+	}
+
+	for (index = table->size; index < table->size + table->nStash; index++) {
+		(*cost)++;
+		if (slotMatches(aarray, table, index, key, keylen, hash)) {
+			return index;
+		}
+	}
+
+	return NO_SLOT;
+}
+
+/**
+ * Empty the slot at index.  A stash entry is replaced by the last one
+ * in the stash, so that the stash stays packed.
+ *
+ *  @see    HashRemove
+ */
+void cuckooRemove(AssociativeArray *aarray, SlotTable *table, HashIndex index)
+{
+	if (index >= table->size) {
+		table->slots[index] = table->slots[table->size + --table->nStash];
+	} else {
+		setCtrl(table, index, HASH_EMPTY);
+	}
+	table->nUsed--;
+}
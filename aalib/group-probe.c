@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <string.h> // for strcmp()
+
+#include "hashtools.h"
+
+/**
+ * Group probing: the "simd" probing strategy.
+ *
+ * This walks the table in the same order as linear probing, but
+ * compares the control bytes of a whole group of consecutive slots at
+ * once (16 with SSE2, 32 with AVX2), in the style of SwissTable.  Each
+ * comparison yields a bitmask with bit i set if slot (pos + i) is of
+ * interest, so a whole group is dismissed with a single test and the
+ * key/value pairs are only touched for slots whose hash fragment
+ * matches.
+ *
+ * The control array carries GROUP_CLONES mirrored bytes past the end
+ * of the table, so a group can be loaded from any slot.
+ *
+ * The implementation is picked when the table is created, from what
+ * the CPU supports; a portable scalar version is used elsewhere.
+ * The strategy may be named as:
+ *	"simd"		: the widest version this CPU supports
+ *	"simd-avx2"	: 32 bytes at a time
+ *	"simd-sse2"	: 16 bytes at a time
+ *	"simd-scalar"	: 16 bytes at a time, one byte per step
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	GROUP_X86	1
+#include <immintrin.h>
+#endif
+
+/**
+ * A lookup that takes no locks loads a group while a writer may store
+ * single control bytes in it.  Each byte is still read whole, and the
+ * fence in groupSearch() orders the reads of the slots after it, but
+ * ThreadSanitizer cannot tell that from a race, and does not follow
+ * fences; built with it, the group is first copied byte by byte with
+ * acquiring loads, as loadCtrl() reads a single byte.
+ */
+#if defined(__SANITIZE_THREAD__)
+#define	GROUP_COPY	1
+#endif
+
+/** one bit per control byte in a group */
+typedef uint32_t GroupMask;
+
+/** index of the lowest set bit in a non-zero mask */
+static inline int
+lowestBit(GroupMask mask)
+{
+#ifdef	__GNUC__
+	return __builtin_ctz(mask);
+#else
+	int bit = 0;
+
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+
+/**
+ * Portable versions, 16 bytes at a time.  Written as plain loops,
+ * which the compiler is free to vectorize.
+ */
+#define	SCALAR_WIDTH	16
+
+static inline GroupMask
+scalarMatch(const unsigned char *ctrl, unsigned char byte)
+{
+	GroupMask mask = 0;
+	int i;
+
+	for (i = 0; i < SCALAR_WIDTH; i++) {
+		mask |= (GroupMask) (ctrl[i] == byte) << i;
+	}
+	return mask;
+}
+
+static inline GroupMask
+scalarMatchEmpty(const unsigned char *ctrl)
+{
+	return scalarMatch(ctrl, HASH_EMPTY);
+}
+
+/** both unused states have the top bit set */
+static inline GroupMask
+scalarMatchEmptyOrDeleted(const unsigned char *ctrl)
+{
+	GroupMask mask = 0;
+	int i;
+
+	for (i = 0; i < SCALAR_WIDTH; i++) {
+		mask |= (GroupMask) (ctrl[i] >> 7) << i;
+	}
+	return mask;
+}
+
+
+#ifdef	GROUP_X86
+/**
+ * SSE2 versions: a compare and a movemask per group.  As the unused
+ * states have the top bit set, movemask of the group alone gives the
+ * empty-or-deleted mask.
+ */
+#define	SSE2_WIDTH	16
+
+__attribute__((target("sse2")))
+static inline GroupMask
+sse2Match(const unsigned char *ctrl, unsigned char byte)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+
+	return (GroupMask) _mm_movemask_epi8(
+			_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+}
+
+__attribute__((target("sse2")))
+static inline GroupMask
+sse2MatchEmpty(const unsigned char *ctrl)
+{
+	return sse2Match(ctrl, HASH_EMPTY);
+}
+
+__attribute__((target("sse2")))
+static inline GroupMask
+sse2MatchEmptyOrDeleted(const unsigned char *ctrl)
+{
+	return (GroupMask) _mm_movemask_epi8(
+			_mm_loadu_si128((const __m128i *) ctrl));
+}
+
+
+/** AVX2 versions, as above but 32 bytes at a time */
+#define	AVX2_WIDTH	32
+
+__attribute__((target("avx2")))
+static inline GroupMask
+avx2Match(const unsigned char *ctrl, unsigned char byte)
+{
+	__m256i group = _mm256_loadu_si256((const __m256i *) ctrl);
+
+	return (GroupMask) _mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) byte)));
+}
+
+__attribute__((target("avx2")))
+static inline GroupMask
+avx2MatchEmpty(const unsigned char *ctrl)
+{
+	return avx2Match(ctrl, HASH_EMPTY);
+}
+
+__attribute__((target("avx2")))
+static inline GroupMask
+avx2MatchEmptyOrDeleted(const unsigned char *ctrl)
+{
+	return (GroupMask) _mm256_movemask_epi8(
+			_mm256_loadu_si256((const __m256i *) ctrl));
+}
+#endif
+
+
+/** the slot for bit number `bit' of the group loaded at pos */
+static inline HashIndex
+groupSlot(const SlotTable *table, HashIndex pos, int bit)
+{
+	HashIndex index = pos + bit;
+
+	/** small tables may see the same slot more than once in a group */
+	if (index >= table->size) {
+		index %= table->size;
+	}
+	return index;
+}
+
+/** the start of the group following the one at pos */
+static inline HashIndex
+nextGroup(const SlotTable *table, HashIndex pos, int width)
+{
+	pos += width;
+	if (pos >= table->size) {
+		pos %= table->size;
+	}
+	return pos;
+}
+
+/**
+ * The body of the search, shared by each implementation.  It is always
+ * inlined, so that the match functions passed in are inlined as well
+ * and each wrapper below is compiled for its own instruction set.
+ *
+ * An empty slot anywhere in a group ends the search: inserts take the
+ * first free slot in this same order, and slots never become empty
+ * again once used, so the key cannot lie beyond it.
+ */
+static inline __attribute__((always_inline)) HashIndex
+groupSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen,
+		HashIndex hash, int *cost, int width,
+		GroupMask (*match)(const unsigned char *, unsigned char),
+		GroupMask (*matchEmpty)(const unsigned char *))
+{
+	unsigned char fragment = hashFragment(hash);
+	HashIndex pos = tableIndex(table, hash);
+	HashIndex seen = 0, index;
+	const unsigned char *group;
+	GroupMask mask;
+#ifdef	GROUP_COPY
+	unsigned char copy[GROUP_CLONES + 1];
+	int b;
+#endif
+
+	/**
+	 * The slot index is only known once the control bytes have been
+	 * loaded, so start fetching the home slot now; most hits are there,
+	 * and this overlaps the two cache misses as a scalar probe would.
+	 */
+#ifdef	__GNUC__
+	__builtin_prefetch(&table->slots[pos]);
+#endif
+
+	(*cost)++;
+	for (;;) {
+#ifdef	GROUP_COPY
+		for (b = 0; b < width; b++) {
+			copy[b] = __atomic_load_n(&table->ctrl[pos + b], __ATOMIC_ACQUIRE);
+		}
+		group = copy;
+#else
+		group = &table->ctrl[pos];
+#endif
+		mask = match(group, fragment);
+
+		/**
+		 * a whole group cannot be loaded atomically; order the reads
+		 * of matching slots after it, as loadCtrl() would
+		 */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		for (; mask != 0; mask &= mask - 1) {
+			index = groupSlot(table, pos, lowestBit(mask));
+			if (slotMatches(aarray, table, index, key, keylen, hash)) {
+				return index;
+			}
+		}
+
+		if (matchEmpty(group) != 0) {
+			return (HashIndex) -1;
+		}
+
+		seen += width;
+		if (seen >= table->size) {
+			return (HashIndex) -1; // The entire table has been searched
+		}
+		pos = nextGroup(table, pos, width);
+		(*cost)++;
+	}
+}
+
+/**
+ * The body of the probe, shared by each implementation: find the first
+ * empty or deleted slot at or after startIndex.  The probe is only used
+ * to find room for an insert, so invalidEndsSearch is not consulted.
+ */
+static inline __attribute__((always_inline)) HashIndex
+groupProbe(SlotTable *table, HashIndex startIndex, int *cost, int width,
+		GroupMask (*matchEmptyOrDeleted)(const unsigned char *))
+{
+	HashIndex pos = startIndex, seen = 0;
+	GroupMask mask;
+
+	for (;;) {
+		mask = matchEmptyOrDeleted(&table->ctrl[pos]);
+		if (mask != 0) {
+			return groupSlot(table, pos, lowestBit(mask));
+		}
+
+		seen += width;
+		if (seen >= table->size) {
+			fprintf(stderr, "Hash table full\n");
+			return (HashIndex) -1;
+		}
+		pos = nextGroup(table, pos, width);
+		(*cost)++;
+	}
+}
+
+
+/**
+ * The instances of the search and probe for each instruction set,
+ * matching the HashSearch and HashProbe types
+ */
+static HashIndex
+scalarGroupSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	return groupSearch(aarray, table, key, keylen, hash, cost,
+			SCALAR_WIDTH, scalarMatch, scalarMatchEmpty);
+}
+
+static HashIndex
+scalarGroupProbe(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex startIndex, int invalidEndsSearch, int *cost)
+{
+	return groupProbe(aarray->table, startIndex, cost,
+			SCALAR_WIDTH, scalarMatchEmptyOrDeleted);
+}
+
+#ifdef	GROUP_X86
+__attribute__((target("sse2")))
+static HashIndex
+sse2GroupSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	return groupSearch(aarray, table, key, keylen, hash, cost,
+			SSE2_WIDTH, sse2Match, sse2MatchEmpty);
+}
+
+__attribute__((target("sse2")))
+static HashIndex
+sse2GroupProbe(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex startIndex, int invalidEndsSearch, int *cost)
+{
+	return groupProbe(aarray->table, startIndex, cost,
+			SSE2_WIDTH, sse2MatchEmptyOrDeleted);
+}
+
+__attribute__((target("avx2")))
+static HashIndex
+avx2GroupSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	return groupSearch(aarray, table, key, keylen, hash, cost,
+			AVX2_WIDTH, avx2Match, avx2MatchEmpty);
+}
+
+__attribute__((target("avx2")))
+static HashIndex
+avx2GroupProbe(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex startIndex, int invalidEndsSearch, int *cost)
+{
+	return groupProbe(aarray->table, startIndex, cost,
+			AVX2_WIDTH, avx2MatchEmptyOrDeleted);
+}
+#endif
+
+
+#define	GROUP_SCALAR	0
+#define	GROUP_SSE2		1
+#define	GROUP_AVX2		2
+
+/** the widest group implementation the running CPU can use */
+static int
+bestGroupVariant(void)
+{
+#ifdef	GROUP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return GROUP_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return GROUP_SSE2;
+	}
+#endif
+	return GROUP_SCALAR;
+}
+
+/**
+ * Work out which implementation a strategy name asks for, falling
+ * back to the best available one if this CPU cannot run it
+ */
+static int
+lookupGroupVariant(const char *name, int complain)
+{
+	int best = bestGroupVariant();
+	int wanted = best;
+
+	if (strcmp(name, "simd-avx2") == 0) {
+		wanted = GROUP_AVX2;
+	} else if (strcmp(name, "simd-sse2") == 0) {
+		wanted = GROUP_SSE2;
+	} else if (strcmp(name, "simd-scalar") == 0) {
+		wanted = GROUP_SCALAR;
+	}
+
+	if (wanted > best && complain) {
+		fprintf(stderr, "Probe strategy '%s' is not supported here - using 'simd'\n",
+				name);
+	}
+	return wanted > best ? best : wanted;
+}
+
+HashProbe groupProbeFor(const char *name)
+{
+	switch (lookupGroupVariant(name, 1)) {
+#ifdef	GROUP_X86
+	case GROUP_AVX2:	return avx2GroupProbe;
+	case GROUP_SSE2:	return sse2GroupProbe;
+#endif
+	default:			return scalarGroupProbe;
+	}
+}
+
+HashSearch groupSearchFor(const char *name)
+{
+	switch (lookupGroupVariant(name, 0)) {
+#ifdef	GROUP_X86
+	case GROUP_AVX2:	return avx2GroupSearch;
+	case GROUP_SSE2:	return sse2GroupSearch;
+#endif
+	default:			return scalarGroupSearch;
+	}
+}
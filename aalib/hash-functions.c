@@ -64,41 +64,39 @@ printableKey(char *buffer, int bufferlen, AAKeyType key, size_t printlen)
 /**
  * Calculate a hash value based on the length of the key
  *
- * Calculate an integer index in the range [0...size-1] for
- * 		the given string key
+ * Calculate an integer hash value for the given string key; the
+ *		table reduces it into the range [0...size-1]
  *
  *  @param  key  key to calculate mapping upon
- *  @param  size boundary for range of allowable return values
- *  @return      integer index associated with key
+ *  @param  seed not used, as this hash is not keyed
+ *  @return      integer hash associated with key
  *
  *  @see    HashAlgorithm
  */
-HashIndex hashByLength(AAKeyType key, size_t keyLength, HashIndex size)
+HashIndex hashByLength(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
-	return keyLength % size;
+	return keyLength;
 }
 
 
-HashIndex customHash(AAKeyType key, size_t keylen, HashIndex tableSize) {
+HashIndex customHash(AAKeyType key, size_t keylen, const HashSeed *seed) {
     HashIndex hash = 0;
 
     for (size_t i = 0; i < keylen; i++) {
-        hash = (hash * 31 + (HashIndex)key[i]) % tableSize;
+        hash = hash * 31 + (HashIndex)key[i];
     }
     return hash;
 }
 /**
  * Calculate a hash value based on the sum of the values in the key
  *
- * Calculate an integer index in the range [0...size-1] for
- * 		the given string key, based on the sum of the values
- *		in the key
+ * Calculate an integer hash value for the given string key,
+ *		based on the sum of the values in the key
  *
  *  param  key  key to calculate mapping upon
- *  param  size boundary for range of allowable return values
- *  return      integer index associated with key
+ *  return      integer hash associated with key
  */
-HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex size)
+HashIndex hashBySum(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
 	HashIndex sum = 0;
     
@@ -114,7 +112,7 @@ HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex size)
 	for(size_t i = 0; i < keyLength; i++){
 		sum += (HashIndex)key[i]; 
 	}
-	return sum % size;
+	return sum;
 }
 /**
  * Locate an empty position in the given array, starting the
@@ -134,7 +132,7 @@ HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex size)
  */
 HashIndex linearProbe(AssociativeArray *hashTable,
 		AAKeyType key, size_t keylength,
-		int index, int invalidEndsSearch, int *cost
+		HashIndex index, int invalidEndsSearch, int *cost
 	)
 {
 	/**
@@ -157,23 +155,75 @@ HashIndex linearProbe(AssociativeArray *hashTable,
 	 * strategy, such as that discussed in class.
 	 */
     // Initial step size for linear probing (1 means moving to the next slot)
-   int j = index;
+   HashIndex j = index;
 
-    while (hashTable->table[j].validity != HASH_EMPTY &&
-           (invalidEndsSearch || hashTable->table[j].validity == HASH_DELETED)) {
-            j = (j + 1) % hashTable->size;
+    while (hashTable->table->ctrl[j] != HASH_EMPTY &&
+           (invalidEndsSearch || hashTable->table->ctrl[j] == HASH_DELETED)) {
+            j = nextTableIndex(hashTable->table, j);
             (*cost)++;
 
         // If we have cycled through the entire table, and it's not empty,
         // then the table is full, and we cannot insert.
         if (j == index) {
             fprintf(stderr, "Hash table full\n");
-            return -1;
+            return (HashIndex) -1;
         }
     }
     return j;
 }
 
+/**
+ * Locate the slot holding the given key, stepping through the table
+ * one slot at a time from the key's home slot.  Only the control
+ * bytes are read until one matches the key's hash fragment.
+ *
+ *  @param  table the generation of the table to search
+ *  @param  hash  the full hash of the key
+ *  @return index of the slot holding the key, or -1 if the key
+ *				is not in the table
+ *
+ *  @see    HashSearch
+ */
+HashIndex linearSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex index = tableIndex(table, hash);
+	HashIndex startIndex = index;
+	unsigned char fragment = hashFragment(hash);
+	unsigned char ctrl;
+
+	(*cost)++;
+	while ((ctrl = loadCtrl(table, index)) != HASH_EMPTY) {
+		if (ctrl == fragment
+				&& slotMatches(aarray, table, index, key, keylen, hash)) {
+			return index;
+		}
+
+		index = nextTableIndex(table, index);
+		if (index == startIndex) {
+			break; // The entire table has been searched
+		}
+		(*cost)++;
+	}
+
+	return (HashIndex) -1;
+}
+
+/**
+ * The s'th slot of the quadratic sequence from startIndex.  On a power
+ * of two table the squares only reach a few of the slots, while the
+ * triangular numbers s(s+1)/2 reach them all.  The probe that places
+ * keys and the search that finds them both step through this.
+ */
+static HashIndex
+quadraticIndex(const SlotTable *table, HashIndex startIndex, HashIndex s)
+{
+    if (table->sizeMask != 0) {
+        return tableIndex(table, startIndex + s * (s + 1) / 2);
+    }
+    return tableIndex(table, startIndex + s * s);  // Quadratic probing formula
+}
+
 /**
  * Locate an empty position in the given array, starting the
  * search at the indicated index, and restricting the search
@@ -191,34 +241,85 @@ HashIndex linearProbe(AssociativeArray *hashTable,
  *  @see    HashProbe
  */
 HashIndex quadraticProbe(AssociativeArray *hashTable, AAKeyType key, size_t keylen,
-    int startIndex, int invalidEndsSearch, int *cost)
+    HashIndex startIndex, int invalidEndsSearch, int *cost)
 {
-    int s = 0;  // Quadratic probing counter
-    int j = startIndex;
+    HashIndex s = 0;  // Quadratic probing counter
+    HashIndex j = startIndex;
 
     // Continue probing until an empty slot or a deleted slot (tombstone) is found, or the entire table is probed
-    while (hashTable->table[j].validity != HASH_EMPTY &&
-           (invalidEndsSearch || hashTable->table[j].validity == HASH_DELETED))
+    while (hashTable->table->ctrl[j] != HASH_EMPTY &&
+           (invalidEndsSearch || hashTable->table->ctrl[j] == HASH_DELETED))
     {
         s++;
-        j = (startIndex + s * s) % hashTable->size;  // Quadratic probing formula
+        j = quadraticIndex(hashTable->table, startIndex, s);
         (*cost)++;
 
         // If we have probed the entire table without finding an empty or deleted slot,
         // then the table is full, and we cannot insert.
-        if (s == hashTable->size)
+        if (s == hashTable->table->size)
         {
            fprintf(stderr, "Hash table full\n");
-           return -1;
+           return (HashIndex) -1;
         }
     }
 
     return j;  // Return the index of the empty or deleted slot found during probing
 }
- 
-	
 
+/**
+ * Locate the slot holding the given key, following the same quadratic
+ * sequence from the key's home slot as quadraticProbe() placed it by.
+ * Tombstones are passed over, as the key may have been placed beyond
+ * them; an empty slot ends the search.
+ *
+ *  @see    HashSearch
+ */
+HashIndex quadraticSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex startIndex = tableIndex(table, hash);
+	HashIndex index = startIndex;
+	HashIndex s = 0;
+	unsigned char fragment = hashFragment(hash);
+	unsigned char ctrl;
+
+	(*cost)++;
+	while ((ctrl = loadCtrl(table, index)) != HASH_EMPTY) {
+		if (ctrl == fragment
+				&& slotMatches(aarray, table, index, key, keylen, hash)) {
+			return index;
+		}
 
+		s++;
+		if (s == table->size) {
+			break; // As many probes as the insert would make
+		}
+		index = quadraticIndex(table, startIndex, s);
+		(*cost)++;
+	}
+
+	return (HashIndex) -1;
+}
+
+/**
+ * The step the double hashing sequence of a key takes through a table,
+ * from the secondary hash.  A zero step never moves, and on a power of
+ * two table only an odd step visits every slot.
+ */
+static HashIndex
+doubleHashStep(AssociativeArray *aarray, const SlotTable *table,
+		AAKeyType key, size_t keylen)
+{
+    HashIndex stepSize = tableIndex(table,
+            aarray->hashAlgorithmSecondary(key, keylen, &aarray->hashSeed));
+
+    if (table->sizeMask != 0) {
+        stepSize |= 1;
+    } else if (stepSize == 0) {
+        stepSize = 1;
+    }
+    return stepSize;
+}
 
 /**
  * Locate an empty position in the given array, starting the
@@ -236,50 +337,67 @@ HashIndex quadraticProbe(AssociativeArray *hashTable, AAKeyType key, size_t keyl
  *
  *  @see    HashProbe
  */
-	/**
-	 * TO DO: you will need to implement an algorithm
-	 * that calls a second hash function (listed
-	 * in the hashTable) and uses the value obtained
-	 * as a result from that as the step size.
-	 *
-	 * Beyond that, the algorithm proceeds as with
-	 * the above strategies.
-	 */
-HashIndex doubleHashProbe(AssociativeArray *hashTable, AAKeyType key, size_t keylen, int startIndex, int invalidEndsSearch, int *cost)
+HashIndex doubleHashProbe(AssociativeArray *hashTable, AAKeyType key, size_t keylen, HashIndex startIndex, int invalidEndsSearch, int *cost)
 {
-    /**
-     * TO DO: you will need to implement an algorithm
-     * that calls a second hash function (listed
-     * in the hashTable) and uses the value obtained
-     * as a result from that as the step size.
-     *
-     * Beyond that, the algorithm proceeds as with
-     * the above strategies.
-     */
-
     // Get the step size from the second hash function
-    HashIndex stepSize = hashTable->hashAlgorithmSecondary(key, keylen, hashTable->size);
+    HashIndex stepSize = doubleHashStep(hashTable, hashTable->table, key, keylen);
 
     // Initialize the starting index for probing
-    int j = startIndex;
-    int s = 0; // Counter for the number of probes
+    HashIndex j = startIndex;
+    HashIndex s = 0; // Counter for the number of probes
 
-    while (hashTable->table[j].validity != HASH_EMPTY &&
-           (invalidEndsSearch || hashTable->table[j].validity == HASH_DELETED))
+    while (hashTable->table->ctrl[j] != HASH_EMPTY &&
+           (invalidEndsSearch || hashTable->table->ctrl[j] == HASH_DELETED))
     {
         // Update the step size based on the result of the second hash function
         s++;
-        j = (startIndex + s * stepSize) % hashTable->size;
+        j = tableIndex(hashTable->table, startIndex + s * stepSize);
         (*cost)++;
 
         // If we have cycled through the entire table, and it's not empty,
         // then the table is full, and we cannot insert.
-        if (s == hashTable->size)
+        if (s == hashTable->table->size)
         {
             fprintf(stderr, "Hash table full\n");
-            return -1;
+            return (HashIndex) -1;
         }
     }
 
     return j;
 }
+
+/**
+ * Locate the slot holding the given key, stepping from its home slot
+ * by the key's secondary hash, as doubleHashProbe() placed it.  The
+ * step is worked out for the table searched, which during growth may
+ * be the old one.
+ *
+ *  @see    HashSearch
+ */
+HashIndex doubleHashSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex startIndex = tableIndex(table, hash);
+	HashIndex index = startIndex;
+	HashIndex stepSize = doubleHashStep(aarray, table, key, keylen);
+	HashIndex s = 0;
+	unsigned char fragment = hashFragment(hash);
+	unsigned char ctrl;
+
+	(*cost)++;
+	while ((ctrl = loadCtrl(table, index)) != HASH_EMPTY) {
+		if (ctrl == fragment
+				&& slotMatches(aarray, table, index, key, keylen, hash)) {
+			return index;
+		}
+
+		s++;
+		if (s == table->size) {
+			break; // The whole sequence has been searched
+		}
+		index = tableIndex(table, startIndex + s * stepSize);
+		(*cost)++;
+	}
+
+	return (HashIndex) -1;
+}
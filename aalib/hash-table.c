@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 
 #include "hashtools.h"
@@ -9,6 +10,18 @@
 /** forward declaration */
 static HashAlgorithm lookupNamedHashStrategy(const char *name);
 static HashProbe lookupNamedProbingStrategy(const char *name);
+static HashSearch lookupNamedSearchStrategy(const char *name);
+static HashPlace lookupNamedPlacementStrategy(const char *name);
+static HashRemove lookupNamedRemovalStrategy(const char *name);
+static SlotTable *createSlotTable(HashIndex size, int powerOfTwo,
+		int chained, int compact);
+static void drainSlots(AssociativeArray *aarray, HashIndex nSlots);
+static int insertHashed(AssociativeArray *aarray, AAKeyType key,
+		size_t keylen, HashIndex hash, void *value);
+static void *lookupHashed(AssociativeArray *aarray, AAKeyType key,
+		size_t keylen, HashIndex hash);
+static void *deleteHashed(AssociativeArray *aarray, AAKeyType key,
+		size_t keylen, HashIndex hash);
 
 /**
  * Create a hash table of the given size,
@@ -17,16 +30,20 @@ static HashProbe lookupNamedProbingStrategy(const char *name);
  *
  *  @param  hash  the HashAlgorithm to use
  *  @param  probingStrategy algorithm used for probing in the case of
- *				collisions
+ *				collisions, or "chain" to chain colliding entries
+ *				in nodes outside the table instead, or "compact"
+ *				to probe linearly in as little memory as possible
  *  @param  newHashSize  the size of the table (will be rounded up
- *				to the next-nearest larger prime, but see exception)
+ *				to the next-nearest larger prime, but see exception).
+ *				The table grows past this size as it fills,
+ *				see aaSetMaxLoadFactor()
  *  @see         HashAlgorithm
  *  @see         HashProbe
  *  @see         Primes
  *
  *  @throws java.lang.IndexOutOfBoundsException if no prime number larger
- *		              		than newHashSize can be found (currently only primes
- *				less than 5000 are known)
+ *		              		than newHashSize can be found (primes up to about
+ *				2^40 are known)
  */
 AssociativeArray *
 aaCreateAssociativeArray(
@@ -37,34 +54,161 @@ aaCreateAssociativeArray(
 	)
 {
 	AssociativeArray *newTable;
+	HashIndex tableSize;
+	int chained = (strncmp(probingStrategy, "cha", 3) == 0);
+	int compact = (strncmp(probingStrategy, "com", 3) == 0);
+
+	/** a chain holds several entries, so fewer of them give the same room */
+	if (chained) {
+		size = size / CHAIN_NODE_ENTRIES + 1;
+	}
+	tableSize = getLargerPrime(size);
+
+	if (tableSize < 1) {
+		fprintf(stderr, "Cannot create table of size %ld\n", size);
+		return NULL;
+	}
 
 	newTable = (AssociativeArray *) malloc(sizeof(AssociativeArray));
 
+	newTable->table = createSlotTable(tableSize, 0, chained, compact);
+	if (newTable->table == NULL) {
+		fprintf(stderr, "Cannot allocate table of size %zu\n", tableSize);
+		free(newTable);
+		return NULL;
+	}
+	newTable->draining = NULL;
+	newTable->drainIndex = 0;
+	newTable->maxLoadFactor = DEFAULT_MAX_LOAD_FACTOR;
+	newTable->maxTombstoneFactor = DEFAULT_MAX_TOMBSTONE_FACTOR;
+	newTable->powerOfTwoSizes = 0;
+
+	randomHashSeed(&newTable->hashSeed);
+	newTable->hashSeedPinned = 0;
 	newTable->hashAlgorithmPrimary = lookupNamedHashStrategy(hashPrimary);
 	newTable->hashNamePrimary = strdup(hashPrimary);
 	newTable->hashAlgorithmSecondary = lookupNamedHashStrategy(hashSecondary);
 	newTable->hashNameSecondary = strdup(hashSecondary);
 	newTable->hashProbe = lookupNamedProbingStrategy(probingStrategy);
+	newTable->hashSearch = lookupNamedSearchStrategy(probingStrategy);
+	newTable->hashPlace = lookupNamedPlacementStrategy(probingStrategy);
+	newTable->hashRemove = lookupNamedRemovalStrategy(probingStrategy);
 	newTable->probeName = strdup(probingStrategy);
 
-	newTable->size = getLargerPrime(size);
+	newTable->nEntries = 0;
+	arenaInit(&newTable->keys);
+	newTable->drainingKeys = NULL;
+	newTable->linearPlacement = (strncmp(probingStrategy, "lin", 3) == 0
+			|| strncmp(probingStrategy, "sim", 3) == 0);
+	newTable->chained = chained;
+	chainPoolInit(&newTable->nodes);
+	newTable->compact = compact;
+	compactHeapInit(&newTable->heap);
+	newTable->concurrency = NULL;
+	newTable->shards = NULL;
+	newTable->nShards = 0;
+	newTable->snapshot = NULL;
 
-	if (newTable->size < 1) {
-		fprintf(stderr, "Cannot create table of size %ld\n", size);
-		free(newTable);
+	memset(&newTable->counts, 0, sizeof(StatsBlock));
+	newTable->latencyPeriod = 0;
+	newTable->rehashesAvoided = 0;
+	newTable->compactions = 0;
+
+	return newTable;
+}
+
+/**
+ * Precompute how hashes are reduced into this table's index range.
+ * Power of two sizes are masked; anything else uses the fastmod
+ * multiplier, which is ceil(2^128 / size).
+ *
+ * @see tableIndex()
+ */
+static void
+setTableReduction(SlotTable *table, int powerOfTwo)
+{
+	table->sizeMask = powerOfTwo ? table->size - 1 : 0;
+#ifdef	__SIZEOF_INT128__
+	table->fastModMultiplier = ((unsigned __int128) -1) / table->size + 1;
+#endif
+}
+
+/**
+ * Allocate one generation of slots, all marked empty, or for the
+ * chained engine one generation of empty chains
+ */
+static SlotTable *
+createSlotTable(HashIndex size, int powerOfTwo, int chained, int compact)
+{
+	SlotTable *newSlots;
+
+	newSlots = (SlotTable *) malloc(sizeof(SlotTable));
+	if (newSlots == NULL)
 		return NULL;
+
+	newSlots->size = size;
+	newSlots->nUsed = 0;
+	newSlots->nDeleted = 0;
+	newSlots->nStash = 0;
+	newSlots->older = NULL;
+	newSlots->newer = NULL;
+	setTableReduction(newSlots, powerOfTwo);
+
+	newSlots->ctrl = NULL;
+	newSlots->slots = NULL;
+	newSlots->buckets = NULL;
+	newSlots->packed = NULL;
+	if (chained || compact) {
+		if ((chained ? chainCreateBuckets(newSlots)
+					: compactCreateSlots(newSlots)) < 0) {
+			free(newSlots);
+			return NULL;
+		}
+		return newSlots;
 	}
 
-	newTable->table = (KeyDataPair *) malloc(newTable->size * sizeof(KeyDataPair));
+	newSlots->ctrl = (unsigned char *) malloc(size + GROUP_CLONES);
+	newSlots->slots = (KeyDataPair *) calloc(size + STASH_SLOTS,
+			sizeof(KeyDataPair));
+	if (newSlots->ctrl == NULL || newSlots->slots == NULL) {
+		free(newSlots->ctrl);
+		free(newSlots->slots);
+		free(newSlots);
+		return NULL;
+	}
+	memset(newSlots->ctrl, HASH_EMPTY, size + GROUP_CLONES);
 
-	/** initialize everything with zeros */
-	memset(newTable->table, 0, newTable->size * sizeof(KeyDataPair));
+	return newSlots;
+}
 
-	newTable->nEntries = 0;
+/**
+ * Free one generation of slots.  The keys too long to be inline belong
+ * to the key arena, and the overflow nodes of any chains to the node
+ * pool; both are released along with the array.
+ */
+static void
+deleteSlotTable(SlotTable *slots)
+{
+	free(slots->ctrl);
+	free(slots->slots);
+	free(slots->buckets);
+	free(slots->packed);
+	free(slots);
+}
 
-	newTable->insertCost = newTable->searchCost = newTable->deleteCost = 0;
+/** deleteSlotTable() in the form retireBlock() calls back */
+static void
+releaseSlotTable(void *table)
+{
+	deleteSlotTable((SlotTable *) table);
+}
 
-	return newTable;
+/** release a key arena set aside by arenaRebuild() or a drain */
+static void
+releaseKeyArena(void *arena)
+{
+	arenaDestroy((KeyArena *) arena);
+	free(arena);
 }
 
 /**
@@ -75,49 +219,324 @@ aaCreateAssociativeArray(
 void
 aaDeleteAssociativeArray(AssociativeArray *aarray)
 {
-	/**
-	 * TO DO:  clean up the memory managed by our utility
-	 *
-	 * Note that memory for keys are managed, values are the
-	 * responsibility of the user
-	 */
-	     // Free memory for the hash table
-    if(aarray == NULL){
-	return;
+	if (aarray == NULL) {
+		return;
 	}
-	for(int i = 0; i < aarray->size; i++){
-		if(aarray->table[i].validity == HASH_USED || aarray->table[i].validity == HASH_DELETED){
-                    if(aarray->table[i].key != NULL){	
-			free(aarray->table[i].key);
+
+	deleteSlotTable(aarray->table);
+	if (aarray->draining != NULL) {
+		deleteSlotTable(aarray->draining);
+	}
+	arenaDestroy(&aarray->keys);
+	if (aarray->drainingKeys != NULL) {
+		releaseKeyArena(aarray->drainingKeys);
+	}
+	chainPoolDestroy(&aarray->nodes);
+	compactHeapDestroy(&aarray->heap);
+	concurrencyDestroy(aarray);
+	shardsDestroy(aarray);
+	snapshotRelease(aarray);
+
+	// Free memory for hash strategy names
+	free(aarray->hashNamePrimary);
+	free(aarray->hashNameSecondary);
+	free(aarray->probeName);
+	free(aarray);
 }
-		}}
-	
 
-    // Free memory for hash strategy names
-    free(aarray->hashNamePrimary);
-    free(aarray->hashNameSecondary);
-    free(aarray->probeName);
-    free(aarray->table);
-    free(aarray);
+/**
+ * Set the fraction of the table (live entries and tombstones together)
+ * that may be in use before the table is grown.
+ *
+ *  @param  loadFactor  a value in the range (0...1)
+ *  @return      0 on success, or a negative number if the value is
+ *				 out of range
+ */
+int
+aaSetMaxLoadFactor(AssociativeArray *aarray, double loadFactor)
+{
+	int i;
+
+	if (loadFactor <= 0.0 || loadFactor >= 1.0) {
+		fprintf(stderr, "Invalid load factor %g - must be between 0 and 1\n",
+				loadFactor);
+		return -1;
+	}
+	aarray->maxLoadFactor = loadFactor;
+	for (i = 0; i < aarray->nShards; i++) {
+		aarray->shards[i]->maxLoadFactor = loadFactor;
+	}
+	return 0;
 }
 
 /**
- * iterate over the array, calling the user function on each valid value
+ * Set the fraction of the table that may hold tombstones before they
+ * are cleared out.  Clearing them costs a pass over the table, spread
+ * over the operations that follow, so a lower limit trades more of
+ * that work for shorter searches in between.
+ *
+ *  @param  fraction  a value in the range (0...1)
+ *  @return      0 on success, or a negative number if the value is
+ *				 out of range
  */
-int aaIterateAction(
-		AssociativeArray *aarray,
-		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
-		void *userdata
-	)
+int
+aaSetMaxTombstoneFactor(AssociativeArray *aarray, double fraction)
+{
+	int i;
+
+	if (fraction <= 0.0 || fraction >= 1.0) {
+		fprintf(stderr, "Invalid tombstone factor %g - must be between 0 and 1\n",
+				fraction);
+		return -1;
+	}
+	aarray->maxTombstoneFactor = fraction;
+	for (i = 0; i < aarray->nShards; i++) {
+		aarray->shards[i]->maxTombstoneFactor = fraction;
+	}
+	return 0;
+}
+
+/**
+ * Work out the size of a new table holding at least minSize slots,
+ * following the array's size policy.
+ *
+ *  @return      the new size, or 0 if no table that large can be made
+ */
+static HashIndex
+tableSizeFor(AssociativeArray *aarray, HashIndex minSize)
+{
+	HashIndex size = 2;
+
+	if ( ! aarray->powerOfTwoSizes) {
+		return getLargerPrime(minSize);
+	}
+
+	while (size < minSize) {
+		if (size > ((HashIndex) -1) / 2) {
+			return 0;
+		}
+		size <<= 1;
+	}
+	return size;
+}
+
+/**
+ * Choose how table sizes are picked, by name:
+ *	"prime"	: sizes come from a ladder of primes, and hashes are
+ *			reduced with a multiply based modulus (the default)
+ *	"pow2"	: sizes are powers of two, and hashes are reduced with
+ *			a mask.  This is fastest, but only hashes that mix
+ *			their low bits well will spread out evenly.
+ *
+ * The policy applies to every table made from here on; an empty
+ * array is resized straight away.
+ *
+ *  @return      0 on success, or a negative number for an unknown name
+ */
+int
+aaSetSizePolicy(AssociativeArray *aarray, char *policy)
+{
+	SlotTable *newTable;
+	int i;
+
+	if (strncmp(policy, "pow", 3) == 0) {
+		aarray->powerOfTwoSizes = 1;
+	} else if (strncmp(policy, "pri", 3) == 0) {
+		aarray->powerOfTwoSizes = 0;
+	} else {
+		fprintf(stderr, "Invalid size policy '%s'\n", policy);
+		return -1;
+	}
+
+	if (aarray->nEntries == 0 && aarray->draining == NULL
+			&& aarray->table->nDeleted == 0) {
+		newTable = createSlotTable(
+				tableSizeFor(aarray, aarray->table->size),
+				aarray->powerOfTwoSizes, aarray->chained, aarray->compact);
+		if (newTable == NULL) {
+			return -1;
+		}
+		retireBlock(aarray, aarray->table, releaseSlotTable);
+		aarray->table = newTable;
+		publishTable(aarray);
+	}
+
+	for (i = 0; i < aarray->nShards; i++) {
+		if (aaSetSizePolicy(aarray->shards[i], policy) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Replace the random seed chosen for the keyed hashes with a fixed
+ * one, so that a run can be reproduced.  As every stored entry was
+ * placed using the old seed, this may only be done while the array
+ * is still unused.
+ *
+ *  @return      0 on success, or a negative number if the array
+ *				 already holds entries
+ */
+int
+aaSetHashSeed(AssociativeArray *aarray, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < aarray->nShards; i++) {
+		if (aaSetHashSeed(aarray->shards[i], seed) < 0) {
+			return -1;
+		}
+	}
+
+	if (aarray->nEntries != 0 || aarray->draining != NULL
+			|| aarray->table->nDeleted != 0) {
+		fprintf(stderr, "Cannot change the hash seed of an array in use\n");
+		return -1;
+	}
+
+	/** spread the one word over both halves of the key */
+	aarray->hashSeed.k0 = mixInteger(seed);
+	aarray->hashSeed.k1 = mixInteger(~seed);
+	aarray->hashSeedPinned = 1;
+	return 0;
+}
+
+/**
+ * Let several threads insert, look up and delete at once.  Lookups
+ * share the table under every strategy.  On the chained, "linear" and
+ * "simd" engines writers share it as well: a chained writer locks the
+ * stripe of slots that its key falls in, and a linear one each stripe
+ * its probe runs through, so writers in different stripes run in
+ * parallel.  Every other engine ("compact" too) still serialises its
+ * writers, and takes no notice of nStripes, as a write there may probe
+ * or move entries anywhere; sharding the array (aaSetShards()) is the
+ * way to run writers in parallel on those.
+ *
+ * Growth still moves DRAIN_STEP slots per operation, but only writers
+ * do the moving, each holding the whole table for its step, so that
+ * lookups never change the table.  Writers go back to their stripes
+ * once the old table is empty.
+ *
+ * This, like the other aaSet calls, must be made before the array is
+ * shared between threads, and the whole-array calls (iterating,
+ * printing, reserving and compacting) hold the table throughout.
+ *
+ *  @param  nStripes  the number of stripe locks to divide the table into
+ *  @return      0 on success, or a negative number if nStripes is not
+ *				 positive or the locks cannot be made
+ */
+int
+aaSetConcurrency(AssociativeArray *aarray, int nStripes)
+{
+	int i;
+
+	if (nStripes <= 0) {
+		fprintf(stderr, "Invalid stripe count %d - must be positive\n",
+				nStripes);
+		return -1;
+	}
+
+	/** a sharded array only routes keys, so just its shards need locks */
+	if (aarray->shards != NULL) {
+		for (i = 0; i < aarray->nShards; i++) {
+			if (aaSetConcurrency(aarray->shards[i], nStripes) < 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+	if (aarray->concurrency != NULL) {
+		fprintf(stderr, "Array is already in concurrent mode\n");
+		return -1;
+	}
+
+	if (aarray->draining != NULL) {
+		drainSlots(aarray, aarray->draining->size);
+	}
+	aarray->concurrency = concurrencyCreate(nStripes);
+	if (aarray->concurrency == NULL) {
+		fprintf(stderr, "Cannot allocate %d stripe locks\n", nStripes);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Let lookups run without taking any lock or writing to the array, for
+ * tables that are loaded once and then mostly read by many threads.
+ * Writers lock as aaSetConcurrency() describes.
+ *
+ * A lookup must never see an entry half written, or one moved while it
+ * reads it, so this is only offered for the "linear" and "simd"
+ * strategies, where an entry stays in its slot until it is deleted.
+ * In this mode a deleted slot is not reused, as a lookup may still be
+ * reading the entry that was there; the tombstones are cleared out by
+ * moving to a fresh table instead.  Replaced tables and key arenas are
+ * only freed once no lookup can still be reading them (see reclaim.c),
+ * but the values themselves belong to the caller: a value deleted from
+ * the array may still be returned to a lookup that was under way.
+ *
+ * Probe and key comparison counts are not kept for these lookups.
+ * As with aaSetConcurrency(), this must be set before the array is
+ * shared between threads, and puts the array in concurrent mode if it
+ * is not already.
+ *
+ *  @return      0 on success, or a negative number if the probing
+ *				 strategy moves entries or no locks can be made
+ */
+int
+aaSetLockFreeReads(AssociativeArray *aarray)
 {
 	int i;
 
-	for (i = 0; i < aarray->size; i++) {
-		if (aarray->table[i].validity == HASH_USED) {
-			if ((*userfunction)(
-					aarray->table[i].key,
-		             		aarray->table[i].keylen,
-					aarray->table[i].value,
+	for (i = 0; i < aarray->nShards; i++) {
+		if (aaSetLockFreeReads(aarray->shards[i]) < 0) {
+			return -1;
+		}
+	}
+	if (aarray->shards != NULL) {
+		return 0;
+	}
+
+	if ( ! aarray->linearPlacement) {
+		fprintf(stderr, "Lookups on '%s' probing cannot run without locks"
+				" - use 'linear' or 'simd'\n", aarray->probeName);
+		return -1;
+	}
+	if (aarray->concurrency == NULL && aaSetConcurrency(aarray, 1) < 0) {
+		return -1;
+	}
+
+	aarray->concurrency->lockFreeReads = 1;
+	publishTable(aarray);
+	return 0;
+}
+
+/**
+ * Visit each used slot of one generation of the table, with the hash
+ * stored in it
+ */
+static int
+visitSlotTable(AssociativeArray *aarray, SlotTable *table,
+		EntryVisitor visitor, void *userdata)
+{
+	HashIndex i;
+
+	if (table->buckets != NULL) {
+		return chainVisit(table, visitor, userdata);
+	}
+	if (table->packed != NULL) {
+		return compactVisit(aarray, table, visitor, userdata);
+	}
+
+	for (i = 0; i < table->size + table->nStash; i++) {
+		if (i >= table->size || HASH_IS_USED(table->ctrl[i])) {
+			if ((*visitor)(
+					slotKey(&table->slots[i]),
+					table->slots[i].keylen,
+					table->slots[i].hash,
+					table->slots[i].value,
 					userdata) < 0) {
 				return -1;
 			}
@@ -126,6 +545,68 @@ int aaIterateAction(
 	return 1;
 }
 
+/**
+ * Visit every entry of the array, wherever it is kept: in any shard,
+ * in either generation of the table, or in a snapshot
+ *
+ *  @return      1 once every entry has been visited, or -1 if the
+ *				 visitor asked to stop
+ */
+int visitEntries(AssociativeArray *aarray, EntryVisitor visitor, void *userdata)
+{
+	int result, i;
+
+	if (aarray->shards != NULL) {
+		for (i = 0; i < aarray->nShards; i++) {
+			if (visitEntries(aarray->shards[i], visitor, userdata) < 0) {
+				return -1;
+			}
+		}
+		return 1;
+	}
+	if (aarray->snapshot != NULL) {
+		return snapshotVisit(aarray, visitor, userdata);
+	}
+
+	lockTable(aarray);
+	result = visitSlotTable(aarray, aarray->table, visitor, userdata);
+	if (result >= 0 && aarray->draining != NULL) {
+		result = visitSlotTable(aarray, aarray->draining, visitor, userdata);
+	}
+	unlockTable(aarray);
+	return result;
+}
+
+/** the user function of aaIterateAction(), as visitEntries() calls it */
+typedef struct IterateAction {
+	int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata);
+	void *userdata;
+} IterateAction;
+
+static int
+callIterateAction(AAKeyType key, size_t keylen, HashIndex hash,
+		void *value, void *action)
+{
+	return (*((IterateAction *) action)->userfunction)(key, keylen, value,
+			((IterateAction *) action)->userdata);
+}
+
+/**
+ * iterate over the array, calling the user function on each valid value
+ */
+int aaIterateAction(
+		AssociativeArray *aarray,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata
+	)
+{
+	IterateAction action;
+
+	action.userfunction = userfunction;
+	action.userdata = userdata;
+	return visitEntries(aarray, callIterateAction, &action);
+}
+
 /** utilities to change names into functions, used in the function above */
 static HashAlgorithm lookupNamedHashStrategy(const char *name)
 {
@@ -137,6 +618,13 @@ static HashAlgorithm lookupNamedHashStrategy(const char *name)
         else if (strncmp(name, "custom", 6) == 0) {
         return customHash;
     }
+	else if (strncmp(name, "sip", 3) == 0) {
+		return sipHash13;
+	} else if (strncmp(name, "wy", 2) == 0) {
+		return wyhash;
+	} else if (strncmp(name, "mur", 3) == 0) {
+		return murmurHash;
+	}
 		// TO DO: add in your own strategy here
 
 	fprintf(stderr, "Invalid hash strategy '%s' - using 'sum'\n", name);
@@ -151,239 +639,1562 @@ static HashProbe lookupNamedProbingStrategy(const char *name)
 		return quadraticProbe;
 	}else if (strncmp(name, "dou", 3) == 0) {
 		return doubleHashProbe;
+	}else if (strncmp(name, "rob", 3) == 0) {
+		return linearProbe; // robinHoodPlace() walks the same order
+	}else if (strncmp(name, "cuc", 3) == 0) {
+		return linearProbe; // not used; cuckooPlace() moves entries itself
+	}else if (strncmp(name, "sim", 3) == 0) {
+		return groupProbeFor(name);
+	}else if (strncmp(name, "cha", 3) == 0) {
+		return linearProbe; // not used; the chained engine has no probes
+	}else if (strncmp(name, "com", 3) == 0) {
+		return linearProbe; // not used; compactPlace() probes its own slots
 	}
 
 	fprintf(stderr, "Invalid hash probe strategy '%s' - using 'linear'\n", name);
 	return linearProbe;
 }
 
+static HashSearch lookupNamedSearchStrategy(const char *name)
+{
+	if (strncmp(name, "sim", 3) == 0) {
+		return groupSearchFor(name);
+	} else if (strncmp(name, "qua", 3) == 0) {
+		return quadraticSearch;
+	} else if (strncmp(name, "dou", 3) == 0) {
+		return doubleHashSearch;
+	} else if (strncmp(name, "rob", 3) == 0) {
+		return robinHoodSearch;
+	} else if (strncmp(name, "cuc", 3) == 0) {
+		return cuckooSearch;
+	}
+
+	return linearSearch;
+}
+
 /**
- * Add another key and data value to the table, provided there is room.
+ * Put an entry in the first free slot the probing strategy finds,
+ * the placement used by all but the Robin Hood strategy
  *
- *  @param  key  a string value used for searching later
- *  @param  value a data value associated with the key
- *  @return      the location the data is placed within the hash table,
- *				 or a negative number if no place can be found
+ *  @return      the slot used, or (HashIndex) -1 if the table is full
  */
-int aaInsert(AssociativeArray *aarray, AAKeyType key, size_t keylen, void *value)
+static HashIndex
+probePlace(AssociativeArray *aarray, KeyDataPair *entry, int *cost)
 {
-	/**
-	 * TO DO:  Search for a location where this key can go, stopping
-	 * if we find a value that has been delete and reuse it.
-	 *
-	 * If a suitable location is found, we then initialize that
-	 * slot with the new key and data
-	 */
-        // Initialize the cost counter
-// Compute the initial hash index using the primary hash function
-    HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    
-    // Initialize insert cost and record the initial index
-    int cost = 0;
-    HashIndex initialindex = index;
-
-    // Allocate memory for a copied key
-    AAKeyType copiedKey = malloc(keylen + 1);
-    if (copiedKey == NULL) {
-        return -1; // Memory allocation failure
-    }
-    memcpy(copiedKey,key,keylen);
-    copiedKey[keylen] = '\0';
-
-    // Copy the key and null-terminate the copied key
-
-    while (1) {
-        // Check if the current slot is empty (0) or has a tombstone (-1).
-        if (aarray->table[index].validity == HASH_EMPTY || aarray->table[index].validity == HASH_DELETED) {
-            // Insert the key, value, and update metadata
-            aarray->table[index].key = copiedKey;
-            aarray->table[index].keylen = keylen;
-            aarray->table[index].value = value;
-            aarray->table[index].validity = HASH_USED;
-            aarray->nEntries++;
-			cost++;
-			aarray->insertCost += cost;
-            
-           // free(copiedKey);         // Update insert cost and free the copied key memory before returning
-            return index;
-        }
-
-        // Use the hash probing strategy to find the next available slot
-        index = aarray->hashProbe(aarray, key, keylen, index, 1, &aarray->insertCost);
-
-        // If we have cycled through the entire table and haven't found an empty slot, return -1
-        if (index == initialindex) {
-			aarray->insertCost += cost;
-            return -1;
-        }
-    }
-	free(copiedKey);
-}
+	SlotTable *table = aarray->table;
+	HashIndex index;
+
+	index = tableIndex(table, entry->hash);
+	(*cost)++;
+
+	if (readsAreLockFree(aarray)) {
+		/**
+		 * a lookup may still be reading the entry a tombstone was left
+		 * by, so go on to an empty slot; both strategies allowed in
+		 * this mode search in this same order
+		 */
+		while (table->ctrl[index] != HASH_EMPTY) {
+			index = nextTableIndex(table, index);
+			(*cost)++;
+		}
+	} else if (HASH_IS_USED(table->ctrl[index])) {
+		index = aarray->hashProbe(aarray, slotKey(entry), entry->keylen,
+				index, 1, cost);
+		if (index == (HashIndex) -1) {
+			return index;
+		}
+	}
+
+	if (table->ctrl[index] == HASH_DELETED) {
+		table->nDeleted--;
+	}
 
+	table->slots[index] = *entry;
+	setCtrl(table, index, hashFragment(entry->hash));
+	table->nUsed++;
 
+	return index;
+}
 
 /**
- * Locates the KeyDataPair associated with the given key, if
- * present in the table.
- *
- *  @param  key  the key to search for
- *  @return      the KeyDataPair containing the key, if the key
- *				 was present in the table, or NULL, if it was not
- *  @see         KeyDataPair
+ * Leave a tombstone in a slot whose entry is deleted, so that probe
+ * chains running through it are not broken.  The key stays in the
+ * slot, so that it can be printed, until the slot is reused.
  */
-void *aaLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+static void
+tombstoneRemove(AssociativeArray *aarray, SlotTable *table, HashIndex index)
 {
-    // Compute the initial hash index using the primary hash function
-    HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    int startIndex = index;
-    int cost = 0;
-
-    while (aarray->table[index].validity != HASH_EMPTY)
-    {
-        // Check if the current slot is marked as deleted
-        if (aarray->table[index].validity == HASH_DELETED)
-        {
-            // This means the key is not in the table
-            index++;
-	    cost++;
-	    aarray->searchCost += cost;
-            if (index == startIndex)
-            {
-                return NULL; // The entire table has been searched, key not found
-            }
-            continue;
-        }
-
-        // Check if the current slot matches the key
-        if (aarray->table[index].keylen == keylen && memcmp(aarray->table[index].key, key, keylen) == 0)
-        {
-            return aarray->table[index].value; // Key found, return the associated value
-        }
-
-        // If the current slot doesn't match the key, handle collision (optional):
-        // You can use the same probing strategy as in aaInsert to find the next slot
-        index++;
-	cost++;
-	aarray->searchCost += cost;
-        if (index == startIndex)
-        {
-            return NULL; // The entire table has been searched, key not found
-        }
-    }
+	setCtrl(table, index, HASH_DELETED);
+	table->nUsed--;
+	table->nDeleted++;
+}
+
+static HashPlace lookupNamedPlacementStrategy(const char *name)
+{
+	if (strncmp(name, "rob", 3) == 0) {
+		return robinHoodPlace;
+	} else if (strncmp(name, "cuc", 3) == 0) {
+		return cuckooPlace;
+	}
 
-    // Key not found
-    return NULL;
+	return probePlace;
 }
 
+static HashRemove lookupNamedRemovalStrategy(const char *name)
+{
+	if (strncmp(name, "rob", 3) == 0) {
+		return robinHoodRemove;
+	} else if (strncmp(name, "cuc", 3) == 0) {
+		return cuckooRemove;
+	}
+
+	return tombstoneRemove;
+}
 
 /**
- * Locates the KeyDataPair associated with the given key, if
- * present in the table.
- *
- *  @param  key  the key to search for
- *  @return      the index of the KeyDataPair containing the key,
- *				 if the key was present in the table, or (-1),
- *				 if no key was found
- *  @see         KeyDataPair
+ * Fill in an entry to be placed.  Short keys are copied into it; for
+ * longer keys the caller passes a copy already made in the key arena.
  */
-void *aaDelete(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+static void
+fillEntry(KeyDataPair *entry, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value)
 {
-	/**
-	 * TO DO: Deletion is closely related to lookup;
-	 * you must find where the key is stored before
-	 * you delete it, after all.
-	 *
-	 * Implement a deletion algorithm based on tombstones,
-	 * as described in class
-	 */
-    int cost = 0;
-	HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    HashIndex initialIndex = index;  // Save the initial index for cost calculation
-
-    while (1) {
-        if (aarray->table[index].validity == HASH_USED) {
-            // Check if the current slot contains the key we're looking for.
-            if (aarray->table[index].keylen == keylen && memcmp(aarray->table[index].key, key, keylen) == 0) {
-                //printf("Key found at index %lu; marking the slot as deleted...\n", index);
-                aarray->table[index].validity = HASH_DELETED;
-                                aarray->nEntries--;
-				cost++;
-                aarray->deleteCost += cost;
-                return aarray->table[index].value;
-            }
-        } else if (aarray->table[index].validity == HASH_EMPTY) {
-            //printf("Reached an empty slot at index %lu; key is not in the table.\n", index);
-			cost++;
-                        aarray->nEntries--;
-            aarray->deleteCost += 1;
-            return NULL;
-        }
-
-        // Move to the next slot using the probing strategy.
-        index = aarray->hashProbe(aarray, key, keylen, index, 1, &aarray->deleteCost);
-        aarray->deleteCost++;  
-        if (index == initialIndex) {
-			cost++;
-        	aarray->deleteCost += 1;
-
-	/**
-	 * TO DO: Deletion is closely related to lookup;
-	 * you must find where the key is stored before
-	 * you delete it, after all.
-	 *
-	 * Implement a deletion algorithm based on tombstones,
-	 * as described in class
-	 */
-
-	return NULL;
-}}
+	if (keyIsInline(keylen)) {
+		memset(entry->inlineKey, 0, INLINE_KEY_BYTES);
+		memcpy(entry->inlineKey, key, keylen);
+	} else {
+		entry->key = key;
+	}
+	entry->keylen = keylen;
+	entry->hash = hash;
+	entry->value = value;
 }
 
 /**
- * Print out the entire aarray contents
+ * Give a key a slot in the current table, using the configured
+ * placement strategy.  This is shared between a fresh insert and moving
+ * entries over from a draining table, which passes along the hash
+ * stored with the entry rather than rehashing.
+ *
+ *  @return      the slot used, or (HashIndex) -1 if the table is full
  */
-void aaPrintContents(FILE *fp, AssociativeArray *aarray, char * tag)
+static HashIndex
+placeEntry(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *cost)
 {
-	char keybuffer[128];
-	int i;
+	KeyDataPair entry;
 
-	fprintf(fp, "%sDumping aarray of %d entries:\n", tag, aarray->size);
-	for (i = 0; i < aarray->size; i++) {
-		fprintf(fp, "%s  ", tag);
-		if (aarray->table[i].validity == HASH_USED) {
-			printableKey(keybuffer, 128,
-					aarray->table[i].key,
-					aarray->table[i].keylen);
-			fprintf(fp, "%d : in use : '%s'\n", i, keybuffer);
-		} else {
-			if (aarray->table[i].validity == HASH_EMPTY) {
-				fprintf(fp, "%d : empty (NULL)\n", i);
-			} else if ( aarray->table[i].validity == HASH_DELETED) {
-				printableKey(keybuffer, 128,
-						aarray->table[i].key,
-						aarray->table[i].keylen);
-				fprintf(fp, "%d : empty (deleted - was '%s')\n", i, keybuffer);
-			} else {
-				fprintf(fp, "%d : invalid validity state %d\n", i,
-						aarray->table[i].validity);
-			}
-		}
-	}
+	fillEntry(&entry, key, keylen, hash, value);
+	return aarray->hashPlace(aarray, &entry, cost);
 }
 
-
 /**
- * Print out a short summary
+ * Give back the space of deleted keys, by copying the live keys into a
+ * fresh key arena and releasing the old one.  The new arena is made as
+ * a single chunk of the right size, so the copies cannot fail part way.
+ * This may only be done when no table is being drained.
+ *
+ * Tombstones forget the key they were deleted with, as it is gone.
+ * Lookups that take no locks may be reading any table, so in that mode
+ * this is never done; the keys are instead copied as a drain moves
+ * them (see startKeyMove()).  The compact engine rebuilds its key heap
+ * instead.
  */
-void aaPrintSummary(FILE *fp, AssociativeArray *aarray)
+static void
+arenaRebuild(AssociativeArray *aarray)
 {
-	fprintf(fp, "Associative array contains %d entries in a table of %d size\n",
-			aarray->nEntries, aarray->size);
-	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
-			aarray->hashNamePrimary, aarray->hashNameSecondary, aarray->probeName);
-	fprintf(fp, "Costs accrued due to probing:\n");
-	fprintf(fp, "  Insertion : %d\n", aarray->insertCost);
-	fprintf(fp, "  Search    : %d\n", aarray->searchCost);
-	fprintf(fp, "  Deletion  : %d\n", aarray->deleteCost);
-}
+	SlotTable *table = aarray->table;
+	KeyArena fresh, *old;
+	KeyDataPair *pair;
+	HashIndex i;
 
+	if (aarray->compact) {
+		compactRebuildHeap(aarray);
+		return;
+	}
+
+	old = (KeyArena *) malloc(sizeof(KeyArena));
+	if (old == NULL) {
+		return; // no memory to spare; keep the old arena
+	}
+	arenaInit(&fresh);
+	if (arenaReserve(&fresh, aarray->keys.bytesLive) < 0) {
+		free(old);
+		return;
+	}
+
+	if (aarray->chained) {
+		chainRebuildKeys(table, &fresh);
+		*old = aarray->keys;
+		retireBlock(aarray, old, releaseKeyArena);
+		aarray->keys = fresh;
+		return;
+	}
+
+	for (i = 0; i < table->size + table->nStash; i++) {
+		pair = &table->slots[i];
+		if (keyIsInline(pair->keylen)
+				|| (i < table->size && table->ctrl[i] == HASH_EMPTY)) {
+			continue;
+		}
+		if (i < table->size && table->ctrl[i] == HASH_DELETED) {
+			pair->key = NULL;
+			pair->keylen = 0;
+		} else {
+			pair->key = arenaCopyKey(&fresh, pair->key, pair->keylen);
+		}
+	}
+
+	*old = aarray->keys;
+	retireBlock(aarray, old, releaseKeyArena);
+	aarray->keys = fresh;
+}
+
+/** the bytes of deleted keys not yet given back, in arena or heap */
+static size_t
+deadKeyBytes(AssociativeArray *aarray)
+{
+	return aarray->compact ? aarray->heap.bytesDead : aarray->keys.bytesDead;
+}
+
+static size_t
+liveKeyBytes(AssociativeArray *aarray)
+{
+	return aarray->compact ? aarray->heap.bytesLive : aarray->keys.bytesLive;
+}
+
+/**
+ * A drain cannot tidy up the key arena of a published table in place
+ * (see arenaRebuild()).  So with lookups that take no locks, when
+ * deleted keys have left dead bytes in the arena, a drain copies each
+ * long key it moves into a fresh one instead, and the old arena is
+ * retired along with the old table.
+ */
+static void
+startKeyMove(AssociativeArray *aarray)
+{
+	KeyArena *old;
+
+	if ( ! readsAreLockFree(aarray) || aarray->keys.bytesDead == 0) {
+		return;
+	}
+
+	old = (KeyArena *) malloc(sizeof(KeyArena));
+	if (old == NULL) {
+		return; // no memory to spare; keep the old arena
+	}
+	*old = aarray->keys;
+	arenaInit(&aarray->keys);
+	if (arenaReserve(&aarray->keys, old->bytesLive) < 0) {
+		aarray->keys = *old;
+		free(old);
+		return;
+	}
+	aarray->drainingKeys = old;
+}
+
+/**
+ * The key to place for one a drain moves: a copy in the fresh arena
+ * started by startKeyMove(), or if none can be made, the key where it
+ * is, with its arena merged back in so that it stays
+ */
+static AAKeyType
+moveKey(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	AAKeyType copy;
+
+	if (aarray->drainingKeys == NULL || keyIsInline(keylen)) {
+		return key;
+	}
+
+	copy = arenaCopyKey(&aarray->keys, key, keylen);
+	if (copy == NULL) {
+		arenaMerge(&aarray->keys, aarray->drainingKeys);
+		free(aarray->drainingKeys);
+		aarray->drainingKeys = NULL;
+		return key;
+	}
+	arenaReleaseKey(aarray->drainingKeys, keylen);
+	return copy;
+}
+
+/**
+ * Move up to nSlots slots of the draining table into the current one.
+ * Once the whole old table has been visited it is released.
+ */
+static void
+drainSlots(AssociativeArray *aarray, HashIndex nSlots)
+{
+	SlotTable *old = aarray->draining;
+	KeyDataPair *pair;
+	HashIndex index;
+	int cost = 0;
+
+	while (nSlots-- > 0 && aarray->drainIndex < old->size) {
+		if (aarray->chained) {
+			if (chainDrainBucket(aarray, old, aarray->drainIndex) < 0) {
+				return; // no memory for nodes; try again next time
+			}
+			aarray->drainIndex++;
+			continue;
+		}
+		if (aarray->compact) {
+			compactDrainSlot(aarray, old, aarray->drainIndex++);
+			continue;
+		}
+
+		index = aarray->drainIndex++;
+		pair = &old->slots[index];
+
+		if (HASH_IS_USED(old->ctrl[index])) {
+			/** cannot fail, the new table is larger than all entries */
+			placeEntry(aarray, moveKey(aarray, slotKey(pair), pair->keylen),
+					pair->keylen, pair->hash, pair->value, &cost);
+			aarray->rehashesAvoided++;
+			old->nUsed--;
+			old->nDeleted++;
+		} else if (old->ctrl[index] != HASH_DELETED) {
+			continue;
+		}
+
+		/**
+		 * leave a tombstone rather than an empty slot, as entries
+		 * further along still need their probe chains to run
+		 * through this slot until they are drained too; a lookup
+		 * taking no locks may still be reading the entry, so in that
+		 * mode it keeps its key
+		 */
+		if ( ! readsAreLockFree(aarray)) {
+			pair->key = NULL;
+			pair->keylen = 0;
+		}
+		setCtrl(old, index, HASH_DELETED);
+	}
+
+	if (aarray->drainIndex >= old->size) {
+		/** the stash goes last, all at once, as it must stay packed */
+		for (index = old->size; index < old->size + old->nStash; index++) {
+			pair = &old->slots[index];
+			placeEntry(aarray, moveKey(aarray, slotKey(pair), pair->keylen),
+					pair->keylen, pair->hash, pair->value, &cost);
+			aarray->rehashesAvoided++;
+		}
+
+		aarray->draining = NULL;
+		aarray->drainIndex = 0;
+		__atomic_store_n(&aarray->table->older, NULL, __ATOMIC_RELEASE);
+
+		/**
+		 * every live key has just been visited, so tidy up their store,
+		 * unless the drain has already copied them to a fresh arena
+		 */
+		if (aarray->drainingKeys != NULL) {
+			retireBlock(aarray, aarray->drainingKeys, releaseKeyArena);
+			aarray->drainingKeys = NULL;
+		} else if ( ! readsAreLockFree(aarray)
+				&& deadKeyBytes(aarray) > liveKeyBytes(aarray) / 2
+				&& deadKeyBytes(aarray) >= KEY_ARENA_CHUNK_BYTES) {
+			arenaRebuild(aarray);
+		}
+
+		retireBlock(aarray, old, releaseSlotTable);
+		publishTable(aarray);
+	}
+}
+
+/**
+ * Switch to a new table of the given size.  The entries are not moved
+ * here; every following operation (in concurrent mode, every following
+ * write) drains DRAIN_STEP slots of the old table, so that no single
+ * call pays for the whole rehash.
+ *
+ *  @return      0 on success, or a negative number if the new table
+ *				 cannot be made
+ */
+static int
+startRehash(AssociativeArray *aarray, HashIndex newSize)
+{
+	SlotTable *newTable;
+
+	/** only one generation is drained at a time */
+	if (aarray->draining != NULL) {
+		drainSlots(aarray, aarray->draining->size);
+	}
+
+	newTable = createSlotTable(newSize, aarray->powerOfTwoSizes,
+			aarray->chained, aarray->compact);
+	if (newTable == NULL) {
+		return -1;
+	}
+
+	aarray->draining = aarray->table;
+	aarray->drainIndex = 0;
+	aarray->table = newTable;
+
+	/**
+	 * link the generations before any entry moves, so that a lookup
+	 * taking no locks that finds an entry gone from the old table goes
+	 * on to the new one; the new table is published straight away
+	 */
+	newTable->older = aarray->draining;
+	__atomic_store_n(&aarray->draining->newer, newTable, __ATOMIC_RELEASE);
+	startKeyMove(aarray);
+	publishTable(aarray);
+	return 0;
+}
+
+/**
+ * Switch to a new, larger table.
+ *
+ *  @param  minSize  the new table will be at least this large
+ *  @return      0 on success, or a negative number if no larger table
+ *				 can be made
+ */
+static int
+startGrowth(AssociativeArray *aarray, HashIndex minSize)
+{
+	HashIndex newSize;
+
+	newSize = tableSizeFor(aarray, minSize);
+	if (newSize <= aarray->table->size) {
+		return -1;
+	}
+	return startRehash(aarray, newSize);
+}
+
+/**
+ * Clear out the tombstones of the current table, by moving its entries
+ * into a fresh table of the same size.  This happens a few slots at a
+ * time, just as growth does, and the old table (tombstones and all) is
+ * released once it has been drained.
+ *
+ *  @return      0 on success, or a negative number if the new table
+ *				 cannot be made
+ */
+static int
+startCompaction(AssociativeArray *aarray)
+{
+	if (startRehash(aarray, aarray->table->size) < 0) {
+		return -1;
+	}
+	aarray->compactions++;
+	return 0;
+}
+
+/**
+ * Clear out every tombstone and give back the space of deleted keys
+ * now, rather than waiting for the tombstone limit to be reached; the
+ * key heap of the compact engine is also cut down to fit its keys.
+ * Any growth under way is finished first.
+ *
+ *  @return      0 on success, or a negative number if there is not
+ *				 enough memory for a fresh table
+ */
+int
+aaCompact(AssociativeArray *aarray)
+{
+	int result = 0, i;
+
+	for (i = 0; i < aarray->nShards; i++) {
+		if (aaCompact(aarray->shards[i]) < 0) {
+			result = -1;
+		}
+	}
+
+	lockTable(aarray);
+	if (aarray->draining != NULL) {
+		drainSlots(aarray, aarray->draining->size);
+	}
+
+	/** a published table is never rebuilt in place (see arenaRebuild()) */
+	if (aarray->table->nDeleted > 0
+			|| (readsAreLockFree(aarray) && aarray->keys.bytesDead > 0)) {
+		result = startCompaction(aarray);
+		if (aarray->draining != NULL) {
+			drainSlots(aarray, aarray->draining->size);
+		}
+	}
+
+	if (result == 0 && (deadKeyBytes(aarray) > 0 || aarray->compact)
+			&& ! readsAreLockFree(aarray)) {
+		arenaRebuild(aarray);
+	}
+	unlockTable(aarray);
+	return result;
+}
+
+/**
+ * How many entries each slot holds at a load factor of one: a chain
+ * of the chained engine is expected to fill a node before growing
+ */
+static int
+entriesPerSlot(AssociativeArray *aarray)
+{
+	return aarray->chained ? CHAIN_NODE_ENTRIES : 1;
+}
+
+/**
+ * Make sure that at least nEntries can be held without passing the
+ * load factor, so that a bulk load does not need to grow repeatedly.
+ *
+ *  @param  nEntries  the number of entries expected
+ *  @return      0 on success, or a negative number if a table of
+ *				 that size cannot be made
+ */
+int
+aaReserve(AssociativeArray *aarray, size_t nEntries)
+{
+	HashIndex needed;
+	int result = 0, i;
+
+	for (i = 0; i < aarray->nShards; i++) {
+		if (aaReserve(aarray->shards[i], nEntries / aarray->nShards + 1) < 0) {
+			result = -1;
+		}
+	}
+	if (aarray->shards != NULL) {
+		return result;
+	}
+
+	needed = (HashIndex) (nEntries
+			/ (aarray->maxLoadFactor * entriesPerSlot(aarray))) + 1;
+	lockTable(aarray);
+	if (needed > aarray->table->size) {
+		result = startGrowth(aarray, needed);
+	}
+	unlockTable(aarray);
+	return result;
+}
+
+/**
+ * Add another key and data value to the table.  The table is grown
+ * when adding this key would pass the load factor.
+ *
+ *  @param  key  a string value used for searching later
+ *  @param  value a data value associated with the key
+ *  @return      the location the data is placed within the hash table
+ *				 (clamped to INT_MAX on very large tables),
+ *				 or a negative number if no place can be found
+ */
+int aaInsert(AssociativeArray *aarray, AAKeyType key, size_t keylen, void *value)
+{
+	return insertHashed(aarray, key, keylen,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->hashSeed), value);
+}
+
+/**
+ * An insert once the key has been hashed, by a thread that has the
+ * whole table to itself
+ */
+static int
+insertExclusive(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *cost)
+{
+	SlotTable *table;
+	AAKeyType copiedKey;
+	HashIndex index;
+	double limit;
+
+	if (aarray->draining != NULL) {
+		drainSlots(aarray, DRAIN_STEP);
+	}
+
+	/**
+	 * Tombstones lengthen probes just as much as live entries do.  When
+	 * they are much of what fills the table, clear them out instead of
+	 * growing, as the entries alone would leave a larger table nearly
+	 * empty.
+	 */
+	table = aarray->table;
+	limit = aarray->maxLoadFactor * entriesPerSlot(aarray) * table->size;
+	if (table->nUsed + table->nDeleted + 1 > limit) {
+		if (2 * (table->nUsed + 1) <= limit) {
+			startCompaction(aarray);
+		} else {
+			startGrowth(aarray, 2 * table->size);
+		}
+	}
+
+	/** the compact engine keeps every key in its own heap */
+	if (aarray->compact) {
+		index = compactPlace(aarray, key, keylen, hash, value, cost);
+		if (index == (HashIndex) -1) {
+			return -1;
+		}
+		aarray->nEntries++;
+		return index > INT_MAX ? INT_MAX : (int) index;
+	}
+
+	// Copy the key into the arena, null-terminated,
+	// unless it is short enough to be copied into the slot;
+	// the chained engine copies its keys itself
+	copiedKey = key;
+	if ( ! keyIsInline(keylen) && ! aarray->chained) {
+		copiedKey = arenaCopyKey(&aarray->keys, key, keylen);
+		if (copiedKey == NULL) {
+			return -1; // Memory allocation failure
+		}
+	}
+
+	if (aarray->chained) {
+		index = chainPlace(aarray, copiedKey, keylen, hash, value, cost);
+	} else {
+		index = placeEntry(aarray, copiedKey, keylen, hash, value, cost);
+	}
+
+	/**
+	 * A strategy that can run out of room early (cuckoo) makes the table
+	 * grow, but only if it is reasonably full: in a sparse table the
+	 * failure comes from too many keys sharing their hashes, which a
+	 * larger table would not help.
+	 */
+	if (index == (HashIndex) -1 && ! aarray->chained
+			&& aarray->table->nUsed >= aarray->table->size / 2
+			&& startGrowth(aarray, 2 * aarray->table->size) == 0) {
+		index = placeEntry(aarray, copiedKey, keylen, hash, value, cost);
+	}
+	if (index == (HashIndex) -1) {
+		if ( ! aarray->chained) {
+			fprintf(stderr, "No room for key in a table of %zu holding %zu entries"
+					" - too many keys share their hashes\n",
+					aarray->table->size, aarray->table->nUsed);
+		}
+		if (copiedKey != key) {
+			arenaReleaseKey(&aarray->keys, keylen);
+		}
+		return -1;
+	}
+
+	aarray->nEntries++;
+	return index > INT_MAX ? INT_MAX : (int) index;
+}
+
+/**
+ * Would one more entry take the current table past its load limit?
+ * Tombstones count, as they do in insertExclusive().  Other threads
+ * may be adding to the counts.
+ */
+static int
+isPastLoadLimit(AssociativeArray *aarray)
+{
+	SlotTable *table = aarray->table;
+
+	return __atomic_load_n(&table->nUsed, __ATOMIC_RELAXED)
+			+ __atomic_load_n(&table->nDeleted, __ATOMIC_RELAXED) + 1
+			> aarray->maxLoadFactor * entriesPerSlot(aarray) * table->size;
+}
+
+/**
+ * An insert on the chained engine in concurrent mode.  The table is
+ * only held shared, with the stripe of the key locked, so that inserts
+ * and deletes elsewhere in the table go ahead at the same time.
+ *
+ *  @return      1 once the insert is made, with its result in *result,
+ *				 or 0 if it must be made holding the whole table, to
+ *				 grow it or to take a step of draining it
+ */
+static int
+insertInStripe(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *result, int *cost)
+{
+	pthread_mutex_t *stripe;
+	HashIndex index;
+
+	lockTableShared(aarray);
+	if (aarray->draining != NULL || isPastLoadLimit(aarray)) {
+		unlockTable(aarray);
+		return 0;
+	}
+
+	stripe = lockStripe(aarray, hash);
+	index = chainPlace(aarray, key, keylen, hash, value, cost);
+	pthread_mutex_unlock(stripe);
+	if (index != (HashIndex) -1) {
+		SHARED_ADD(aarray, aarray->nEntries, 1);
+	}
+	unlockTable(aarray);
+
+	if (index == (HashIndex) -1) {
+		*result = -1;
+	} else {
+		*result = index > INT_MAX ? INT_MAX : (int) index;
+	}
+	return 1;
+}
+
+/**
+ * An insert on "linear" or "simd" in concurrent mode.  The table is
+ * held shared, and the stripes from the home slot of the key up to
+ * the empty slot it goes in are locked.  Tombstones are passed over
+ * rather than reused, so that the entry only ever fills an empty slot,
+ * which no lookup can be reading; the tombstones go when the table is
+ * next compacted or grown.
+ *
+ *  @return      1 once the insert is made, with its result in *result,
+ *				 or 0 if it must be made holding the whole table, to
+ *				 grow it, to take a step of draining it, or as its probe
+ *				 wrapped around the end of the table
+ */
+static int
+insertInStripes(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value, int *result, int *cost)
+{
+	SlotTable *table;
+	KeyDataPair *pair;
+	StripeWalk walk;
+	AAKeyType copiedKey = key;
+	HashIndex index, n;
+
+	lockTableShared(aarray);
+	table = aarray->table;
+	if (aarray->draining != NULL || isPastLoadLimit(aarray)) {
+		unlockTable(aarray);
+		return 0;
+	}
+
+	index = tableIndex(table, hash);
+	stripeWalkStart(aarray, &walk, index);
+	(*cost)++;
+	for (n = 1; loadCtrl(table, index) != HASH_EMPTY; n++) {
+		index = nextTableIndex(table, index);
+		if (n == table->size || stripeWalkReach(aarray, &walk, index) < 0) {
+			stripeWalkEnd(aarray, &walk);
+			unlockTable(aarray);
+			return 0;
+		}
+		(*cost)++;
+	}
+
+	if ( ! keyIsInline(keylen)) {
+		lockStore(aarray);
+		copiedKey = arenaCopyKey(&aarray->keys, key, keylen);
+		unlockStore(aarray);
+	}
+	if (copiedKey == NULL) {
+		*result = -1; // Memory allocation failure
+	} else {
+		pair = &table->slots[index];
+		fillEntry(pair, copiedKey, keylen, hash, value);
+		setCtrl(table, index, hashFragment(hash));
+		__atomic_fetch_add(&table->nUsed, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&aarray->nEntries, 1, __ATOMIC_RELAXED);
+		*result = index > INT_MAX ? INT_MAX : (int) index;
+	}
+	stripeWalkEnd(aarray, &walk);
+	unlockTable(aarray);
+	return 1;
+}
+
+/**
+ * The body of an insert, once the key has been hashed; this is shared
+ * by the byte string, integer key and batch interfaces
+ */
+static int
+insertHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void *value)
+{
+	struct timespec start;
+	int result, cost = 0, timed, done = 0;
+
+	if (aarray->shards != NULL) {
+		return insertHashed(shardFor(aarray, hash), key, keylen, hash, value);
+	}
+	if (aarray->snapshot != NULL) {
+		fprintf(stderr, "Cannot insert into an array loaded from a snapshot\n");
+		return -1;
+	}
+
+	timed = sampleLatency(aarray, &start);
+	if (aarray->concurrency != NULL && aarray->chained) {
+		done = insertInStripe(aarray, key, keylen, hash, value, &result,
+				&cost);
+	} else if (aarray->concurrency != NULL && aarray->linearPlacement) {
+		done = insertInStripes(aarray, key, keylen, hash, value, &result,
+				&cost);
+	}
+	if ( ! done) {
+		cost = 0;
+		lockTable(aarray);
+		result = insertExclusive(aarray, key, keylen, hash, value, &cost);
+		reclaimRetired(aarray, 0);
+		unlockTable(aarray);
+	}
+
+	recordOperation(aarray, STATS_INSERTS, result >= 0, cost);
+	if (timed) {
+		recordLatency(aarray, STATS_INSERTS, &start);
+	}
+	return result;
+}
+
+/**
+ * Locate the slot holding the given key within one generation
+ * of the table, using the search that goes with the probing strategy.
+ * The key is hashed once by the caller, even if both generations
+ * are searched.
+ *
+ *  @return      the slot index, or (HashIndex) -1 if the key is
+ *				 not present in this table
+ */
+static HashIndex
+findEntry(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	return aarray->hashSearch(aarray, table, key, keylen, hash, cost);
+}
+
+/**
+ * Locates the KeyDataPair associated with the given key, if
+ * present in the table.
+ *
+ *  @param  key  the key to search for
+ *  @return      the KeyDataPair containing the key, if the key
+ *				 was present in the table, or NULL, if it was not
+ *  @see         KeyDataPair
+ */
+void *aaLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	return lookupHashed(aarray, key, keylen,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->hashSeed));
+}
+
+/** look for a key in both generations of the table */
+static void *
+searchTables(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, int *cost)
+{
+	HashIndex index;
+	void *value;
+
+	if (aarray->chained) {
+		if (chainLookup(aarray, aarray->table, key, keylen, hash, &value,
+					cost)
+				|| (aarray->draining != NULL
+					&& chainLookup(aarray, aarray->draining, key, keylen,
+						hash, &value, cost))) {
+			return value;
+		}
+		return NULL;
+	}
+	if (aarray->compact) {
+		if (compactLookup(aarray, aarray->table, key, keylen, hash, &value,
+					cost)
+				|| (aarray->draining != NULL
+					&& compactLookup(aarray, aarray->draining, key, keylen,
+						hash, &value, cost))) {
+			return value;
+		}
+		return NULL;
+	}
+
+	index = findEntry(aarray, aarray->table, key, keylen, hash, cost);
+	if (index != (HashIndex) -1) {
+		return aarray->table->slots[index].value;
+	}
+
+	/** entries not yet drained are still in the old table */
+	if (aarray->draining != NULL) {
+		index = findEntry(aarray, aarray->draining, key, keylen, hash, cost);
+		if (index != (HashIndex) -1) {
+			return aarray->draining->slots[index].value;
+		}
+	}
+
+	// Key not found
+	return NULL;
+}
+
+/**
+ * A lookup that takes no locks: it searches the published table, which
+ * stays allocated (along with its keys) until epochExit().
+ *
+ * While that table is being drained into, the old one is searched
+ * first.  A drain places an entry in the new table before it leaves a
+ * tombstone in the old, so a lookup that finds a tombstone where its
+ * key was goes on along the newer links and finds the entry there; it
+ * follows them as far as they go, as further growth may have moved
+ * the entry again in the meantime.
+ */
+static void *
+lookupLockFree(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash)
+{
+	SlotTable *table, *older;
+	HashIndex index;
+	void *value = NULL;
+	int cost = 0, shared;
+
+	/** every reader record is in use; wait out the writers instead */
+	shared = (epochEnter() < 0);
+	if (shared) {
+		lockTableShared(aarray);
+	}
+
+	table = __atomic_load_n(&aarray->concurrency->published, __ATOMIC_ACQUIRE);
+	older = __atomic_load_n(&table->older, __ATOMIC_ACQUIRE);
+	if (older != NULL) {
+		table = older;
+	}
+	while (table != NULL) {
+		index = aarray->hashSearch(aarray, table, key, keylen, hash, &cost);
+		if (index != (HashIndex) -1) {
+			value = table->slots[index].value;
+			break;
+		}
+		table = __atomic_load_n(&table->newer, __ATOMIC_ACQUIRE);
+	}
+
+	if (shared) {
+		unlockTable(aarray);
+	} else {
+		epochExit();
+	}
+	return value;
+}
+
+/**
+ * Look for a key in whatever holds the entries of an unsharded array,
+ * taking the locks that its mode calls for
+ */
+static void *
+lookupInArray(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, int *cost)
+{
+	pthread_mutex_t *stripe = NULL;
+	void *value;
+
+	if (aarray->snapshot != NULL) {
+		return snapshotLookup(aarray, key, keylen, hash, cost);
+	}
+	if (aarray->concurrency == NULL) {
+		if (aarray->draining != NULL) {
+			drainSlots(aarray, DRAIN_STEP);
+		}
+		return searchTables(aarray, key, keylen, hash, cost);
+	}
+
+	if (aarray->concurrency->lockFreeReads) {
+		return lookupLockFree(aarray, key, keylen, hash);
+	}
+
+	/**
+	 * In concurrent mode lookups share the table and change nothing in
+	 * it.  Chains also need their stripe, as they are changed by
+	 * writers that share the table as well.
+	 */
+	lockTableShared(aarray);
+	if (aarray->chained) {
+		stripe = lockStripe(aarray, hash);
+	}
+	value = searchTables(aarray, key, keylen, hash, cost);
+	if (stripe != NULL) {
+		pthread_mutex_unlock(stripe);
+	}
+	unlockTable(aarray);
+	return value;
+}
+
+/**
+ * The body of a lookup, once the key has been hashed.  As NULL is
+ * what a missing key gives, a lookup is counted as a hit when it
+ * finds a value other than NULL.
+ */
+static void *
+lookupHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash)
+{
+	struct timespec start;
+	void *value;
+	int cost = 0, timed;
+
+	if (aarray->shards != NULL) {
+		return lookupHashed(shardFor(aarray, hash), key, keylen, hash);
+	}
+
+	timed = sampleLatency(aarray, &start);
+	value = lookupInArray(aarray, key, keylen, hash, &cost);
+	recordOperation(aarray, STATS_LOOKUPS, value != NULL, cost);
+	if (timed) {
+		recordLatency(aarray, STATS_LOOKUPS, &start);
+	}
+	return value;
+}
+
+
+/**
+ * Empty the slot holding the key, in the way the strategy calls for:
+ * usually by leaving a tombstone
+ */
+static void *
+deleteFromSlotTable(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex index;
+	void *value;
+
+	if (aarray->chained) {
+		if ( ! chainRemove(aarray, table, key, keylen, hash, &value, cost)) {
+			return NULL;
+		}
+		lockStore(aarray);
+		arenaReleaseKey(&aarray->keys, keylen);
+		unlockStore(aarray);
+		SHARED_ADD(aarray, aarray->nEntries, -1);
+		return value;
+	}
+	if (aarray->compact) {
+		if ( ! compactRemove(aarray, table, key, keylen, hash, &value, cost)) {
+			return NULL;
+		}
+		aarray->nEntries--;
+		return value;
+	}
+
+	index = findEntry(aarray, table, key, keylen, hash, cost);
+	if (index == (HashIndex) -1) {
+		return NULL;
+	}
+
+	/** the removal may move other entries into this slot */
+	value = table->slots[index].value;
+	aarray->hashRemove(aarray, table, index);
+	if ( ! keyIsInline(keylen)) {
+		arenaReleaseKey(table == aarray->draining && aarray->drainingKeys
+				!= NULL ? aarray->drainingKeys : &aarray->keys, keylen);
+	}
+	aarray->nEntries--;
+	return value;
+}
+
+/**
+ * Locates the KeyDataPair associated with the given key, if
+ * present in the table, and removes it.
+ *
+ *  @param  key  the key to search for
+ *  @return      the value stored with the key, if the key was
+ *				 present in the table, or NULL if no key was found
+ *  @see         KeyDataPair
+ */
+void *aaDelete(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	return deleteHashed(aarray, key, keylen,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->hashSeed));
+}
+
+/**
+ * A delete once the key has been hashed, by a thread that has the
+ * whole table to itself
+ */
+static void *
+deleteExclusive(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, int *cost)
+{
+	void *value;
+
+	if (aarray->draining != NULL) {
+		drainSlots(aarray, DRAIN_STEP);
+	}
+
+	value = deleteFromSlotTable(aarray, aarray->table, key, keylen, hash,
+			cost);
+	if (value == NULL && aarray->draining != NULL) {
+		value = deleteFromSlotTable(aarray, aarray->draining, key, keylen,
+				hash, cost);
+	}
+
+	/** searches walk over tombstones, so do not let them build up */
+	if (aarray->draining == NULL && aarray->table->nDeleted
+			> aarray->maxTombstoneFactor * aarray->table->size) {
+		startCompaction(aarray);
+	}
+	return value;
+}
+
+/**
+ * Clear out the tombstones of the current table, for a delete that
+ * only shared the table when it found them past their limit
+ */
+static void
+compactCrowdedTable(AssociativeArray *aarray)
+{
+	/** another thread may have cleared them out in the meantime */
+	lockTable(aarray);
+	if (aarray->draining == NULL && aarray->table->nDeleted
+			> aarray->maxTombstoneFactor * aarray->table->size) {
+		startCompaction(aarray);
+	}
+	reclaimRetired(aarray, 0);
+	unlockTable(aarray);
+}
+
+/**
+ * A delete on the chained engine in concurrent mode, which shares the
+ * table and locks just the stripe of the key
+ *
+ *  @return      1 once the delete is made, with the value found in
+ *				 *value, or 0 if it must be made holding the whole
+ *				 table, to take a step of draining it
+ */
+static int
+deleteInStripe(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void **value, int *cost)
+{
+	pthread_mutex_t *stripe;
+
+	lockTableShared(aarray);
+	if (aarray->draining != NULL) {
+		unlockTable(aarray);
+		return 0;
+	}
+
+	stripe = lockStripe(aarray, hash);
+	*value = deleteFromSlotTable(aarray, aarray->table, key, keylen, hash,
+			cost);
+	pthread_mutex_unlock(stripe);
+	unlockTable(aarray);
+	return 1;
+}
+
+/**
+ * A delete on "linear" or "simd" in concurrent mode.  The table is
+ * held shared, and the stripes from the home slot of the key up to
+ * the slot it is found in (or the empty slot that ends the search) are
+ * locked, so that no insert can place the key in that run meanwhile.
+ *
+ *  @return      1 once the delete is made, with the value found in
+ *				 *value, or 0 if it must be made holding the whole
+ *				 table, to take a step of draining it or as its search
+ *				 wrapped around the end of the table
+ */
+static int
+deleteInStripes(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, void **value, int *cost)
+{
+	unsigned char fragment = hashFragment(hash), ctrl;
+	SlotTable *table;
+	StripeWalk walk;
+	HashIndex index, n;
+	int found = 0, crowded = 0;
+
+	lockTableShared(aarray);
+	table = aarray->table;
+	if (aarray->draining != NULL) {
+		unlockTable(aarray);
+		return 0;
+	}
+
+	index = tableIndex(table, hash);
+	stripeWalkStart(aarray, &walk, index);
+	(*cost)++;
+	for (n = 1; (ctrl = loadCtrl(table, index)) != HASH_EMPTY; n++) {
+		if (ctrl == fragment
+				&& slotMatches(aarray, table, index, key, keylen, hash)) {
+			found = 1;
+			break;
+		}
+		if (n == table->size) {
+			break;
+		}
+		index = nextTableIndex(table, index);
+		if (stripeWalkReach(aarray, &walk, index) < 0) {
+			stripeWalkEnd(aarray, &walk);
+			unlockTable(aarray);
+			return 0;
+		}
+		(*cost)++;
+	}
+
+	*value = NULL;
+	if (found) {
+		*value = table->slots[index].value;
+		setCtrl(table, index, HASH_DELETED);
+		__atomic_fetch_sub(&table->nUsed, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&table->nDeleted, 1, __ATOMIC_RELAXED);
+	}
+	stripeWalkEnd(aarray, &walk);
+	if (found) {
+		if ( ! keyIsInline(keylen)) {
+			lockStore(aarray);
+			arenaReleaseKey(&aarray->keys, keylen);
+			unlockStore(aarray);
+		}
+		__atomic_fetch_sub(&aarray->nEntries, 1, __ATOMIC_RELAXED);
+
+		/** searches walk over tombstones, so do not let them build up */
+		crowded = __atomic_load_n(&table->nDeleted, __ATOMIC_RELAXED)
+				> aarray->maxTombstoneFactor * table->size;
+	}
+	unlockTable(aarray);
+
+	if (crowded) {
+		compactCrowdedTable(aarray);
+	}
+	return 1;
+}
+
+/**
+ * The body of a delete, once the key has been hashed.  In concurrent
+ * mode the chained, "linear" and "simd" engines lock just the stripes
+ * they work in, and any other strategy the whole table.
+ */
+static void *
+deleteHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash)
+{
+	struct timespec start;
+	void *value;
+	int cost = 0, timed, done = 0;
+
+	if (aarray->shards != NULL) {
+		return deleteHashed(shardFor(aarray, hash), key, keylen, hash);
+	}
+	if (aarray->snapshot != NULL) {
+		fprintf(stderr, "Cannot delete from an array loaded from a snapshot\n");
+		return NULL;
+	}
+
+	timed = sampleLatency(aarray, &start);
+	if (aarray->concurrency != NULL && aarray->chained) {
+		done = deleteInStripe(aarray, key, keylen, hash, &value, &cost);
+	} else if (aarray->concurrency != NULL && aarray->linearPlacement) {
+		done = deleteInStripes(aarray, key, keylen, hash, &value, &cost);
+	}
+	if ( ! done) {
+		cost = 0;
+		lockTable(aarray);
+		value = deleteExclusive(aarray, key, keylen, hash, &cost);
+		reclaimRetired(aarray, 0);
+		unlockTable(aarray);
+	}
+
+	recordOperation(aarray, STATS_DELETES, value != NULL, cost);
+	if (timed) {
+		recordLatency(aarray, STATS_DELETES, &start);
+	}
+	return value;
+}
+
+/**
+ * The integer key interface.  Keys are stored inline in the slot as
+ * the bytes of the integer, and hashed with mixInteger() of the key
+ * and the array's seed rather than with the array's primary hash.
+ * Integer and byte string keys may share an array, but a key must
+ * always be used through the same interface, as the two hash it
+ * differently.
+ *
+ * The mixer is a bijection, so for integer keys a matching stored
+ * hash already means a matching key; the key bytes compared after it
+ * are in the slot itself.
+ */
+int aaInsertU64(AssociativeArray *aarray, uint64_t key, void *value)
+{
+	return insertHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0), value);
+}
+
+void *aaLookupU64(AssociativeArray *aarray, uint64_t key)
+{
+	return lookupHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0));
+}
+
+void *aaDeleteU64(AssociativeArray *aarray, uint64_t key)
+{
+	return deleteHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0));
+}
+
+int aaInsertU32(AssociativeArray *aarray, uint32_t key, void *value)
+{
+	return insertHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0), value);
+}
+
+void *aaLookupU32(AssociativeArray *aarray, uint32_t key)
+{
+	return lookupHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0));
+}
+
+void *aaDeleteU32(AssociativeArray *aarray, uint32_t key)
+{
+	return deleteHashed(aarray, (AAKeyType) &key, sizeof(key),
+			mixInteger(key ^ aarray->hashSeed.k0));
+}
+
+/**
+ * Start fetching the first cache lines a search for this hash will
+ * read, in the current table only: during growth most keys are found
+ * there, and the old table is soon gone.
+ */
+static void
+prefetchHome(AssociativeArray *aarray, HashIndex hash)
+{
+#ifdef	__GNUC__
+	SlotTable *table;
+	HashIndex index;
+
+	if (aarray->shards != NULL) {
+		aarray = shardFor(aarray, hash);
+	}
+
+	/** another thread may replace the table under an unlocked peek */
+	if (aarray->concurrency != NULL || aarray->snapshot != NULL) {
+		return;
+	}
+	table = aarray->table;
+	if (aarray->chained) {
+		chainPrefetch(table, hash);
+		return;
+	}
+	if (aarray->compact) {
+		compactPrefetch(table, hash);
+		return;
+	}
+	index = tableIndex(table, hash);
+	__builtin_prefetch(&table->ctrl[index]);
+	__builtin_prefetch(&table->slots[index]);
+#endif
+}
+
+/** hash key i of a batch and start fetching the slots it will look in */
+static inline HashIndex
+hashAhead(AssociativeArray *aarray, AAKeyType keys[], size_t lens[],
+		size_t i)
+{
+	HashIndex hash;
+
+	hash = aarray->hashAlgorithmPrimary(keys[i], lens[i], &aarray->hashSeed);
+	prefetchHome(aarray, hash);
+	return hash;
+}
+
+/**
+ * The batch interface: the same operations as aaInsert(), aaLookup()
+ * and aaDelete(), applied to n keys in turn.  Each key is hashed and
+ * its slots prefetched BATCH_WINDOW keys before it is resolved, so on
+ * a table larger than the cache the memory latency of that many keys
+ * overlaps, rather than being paid one key at a time.  The results
+ * are exactly those of the single key calls made in the same order.
+ *
+ *  @param  keys  the keys to operate on
+ *  @param  lens  the length of each key
+ *  @param  values  the value to insert with each key, or the value
+ *				found for (or deleted with) each key, NULL if absent
+ *  @return      the number of keys inserted, found or deleted
+ */
+size_t aaInsertBatch(AssociativeArray *aarray, AAKeyType keys[], size_t lens[],
+		void *values[], size_t n)
+{
+	HashIndex hashes[BATCH_WINDOW];
+	size_t i, nDone = 0;
+
+	for (i = 0; i < n && i < BATCH_WINDOW; i++) {
+		hashes[i] = hashAhead(aarray, keys, lens, i);
+	}
+	for (i = 0; i < n; i++) {
+		if (insertHashed(aarray, keys[i], lens[i],
+					hashes[i % BATCH_WINDOW], values[i]) >= 0) {
+			nDone++;
+		}
+		if (i + BATCH_WINDOW < n) {
+			hashes[i % BATCH_WINDOW] = hashAhead(aarray, keys, lens,
+					i + BATCH_WINDOW);
+		}
+	}
+	return nDone;
+}
+
+size_t aaLookupBatch(AssociativeArray *aarray, AAKeyType keys[], size_t lens[],
+		size_t n, void *values[])
+{
+	HashIndex hashes[BATCH_WINDOW];
+	size_t i, nDone = 0;
+
+	for (i = 0; i < n && i < BATCH_WINDOW; i++) {
+		hashes[i] = hashAhead(aarray, keys, lens, i);
+	}
+	for (i = 0; i < n; i++) {
+		values[i] = lookupHashed(aarray, keys[i], lens[i],
+				hashes[i % BATCH_WINDOW]);
+		if (values[i] != NULL) {
+			nDone++;
+		}
+		if (i + BATCH_WINDOW < n) {
+			hashes[i % BATCH_WINDOW] = hashAhead(aarray, keys, lens,
+					i + BATCH_WINDOW);
+		}
+	}
+	return nDone;
+}
+
+size_t aaDeleteBatch(AssociativeArray *aarray, AAKeyType keys[], size_t lens[],
+		size_t n, void *values[])
+{
+	HashIndex hashes[BATCH_WINDOW];
+	size_t i, nDone = 0;
+
+	for (i = 0; i < n && i < BATCH_WINDOW; i++) {
+		hashes[i] = hashAhead(aarray, keys, lens, i);
+	}
+	for (i = 0; i < n; i++) {
+		values[i] = deleteHashed(aarray, keys[i], lens[i],
+				hashes[i % BATCH_WINDOW]);
+		if (values[i] != NULL) {
+			nDone++;
+		}
+		if (i + BATCH_WINDOW < n) {
+			hashes[i % BATCH_WINDOW] = hashAhead(aarray, keys, lens,
+					i + BATCH_WINDOW);
+		}
+	}
+	return nDone;
+}
+
+/**
+ * Print out the entire aarray contents
+ */
+static void
+printSlotTable(FILE *fp, AssociativeArray *aarray, SlotTable *table,
+		char *tag)
+{
+	char keybuffer[128];
+	HashIndex i;
+
+	if (table->buckets != NULL) {
+		chainPrint(fp, table, tag);
+		return;
+	}
+	if (table->packed != NULL) {
+		compactPrint(fp, aarray, table, tag);
+		return;
+	}
+
+	for (i = 0; i < table->size + table->nStash; i++) {
+		fprintf(fp, "%s  ", tag);
+		if (i >= table->size) {
+			printableKey(keybuffer, 128,
+					slotKey(&table->slots[i]),
+					table->slots[i].keylen);
+			fprintf(fp, "%zu : in stash : '%s'\n", i, keybuffer);
+			continue;
+		}
+		if (HASH_IS_USED(table->ctrl[i])) {
+			printableKey(keybuffer, 128,
+					slotKey(&table->slots[i]),
+					table->slots[i].keylen);
+			fprintf(fp, "%zu : in use : '%s'\n", i, keybuffer);
+		} else {
+			if (table->ctrl[i] == HASH_EMPTY) {
+				fprintf(fp, "%zu : empty (NULL)\n", i);
+			} else if (table->ctrl[i] == HASH_DELETED) {
+				printableKey(keybuffer, 128,
+						slotKey(&table->slots[i]),
+						table->slots[i].keylen);
+				fprintf(fp, "%zu : empty (deleted - was '%s')\n", i, keybuffer);
+			} else {
+				fprintf(fp, "%zu : invalid control byte 0x%02x\n", i,
+						table->ctrl[i]);
+			}
+		}
+	}
+}
+
+void aaPrintContents(FILE *fp, AssociativeArray *aarray, char * tag)
+{
+	if (aarray->shards != NULL) {
+		shardsPrintContents(fp, aarray, tag);
+		return;
+	}
+	if (aarray->snapshot != NULL) {
+		snapshotPrintContents(fp, aarray, tag);
+		return;
+	}
+
+	lockTable(aarray);
+	fprintf(fp, "%sDumping aarray of %zu entries:\n", tag, aarray->table->size);
+	printSlotTable(fp, aarray, aarray->table, tag);
+
+	if (aarray->draining != NULL) {
+		fprintf(fp, "%sDumping draining table of %zu entries:\n",
+				tag, aarray->draining->size);
+		printSlotTable(fp, aarray, aarray->draining, tag);
+	}
+	unlockTable(aarray);
+}
+
+
+/**
+ * Print out a short summary
+ */
+void aaPrintSummary(FILE *fp, AssociativeArray *aarray)
+{
+	AAMemoryUsage usage;
+	AAStats stats;
+
+	if (aarray->shards != NULL) {
+		shardsPrintSummary(fp, aarray);
+		return;
+	}
+	if (aarray->snapshot != NULL) {
+		snapshotPrintSummary(fp, aarray);
+		return;
+	}
+
+	lockTable(aarray);
+	fprintf(fp, "Associative array contains %zu entries in a table of %zu size\n",
+			aarray->nEntries, aarray->table->size);
+	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
+			aarray->hashNamePrimary, aarray->hashNameSecondary, aarray->probeName);
+	fprintf(fp, "Hash seed is %s (%016llx%016llx)\n",
+			aarray->hashSeedPinned ? "pinned" : "random",
+			(unsigned long long) aarray->hashSeed.k0,
+			(unsigned long long) aarray->hashSeed.k1);
+	fprintf(fp, "Table sizes are %s\n",
+			aarray->powerOfTwoSizes ? "powers of two" : "prime");
+	if (aarray->chained) {
+		fprintf(fp, "Entries are chained in nodes of %d, with %zu overflow nodes in %zu pool chunks\n",
+				CHAIN_NODE_ENTRIES, aarray->nodes.nodesInUse,
+				aarray->nodes.nChunks);
+	} else if (aarray->compact) {
+		fprintf(fp, "Entries are packed in slots of 32-bit hash and key reference, with their keys in a shared heap\n");
+	} else {
+		fprintf(fp, "Keys shorter than %d bytes are stored inline\n",
+				INLINE_KEY_BYTES);
+	}
+	if (aarray->compact) {
+		fprintf(fp, "All keys use %zu bytes of a %zu byte heap; %zu bytes to reclaim\n",
+				aarray->heap.bytesLive, aarray->heap.bytesReserved,
+				aarray->heap.bytesDead);
+	} else {
+		fprintf(fp, "%s keys use %zu bytes of %zu in %zu arena chunks; %zu bytes to reclaim\n",
+				aarray->chained ? "All" : "Longer",
+				aarray->keys.bytesLive, aarray->keys.bytesReserved,
+				aarray->keys.nChunks, aarray->keys.bytesDead);
+	}
+	fprintf(fp, "Table grows past a load of %.2f; %zu tombstones in use\n",
+			aarray->maxLoadFactor, aarray->table->nDeleted);
+	fprintf(fp, "Tombstones are cleared past %.2f of the table; cleared %llu times\n",
+			aarray->maxTombstoneFactor,
+			(unsigned long long) aarray->compactions);
+	if (aarray->draining != NULL) {
+		fprintf(fp, "Still draining %zu entries from previous table of %zu size\n",
+				aarray->draining->nUsed, aarray->draining->size);
+	}
+	if (readsAreLockFree(aarray)) {
+		fprintf(fp, "Shared between threads, with lookups taking no locks;"
+				" %zu blocks awaiting reclamation\n",
+				aarray->concurrency->nRetired);
+	} else if (aarray->concurrency != NULL) {
+		fprintf(fp, "Shared between threads, with %d stripe locks%s\n",
+				aarray->concurrency->nStripes,
+				aarray->chained || aarray->linearPlacement
+					? "" : " (unused by this strategy)");
+	}
+	unlockTable(aarray);
+
+	aaGetStats(aarray, &stats);
+	statsPrintSummary(fp, &stats);
+	aaMemoryUsage(aarray, &usage);
+	memoryPrintSummary(fp, &usage);
+}
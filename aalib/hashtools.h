@@ -2,6 +2,10 @@
 #define	__HASHING_TOOLS_HEADER__
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <aarray.h>
 
@@ -11,44 +15,699 @@ typedef size_t HashIndex;
 // definition of HashProbe and allow HashProbe to be used in AssociativeArray
 typedef struct AssociativeArray AssociativeArray;
 
-typedef HashIndex (*HashAlgorithm)(AAKeyType key, size_t keyLength, HashIndex tableSize);
-typedef HashIndex (*HashProbe)(struct AssociativeArray *table, AAKeyType key, size_t keyLength, int startIndex, int, int *cost);
+/**
+ * The secret that keyed hashes mix into every key.  Each array picks
+ * its own at random when it is created, unless one is pinned with
+ * aaSetHashSeed(), so that colliding keys cannot be worked out ahead
+ * of time.  Only the keyed hashes ("sip", "wyhash", "murmur" and the
+ * integer key mixer) use it.
+ */
+typedef struct HashSeed {
+	uint64_t k0;
+	uint64_t k1;
+} HashSeed;
 
+/**
+ * A hash algorithm returns the full width hash of the key; the table
+ * reduces it into its own index range using tableIndex() below
+ */
+typedef HashIndex (*HashAlgorithm)(AAKeyType key, size_t keyLength,
+		const HashSeed *seed);
+typedef HashIndex (*HashProbe)(struct AssociativeArray *table, AAKeyType key, size_t keyLength, HashIndex startIndex, int, int *cost);
+
+/**
+ * A search follows the same sequence as its probe, but looks for the
+ * slot holding the key.  It is passed the table to search, as the
+ * table being drained during growth is searched as well.
+ */
+struct SlotTable;
+typedef HashIndex (*HashSearch)(struct AssociativeArray *aarray, struct SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+
+/**
+ * Keys shorter than this many bytes are kept in the slot itself, saving
+ * an allocation per insert and a pointer chase per comparison; longer
+ * keys are copied to the heap.  The rest of the buffer is zeroed, so
+ * an inline key is NUL terminated just as a heap copy is.  This may be
+ * set at build time; anything up to the size of a pointer costs no
+ * extra room in the slot.
+ */
+#ifndef	INLINE_KEY_BYTES
+#define	INLINE_KEY_BYTES	24
+#endif
+
+/**
+ * The operation counts and histograms behind aaGetStats() are kept
+ * unless the library is built with -DAA_STATS=0, which leaves out every
+ * update to them (see STATS_ADD() below).
+ */
+#ifndef	AA_STATS
+#define	AA_STATS	1
+#endif
+
+/**
+ * The full hash of the key is kept with it, so that a slot whose hash
+ * differs can be passed over without following the key pointer, and
+ * so that entries can be moved to a new table without rehashing.
+ *
+ * Which member of the union holds the key depends on its length; use
+ * slotKey() to get at the key bytes.
+ */
 typedef struct KeyDataPair {
-	AAKeyType key;
+	union {
+		AAKeyType key;
+		unsigned char inlineKey[INLINE_KEY_BYTES];
+	};
 	size_t keylen;
+	HashIndex hash;
 	void *value;
-	int validity;
 } KeyDataPair;
 
+/**
+ * Strategies that move entries about once they are placed (such as
+ * Robin Hood) also decide where a new entry goes and how a slot is
+ * emptied.  A placement puts an entry, already filled in, into the
+ * current table and returns the slot it went to; a removal empties
+ * the used slot at index of the given table.
+ */
+typedef HashIndex (*HashPlace)(struct AssociativeArray *aarray, KeyDataPair *entry, int *cost);
+typedef void (*HashRemove)(struct AssociativeArray *aarray, struct SlotTable *table, HashIndex index);
+
+/**
+ * One generation of slot storage.  While the array is growing, the
+ * previous generation is kept alongside the current one and drained
+ * a few slots at a time by the operations that follow.
+ *
+ * The state of each slot is kept in a dense array of control bytes,
+ * separate from the key/value pairs, so that probing reads only the
+ * control bytes until it finds a slot that is likely to match.
+ *
+ * Past the end of the slots are STASH_SLOTS more, used by the cuckoo
+ * strategy for entries that fit in neither of their buckets.  They
+ * have no control bytes; the first nStash of them are in use.
+ *
+ * The chained engine has no ctrl or slots; each slot is instead the
+ * first node of a chain, in buckets (see chained.c).  Nor does the
+ * compact engine, whose slots are in packed (see compact.c).
+ *
+ * While one table drains into another, older links the new table to
+ * the old and newer the old to the new, so that a lookup taking no
+ * locks can follow an entry that moves while it searches (see
+ * lookupLockFree() in hash-table.c).
+ */
+struct ChainNode;
+struct CompactSlot;
+typedef struct SlotTable {
+	unsigned char *ctrl;
+	KeyDataPair *slots;
+	struct ChainNode *buckets;
+	struct CompactSlot *packed;
+	HashIndex size;
+	HashIndex nUsed;
+	HashIndex nDeleted;
+	HashIndex nStash;
+	struct SlotTable *older;
+	struct SlotTable *newer;
+
+	/** how hashes are reduced into [0...size-1]; see tableIndex() */
+	HashIndex sizeMask;
+#ifdef	__SIZEOF_INT128__
+	unsigned __int128 fastModMultiplier;
+#endif
+} SlotTable;
+
+/**
+ * Keys too long to be kept inline are bump allocated from a list of
+ * large chunks, owned by the array; see key-arena.c
+ */
+typedef struct KeyArenaChunk {
+	struct KeyArenaChunk *next;
+	size_t size;
+	size_t used;
+	unsigned char data[];
+} KeyArenaChunk;
+
+typedef struct KeyArena {
+	KeyArenaChunk *chunks;
+	size_t nChunks;
+	size_t bytesReserved;
+	size_t bytesLive;
+	size_t bytesDead;
+} KeyArena;
+
+/**
+ * The overflow nodes of the chained engine are carved from large
+ * chunks, and kept on a free list when not in use; see chained.c
+ */
+typedef struct ChainPool {
+	struct ChainChunk *chunks;
+	struct ChainNode *freeNodes;
+	size_t nChunks;
+	size_t nodesInUse;
+} ChainPool;
+
+/**
+ * The keys of the compact engine are kept one after another in a
+ * single buffer, each behind its length, and are referred to by their
+ * byte offset into it; see compact.c
+ */
+typedef struct CompactHeap {
+	unsigned char *bytes;
+	size_t bytesReserved;
+	size_t bytesUsed;
+	size_t bytesLive;
+	size_t bytesDead;
+} CompactHeap;
+
+/**
+ * The operation counts of an array, or of the threads sharing one.
+ * An array not in concurrent mode keeps one; in concurrent mode each
+ * thread adds to one of STATS_BLOCKS more, aligned to cache lines, so
+ * that threads do not contend for the lines of the counts (see
+ * statsBlock() below).  aaGetStats() adds them all up.
+ */
+#define	STATS_INSERTS	0
+#define	STATS_LOOKUPS	1
+#define	STATS_DELETES	2
+
+typedef struct StatsBlock {
+	AAOperationStats operations[3];
+	uint64_t keyCompares;
+	uint64_t hashMismatches;
+} StatsBlock;
+
+typedef struct ThreadStats {
+	StatsBlock counts;
+} __attribute__((aligned(64))) ThreadStats;
+
+/**
+ * The locks of an array in concurrent mode; see concurrent.c.
+ *
+ * Every operation holds tableLock: lookups share it, as do inserts and
+ * deletes on the chained, "linear" and "simd" engines, which also lock
+ * the stripes (ranges of slots) they work in.  Anything else that
+ * changes the table, including each step of draining it, holds
+ * tableLock alone.  storeLock guards the key arena and node pool while
+ * threads share the table.
+ *
+ * With lockFreeReads set, lookups take no lock at all: they find the
+ * table through "published", which writers replace as soon as a new
+ * table is made, and old tables and key arenas wait on the "retired"
+ * list until no lookup can still be reading them (see reclaim.c).
+ */
+typedef struct RetiredBlock {
+	struct RetiredBlock *next;
+	void *block;
+	void (*release)(void *block);
+	uint64_t epoch;
+} RetiredBlock;
+
+typedef struct StripeLock {
+	pthread_mutex_t mutex;
+} __attribute__((aligned(64))) StripeLock;
+
+/**
+ * The stripes, first to last, that a writer probing from its home slot
+ * holds; see stripeWalkStart() in concurrent.c
+ */
+typedef struct StripeWalk {
+	int first;
+	int last;
+} StripeWalk;
+
+typedef struct ConcurrencyControl {
+	pthread_rwlock_t tableLock;
+	pthread_mutex_t storeLock;
+	StripeLock *stripes;
+	int nStripes;
+	ThreadStats *threadStats;
+	int lockFreeReads;
+	SlotTable *published;
+	RetiredBlock *retired;
+	size_t nRetired;
+} ConcurrencyControl;
+
+/**
+ * The mapping behind an array loaded with aaLoadSnapshot(); see
+ * snapshot.c.  Such an array keeps its entries there rather than in
+ * its table, and cannot be changed.
+ */
+struct Snapshot;
+
 struct AssociativeArray {
-	KeyDataPair *table;
-	int size;
-	int nEntries;
+	SlotTable *table;
+	SlotTable *draining;
+	HashIndex drainIndex;
+	double maxLoadFactor;
+	double maxTombstoneFactor;
+	int powerOfTwoSizes;
+	HashIndex nEntries;
+	KeyArena keys;
+
+	/**
+	 * with lookups that take no locks, the arena of the keys still in
+	 * the draining table; they are copied to keys as they are moved
+	 */
+	KeyArena *drainingKeys;
+
+	/**
+	 * set for "linear" and "simd", which place each entry along the
+	 * linear sequence and never move it: their lookups can run without
+	 * locks, and their writers can lock just the stripes they probe
+	 */
+	int linearPlacement;
+	int chained;
+	ChainPool nodes;
+	int compact;
+	CompactHeap heap;
+	ConcurrencyControl *concurrency;
+	struct AssociativeArray **shards;
+	int nShards;
+	struct Snapshot *snapshot;
 	HashProbe hashProbe;
+	HashSearch hashSearch;
+	HashPlace hashPlace;
+	HashRemove hashRemove;
 	char *probeName;
+	HashSeed hashSeed;
+	int hashSeedPinned;
 	HashAlgorithm hashAlgorithmPrimary;
 	char *hashNamePrimary;
 	HashAlgorithm hashAlgorithmSecondary;
 	char *hashNameSecondary;
-	int searchCost;
-	int insertCost;
-	int deleteCost;
+	StatsBlock counts;
+	unsigned int latencyPeriod;
+	uint64_t rehashesAvoided;
+	uint64_t compactions;
 };
 
 
-#define	HASH_EMPTY		0
-#define	HASH_USED		1
-#define	HASH_DELETED	2
+/**
+ * Called by visitEntries() on each entry, with the full hash it is
+ * stored under, so that the entry can be placed elsewhere without
+ * hashing it again (an integer key cannot be, from its bytes alone).
+ * A negative return stops the visit.
+ */
+typedef int (*EntryVisitor)(AAKeyType key, size_t keylen, HashIndex hash,
+		void *value, void *userdata);
+
+/** do lookups on this array run without taking any lock? */
+static inline int
+readsAreLockFree(const AssociativeArray *aarray)
+{
+	return aarray->concurrency != NULL && aarray->concurrency->lockFreeReads;
+}
+
+/**
+ * Control byte values.  A used slot holds a 7-bit fragment of its
+ * key's hash (so the top bit is clear); the two unused states both
+ * have the top bit set.
+ */
+#define	HASH_EMPTY		0x80
+#define	HASH_DELETED	0xFE
+#define	HASH_IS_USED(ctrl)	(((ctrl) & 0x80) == 0)
+
+/**
+ * The control array carries this many extra bytes past the end of the
+ * table, mirroring the first bytes of the table, so that a group of up
+ * to 32 control bytes can be loaded from any slot without wrapping.
+ */
+#define	GROUP_CLONES	31
+
+/** grow once (used + deleted) slots pass this fraction of the table */
+#define	DEFAULT_MAX_LOAD_FACTOR	0.75
+
+/** clear out tombstones once they fill this fraction of the table */
+#define	DEFAULT_MAX_TOMBSTONE_FACTOR	0.25
+
+/** number of keys hashed and prefetched ahead by the batch operations */
+#define	BATCH_WINDOW	16
+
+/** number of overflow slots kept past the end of each table */
+#define	STASH_SLOTS		4
+
+/** number of blocks of counts kept by an array in concurrent mode */
+#define	STATS_BLOCKS	16
+
+/** number of old slots moved to the new table by each operation */
+#define	DRAIN_STEP		8
+
+/**
+ * entries held by each node of the chained engine, and the cache line
+ * size its nodes are aligned to
+ */
+#define	CHAIN_NODE_ENTRIES	4
+#define	CHAIN_NODE_ALIGN	64
+
+/** the least the key heap of the compact engine grows by */
+#define	COMPACT_HEAP_MIN_BYTES	(64 * 1024)
+
+/** size of each chunk of the key arena; longer keys get their own */
+#define	KEY_ARENA_CHUNK_BYTES	(64 * 1024)
+
+/**
+ * Add to a count that threads may update at the same time in
+ * concurrent mode, in which case the addition is made atomic.  Lookups
+ * that take no locks must not write to the array at all, so those
+ * counts are not kept in that mode.  The operation counts themselves
+ * are each thread's own (see statsBlock()), so the atomic addition
+ * rarely has to wait for another thread.
+ */
+#define	SHARED_ADD(aarray, count, n) \
+	do { \
+		if ((aarray)->concurrency == NULL) { \
+			(count) += (n); \
+		} else if ( ! (aarray)->concurrency->lockFreeReads) { \
+			__atomic_fetch_add(&(count), (n), __ATOMIC_RELAXED); \
+		} \
+	} while (0)
+
+/** raise a maximum under the same rules as SHARED_ADD() */
+#define	SHARED_MAX(aarray, maximum, n) \
+	do { \
+		uint64_t seen_; \
+		if ((aarray)->concurrency == NULL) { \
+			if ((uint64_t) (n) > (maximum)) (maximum) = (n); \
+		} else if ( ! (aarray)->concurrency->lockFreeReads) { \
+			seen_ = __atomic_load_n(&(maximum), __ATOMIC_RELAXED); \
+			while ((uint64_t) (n) > seen_ \
+					&& ! __atomic_compare_exchange_n(&(maximum), &seen_, \
+						(uint64_t) (n), 1, __ATOMIC_RELAXED, \
+						__ATOMIC_RELAXED)) \
+				; \
+		} \
+	} while (0)
+
+/** add to a count that only the statistics use */
+#if AA_STATS
+#define	STATS_ADD(aarray, count, n)	SHARED_ADD(aarray, count, n)
+#else
+#define	STATS_ADD(aarray, count, n)	do { } while (0)
+#endif
+
+/** the block of counts of the calling thread, once it has claimed one */
+extern __thread int statsSlot;
+int claimStatsSlot(void);
+
+/**
+ * The counts the calling thread adds to: the array's own, or in
+ * concurrent mode the block of the thread.  The threads take the
+ * blocks in turn, so they only share one when there are more than
+ * STATS_BLOCKS of them.
+ */
+static inline StatsBlock *
+statsBlock(AssociativeArray *aarray)
+{
+	if (aarray->concurrency == NULL) {
+		return &aarray->counts;
+	}
+	return &aarray->concurrency->threadStats[statsSlot >= 0
+			? statsSlot : claimStatsSlot()].counts;
+}
+
+/** the histogram bucket of a probe length or latency */
+static inline int
+statsBucket(uint64_t n)
+{
+	int bucket = (n == 0) ? 0 : 64 - __builtin_clzll(n);
+
+	return bucket < AA_STATS_BUCKETS ? bucket : AA_STATS_BUCKETS - 1;
+}
+
+/**
+ * Count one operation (STATS_INSERTS, STATS_LOOKUPS or STATS_DELETES),
+ * which found its key (or stored it) or not, and the probes it took
+ */
+static inline void
+recordOperation(AssociativeArray *aarray, int operation,
+		int found, int probes)
+{
+#if AA_STATS
+	AAOperationStats *stats = &statsBlock(aarray)->operations[operation];
+
+	if (found) {
+		SHARED_ADD(aarray, stats->hits, 1);
+	} else {
+		SHARED_ADD(aarray, stats->misses, 1);
+	}
+	SHARED_ADD(aarray, stats->probes, probes);
+	SHARED_ADD(aarray, stats->probeHistogram[statsBucket(probes)], 1);
+	SHARED_MAX(aarray, stats->maxProbes, probes);
+#endif
+}
+
+int latencySampleDue(unsigned int period);
+void recordLatency(AssociativeArray *aarray, int operation,
+		const struct timespec *start);
+
+/**
+ * Start the clock on an operation if it is one to be timed; only one
+ * operation in every latencyPeriod of each thread is, so that timing
+ * costs next to nothing, and none are unless a period is set.
+ *
+ *  @return      nonzero if the operation is timed
+ */
+static inline int
+sampleLatency(AssociativeArray *aarray, struct timespec *start)
+{
+#if AA_STATS
+	if (aarray->latencyPeriod != 0 && latencySampleDue(aarray->latencyPeriod)) {
+		clock_gettime(CLOCK_MONOTONIC, start);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * Reduce a full width hash into the index range of the given table.
+ *
+ * Power of two tables simply mask off the high bits.  Prime sized
+ * tables use Lemire's "fastmod" reduction, which replaces the hardware
+ * divide with multiplications by a constant precomputed per table
+ * (see setTableReduction() in hash-table.c).  It gives exactly the same
+ * result as hash % size.
+ */
+static inline HashIndex
+tableIndex(const SlotTable *table, HashIndex hash)
+{
+	if (table->sizeMask != 0)
+		return hash & table->sizeMask;
+
+#ifdef	__SIZEOF_INT128__
+	{
+		unsigned __int128 lowbits = table->fastModMultiplier * hash;
+		unsigned __int128 bottom = ((lowbits & UINT64_MAX) * table->size) >> 64;
+		unsigned __int128 top = (lowbits >> 64) * table->size;
+
+		return (HashIndex) ((bottom + top) >> 64);
+	}
+#else
+	return hash % table->size;
+#endif
+}
+
+/**
+ * The hash used by the integer key interface: the multiply-xorshift
+ * finalizer from MurmurHash3.  Each step is invertible, so distinct
+ * keys always have distinct hashes.
+ */
+static inline HashIndex
+mixInteger(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= UINT64_C(0xff51afd7ed558ccd);
+	key ^= key >> 33;
+	key *= UINT64_C(0xc4ceb9fe1a85ec53);
+	key ^= key >> 33;
+	return (HashIndex) key;
+}
+
+/**
+ * The 7-bit fragment of the hash stored in the control byte of a used
+ * slot.  It is taken from the top of a Fibonacci multiply of the hash
+ * so that it is independent of the bits that chose the slot, even for
+ * hashes (such as a sum of bytes) that have no high bits of their own.
+ */
+static inline unsigned char
+hashFragment(HashIndex hash)
+{
+	return (unsigned char) (((uint64_t) hash * UINT64_C(0x9E3779B97F4A7C15)) >> 57);
+}
+
+/**
+ * The shard of a sharded array that a hash belongs to.  The hash is
+ * mixed first and the high bits of the mix pick the shard: many hashes
+ * (a sum of bytes, say) have no high bits of their own, and the tables
+ * index by the low bits, so the keys in one shard still spread over its
+ * table.  The mix is not the multiply hashFragment() takes its bits
+ * from, so the fragments within a shard are not narrowed either.
+ */
+static inline int
+shardIndex(const AssociativeArray *aarray, HashIndex hash)
+{
+	return (int) ((mixInteger(hash) >> 32) * aarray->nShards >> 32);
+}
+
+static inline AssociativeArray *
+shardFor(const AssociativeArray *aarray, HashIndex hash)
+{
+	return aarray->shards[shardIndex(aarray, hash)];
+}
+
+/**
+ * Set the control byte of a slot, keeping the mirrored tail in step.
+ * The store is a release, so that a lookup taking no locks that sees
+ * the new byte also sees the entry written to the slot before it.
+ */
+static inline void
+setCtrl(SlotTable *table, HashIndex index, unsigned char ctrl)
+{
+	__atomic_store_n(&table->ctrl[index], ctrl, __ATOMIC_RELEASE);
+	if (index < GROUP_CLONES) {
+		for (index += table->size; index < table->size + GROUP_CLONES;
+				index += table->size) {
+			__atomic_store_n(&table->ctrl[index], ctrl, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+/** read the control byte of a slot, pairing with setCtrl() */
+static inline unsigned char
+loadCtrl(const SlotTable *table, HashIndex index)
+{
+	return __atomic_load_n(&table->ctrl[index], __ATOMIC_ACQUIRE);
+}
+
+/** is a key of this length kept inline in its slot? */
+static inline int
+keyIsInline(size_t keylen)
+{
+	return keylen < INLINE_KEY_BYTES;
+}
+
+/** the bytes of the key held in a slot, wherever they are kept */
+static inline AAKeyType
+slotKey(KeyDataPair *pair)
+{
+	return keyIsInline(pair->keylen) ? pair->inlineKey : pair->key;
+}
+
+/**
+ * Does the used slot at index hold the given key?  Callers check the
+ * control byte fragment first, so this is only reached on a likely match.
+ * The stored hash is compared before the key bytes, which live in a
+ * separate allocation and so are likely to miss the cache.
+ */
+static inline int
+slotMatches(AssociativeArray *aarray, const SlotTable *table,
+		HashIndex index, AAKeyType key, size_t keylen, HashIndex hash)
+{
+	KeyDataPair *pair = &table->slots[index];
+
+	if (pair->hash != hash || pair->keylen != keylen) {
+		STATS_ADD(aarray, statsBlock(aarray)->hashMismatches, 1);
+		return 0;
+	}
+	STATS_ADD(aarray, statsBlock(aarray)->keyCompares, 1);
+	return memcmp(slotKey(pair), key, keylen) == 0;
+}
+
+/** step an index forward by one, wrapping at the end of the table */
+static inline HashIndex
+nextTableIndex(const SlotTable *table, HashIndex index)
+{
+	return (index + 1 == table->size) ? 0 : index + 1;
+}
 
 /** prototypes */
-HashIndex hashByLength(AAKeyType key, size_t keyLength, HashIndex size);
-HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex tableSize);
-HashIndex linearProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-HashIndex  quadraticProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-HashIndex  doubleHashProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-HashIndex customHash(AAKeyType key, size_t keylen, HashIndex tableSize);
-int getLargerPrime(int value);
+HashIndex hashByLength(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashIndex hashBySum(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashIndex linearProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, HashIndex index, int stopOnInvalid, int *cost);
+HashIndex  quadraticProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, HashIndex index, int stopOnInvalid, int *cost);
+HashIndex  doubleHashProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, HashIndex index, int stopOnInvalid, int *cost);
+HashIndex customHash(AAKeyType key, size_t keylen, const HashSeed *seed);
+HashIndex wyhash(AAKeyType key, size_t keylen, const HashSeed *seed);
+HashIndex murmurHash(AAKeyType key, size_t keylen, const HashSeed *seed);
+HashIndex sipHash13(AAKeyType key, size_t keylen, const HashSeed *seed);
+void randomHashSeed(HashSeed *seed);
+HashIndex linearSearch(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+HashIndex quadraticSearch(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+HashIndex doubleHashSearch(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+HashIndex robinHoodPlace(AssociativeArray *aarray, KeyDataPair *entry, int *cost);
+HashIndex robinHoodSearch(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+void robinHoodRemove(AssociativeArray *aarray, SlotTable *table, HashIndex index);
+HashIndex cuckooPlace(AssociativeArray *aarray, KeyDataPair *entry, int *cost);
+HashIndex cuckooSearch(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, int *cost);
+void cuckooRemove(AssociativeArray *aarray, SlotTable *table, HashIndex index);
+void chainPoolInit(ChainPool *pool);
+void chainPoolDestroy(ChainPool *pool);
+int chainCreateBuckets(SlotTable *table);
+HashIndex chainPlace(AssociativeArray *aarray, AAKeyType key, size_t keyLength, HashIndex hash, void *value, int *cost);
+int chainLookup(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, void **value, int *cost);
+int chainRemove(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, void **value, int *cost);
+void chainPrefetch(const SlotTable *table, HashIndex hash);
+int chainDrainBucket(AssociativeArray *aarray, SlotTable *old, HashIndex bucket);
+void chainRebuildKeys(SlotTable *table, KeyArena *fresh);
+int chainVisit(SlotTable *table, EntryVisitor visitor, void *userdata);
+void chainPrint(FILE *fp, SlotTable *table, char *tag);
+size_t chainTableBytes(const SlotTable *table);
+void chainPoolBytes(const ChainPool *pool, size_t *inUse, size_t *reserved);
+void compactHeapInit(CompactHeap *heap);
+void compactHeapDestroy(CompactHeap *heap);
+int compactCreateSlots(SlotTable *table);
+HashIndex compactPlace(AssociativeArray *aarray, AAKeyType key, size_t keyLength, HashIndex hash, void *value, int *cost);
+int compactLookup(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, void **value, int *cost);
+int compactRemove(AssociativeArray *aarray, SlotTable *table, AAKeyType key, size_t keyLength, HashIndex hash, void **value, int *cost);
+void compactPrefetch(const SlotTable *table, HashIndex hash);
+void compactDrainSlot(AssociativeArray *aarray, SlotTable *old, HashIndex index);
+void compactRebuildHeap(AssociativeArray *aarray);
+int compactVisit(AssociativeArray *aarray, SlotTable *table, EntryVisitor visitor, void *userdata);
+void compactPrint(FILE *fp, AssociativeArray *aarray, SlotTable *table, char *tag);
+size_t compactTableBytes(const SlotTable *table);
+HashProbe groupProbeFor(const char *name);
+HashSearch groupSearchFor(const char *name);
+HashIndex getLargerPrime(HashIndex value);
+
+ConcurrencyControl *concurrencyCreate(int nStripes);
+void lockTable(AssociativeArray *aarray);
+void lockTableShared(AssociativeArray *aarray);
+void unlockTable(AssociativeArray *aarray);
+pthread_mutex_t *lockStripe(AssociativeArray *aarray, HashIndex hash);
+void stripeWalkStart(AssociativeArray *aarray, StripeWalk *walk, HashIndex index);
+int stripeWalkReach(AssociativeArray *aarray, StripeWalk *walk, HashIndex index);
+void stripeWalkEnd(AssociativeArray *aarray, StripeWalk *walk);
+void lockStore(AssociativeArray *aarray);
+void unlockStore(AssociativeArray *aarray);
+void concurrencyDestroy(AssociativeArray *aarray);
+int epochEnter(void);
+void epochExit(void);
+void retireBlock(AssociativeArray *aarray, void *block,
+		void (*release)(void *block));
+void publishTable(AssociativeArray *aarray);
+void reclaimRetired(AssociativeArray *aarray, int everything);
+
+void shardsDestroy(AssociativeArray *aarray);
+void shardsPrintContents(FILE *fp, AssociativeArray *aarray, char *tag);
+void shardsPrintSummary(FILE *fp, AssociativeArray *aarray);
+int visitEntries(AssociativeArray *aarray, EntryVisitor visitor, void *userdata);
+
+void *snapshotLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen, HashIndex hash, int *cost);
+HashIndex snapshotTableSize(const AssociativeArray *aarray);
+size_t snapshotMappedBytes(const AssociativeArray *aarray);
+int snapshotVisit(AssociativeArray *aarray, EntryVisitor visitor, void *userdata);
+void snapshotPrintContents(FILE *fp, AssociativeArray *aarray, char *tag);
+void snapshotPrintSummary(FILE *fp, AssociativeArray *aarray);
+void snapshotRelease(AssociativeArray *aarray);
+
+void statsPrintSummary(FILE *fp, const AAStats *stats);
+void memoryPrintSummary(FILE *fp, const AAMemoryUsage *usage);
+
+void arenaInit(KeyArena *arena);
+int arenaReserve(KeyArena *arena, size_t nBytes);
+AAKeyType arenaCopyKey(KeyArena *arena, AAKeyType key, size_t keylen);
+void arenaReleaseKey(KeyArena *arena, size_t keylen);
+void arenaMerge(KeyArena *arena, KeyArena *other);
+void arenaDestroy(KeyArena *arena);
 
 int doKeysMatch(AAKeyType key1, size_t key1len, AAKeyType key2, size_t key2len);
 int printableKey(char *buffer, int bufferlen, AAKeyType key, size_t keylen);
@@ -0,0 +1,133 @@
+/**
+ * The store for keys too long to be kept inline in their slot.
+ *
+ * Keys are bump allocated from large chunks rather than malloc'd one
+ * at a time.  Nothing is freed individually: the bytes of a deleted
+ * key are only counted as dead, and are given back when the live keys
+ * are copied into a fresh arena (see arenaRebuild() in hash-table.c)
+ * or when the whole arena is released, which costs one free() per
+ * chunk however many keys it holds.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtools.h"
+
+/**
+ * Add a chunk with room for at least minBytes to the head of the
+ * chunk list, which is where allocation always takes place
+ */
+static KeyArenaChunk *
+addArenaChunk(KeyArena *arena, size_t minBytes)
+{
+	KeyArenaChunk *chunk;
+	size_t size = KEY_ARENA_CHUNK_BYTES;
+
+	if (size < minBytes) {
+		size = minBytes;
+	}
+
+	chunk = (KeyArenaChunk *) malloc(sizeof(KeyArenaChunk) + size);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	chunk->next = arena->chunks;
+	chunk->size = size;
+	chunk->used = 0;
+
+	arena->chunks = chunk;
+	arena->nChunks++;
+	arena->bytesReserved += size;
+	return chunk;
+}
+
+/** set up an arena holding no chunks */
+void arenaInit(KeyArena *arena)
+{
+	arena->chunks = NULL;
+	arena->nChunks = 0;
+	arena->bytesReserved = 0;
+	arena->bytesLive = 0;
+	arena->bytesDead = 0;
+}
+
+/**
+ * Make sure the next nBytes of keys can be copied without another
+ * chunk being needed.
+ *
+ *  @return      0 on success, or -1 if no memory is left
+ */
+int arenaReserve(KeyArena *arena, size_t nBytes)
+{
+	KeyArenaChunk *chunk = arena->chunks;
+
+	if (chunk == NULL || chunk->size - chunk->used < nBytes) {
+		if (addArenaChunk(arena, nBytes) == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Copy a key into the arena, with a NUL after it as the keys are
+ * often strings.
+ *
+ *  @return      the copy of the key, or NULL if no memory is left
+ */
+AAKeyType arenaCopyKey(KeyArena *arena, AAKeyType key, size_t keylen)
+{
+	KeyArenaChunk *chunk;
+	AAKeyType copy;
+
+	if (arenaReserve(arena, keylen + 1) < 0) {
+		return NULL;
+	}
+
+	chunk = arena->chunks;
+	copy = chunk->data + chunk->used;
+	memcpy(copy, key, keylen);
+	copy[keylen] = '\0';
+	chunk->used += keylen + 1;
+	arena->bytesLive += keylen + 1;
+	return copy;
+}
+
+/** note that a key copied by arenaCopyKey() is no longer in use */
+void arenaReleaseKey(KeyArena *arena, size_t keylen)
+{
+	arena->bytesLive -= keylen + 1;
+	arena->bytesDead += keylen + 1;
+}
+
+/**
+ * Take over every chunk of another arena, and the keys in them, leaving
+ * it empty.  They go at the tail of the list, so allocation carries on
+ * in the head chunk of this arena.
+ */
+void arenaMerge(KeyArena *arena, KeyArena *other)
+{
+	KeyArenaChunk **tail;
+
+	for (tail = &arena->chunks; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = other->chunks;
+	arena->nChunks += other->nChunks;
+	arena->bytesReserved += other->bytesReserved;
+	arena->bytesLive += other->bytesLive;
+	arena->bytesDead += other->bytesDead;
+	arenaInit(other);
+}
+
+/** give back every chunk, and so every key, in the arena */
+void arenaDestroy(KeyArena *arena)
+{
+	KeyArenaChunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arenaInit(arena);
+}
@@ -3,8 +3,15 @@
  * A tool to find a good prime number for use as a table size.
  */
 
-/** a table of primes up to a moderately large size */
-static int sPrimes[] = {
+#include "hashtools.h"
+
+/**
+ * a table of every prime up to a moderately large size, followed by a
+ * ladder of primes that grows geometrically (by a factor of about
+ * 2^(1/4)) from there up to 2^40, so that large tables can still be
+ * sized within a few percent of what was asked for
+ */
+static const HashIndex sPrimes[] = {
 		   2,      3,      5,      7,     11,     13,     17,     19,     23,     29,
 		  31,     37,     41,     43,     47,     53,     59,     61,     67,     71,
 		  73,     79,     83,     89,     97,    101,    103,    107,    109,    113,
@@ -105,25 +112,57 @@ static int sPrimes[] = {
 		7649,   7669,   7673,   7681,   7687,   7691,   7699,   7703,   7717,   7723,
 		7727,   7741,   7753,   7757,   7759,   7789,   7793,   7817,   7823,   7829,
 		7841,   7853,   7867,   7873,   7877,   7879,   7883,   7901,   7907,   7919,
-		-1
+
+		/** the geometric ladder: the first prime at or above 2^(k/4) */
+		          9743,          11587,          13781,          16411,          19489,
+		         23173,          27581,          32771,          38971,          46349,
+		         55109,          65537,          77951,          92683,         110221,
+		        131101,         155887,         185369,         220447,         262147,
+		        311747,         370759,         440893,         524309,         623521,
+		        741457,         881779,        1048583,        1246997,        1482919,
+		       1763491,        2097169,        2493949,        2965847,        3526987,
+		       4194319,        4987901,        5931649,        7053971,        8388617,
+		       9975803,       11863289,       14107921,       16777259,       19951597,
+		      23726569,       28215809,       33554467,       39903197,       47453149,
+		      56431657,       67108879,       79806341,       94906297,      112863217,
+		     134217757,      159612679,      189812533,      225726419,      268435459,
+		     319225391,      379625083,      451452839,      536870923,      638450719,
+		     759250133,      902905657,     1073741827,     1276901429,     1518500279,
+		    1805811341,     2147483659,     2553802871,     3037000507,     3611622607,
+		    4294967311,     5107605691,     6074001001,     7223245229,     8589934609,
+		   10215211387,    12148002047,    14446490449,    17179869209,    20430422699,
+		   24296004011,    28892980877,    34359738421,    40860845437,    48592008053,
+		   57785961671,    68719476767,    81721690807,    97184016049,   115571923303,
+		  137438953481,   163443381373,   194368032011,   231143846587,   274877906951,
+		  326886762733,   388736063999,   462287693167,   549755813911,   653773525393,
+		  777472128049,   924575386373,  1099511627791,
 	};
 
+#define	N_PRIMES	(sizeof(sPrimes) / sizeof(sPrimes[0]))
+
 
 /**
- * Locates the next largest prime.
+ * Locates the next largest prime, using a binary search of the table.
  *  params  value  the value to start at
- *  returns the prime larger than the given value, if known
+ *  returns the smallest known prime no smaller than the given value,
+ *			or 0 if the value is beyond the end of the table
  */
-int getLargerPrime(int value)
+HashIndex getLargerPrime(HashIndex value)
 {
-	int i = 0;
-	while (sPrimes[i] > 0 && sPrimes[i] < value)
-		i++;
-
-	/** if we walked off the table, return -1 */
-	if (sPrimes[i] < 0) return (-1);
+	size_t low = 0, high = N_PRIMES;
+	size_t middle;
 
-	return sPrimes[i];
-}
+	/** find the first entry that is not less than value */
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (sPrimes[middle] < value)
+			low = middle + 1;
+		else
+			high = middle;
+	}
 
+	/** if we walked off the table, return 0 */
+	if (low == N_PRIMES) return 0;
 
+	return sPrimes[low];
+}
@@ -0,0 +1,215 @@
+/**
+ * Epoch based reclamation, for arrays whose lookups take no locks.
+ *
+ * A lookup in that mode may still be reading a table, or a key in the
+ * arena, after a writer has replaced it.  So the writer does not free
+ * the old memory, but retires it, and frees it only once every lookup
+ * that could have seen it has finished.
+ *
+ * Each thread that looks up keys is given a reader record, on a cache
+ * line of its own, the first time it does so.  A lookup stores the
+ * global epoch in its record on the way in and clears it on the way
+ * out; that is the only memory it writes, and no other thread writes
+ * to the record.  When a writer publishes a new table, it advances the
+ * global epoch and stamps everything retired so far with the new
+ * value.  A lookup that started at an older epoch might have found the
+ * old table; one that started at the new epoch or later cannot have,
+ * so a block is freed once no record holds an epoch older than its
+ * stamp.
+ *
+ * The records are shared by every array, which only makes the wait a
+ * little longer than it needs to be.  A thread that finds them all
+ * taken falls back on sharing the table lock with other such threads.
+ */
+
+#include <stdlib.h>
+
+#include "hashtools.h"
+
+/** the most threads that can take part in lock-free lookups at once */
+#define	EPOCH_READERS	128
+
+typedef struct EpochRecord {
+	uint64_t epoch;		// 0 when the thread is not in a lookup
+	int claimed;
+} __attribute__((aligned(64))) EpochRecord;
+
+static EpochRecord records[EPOCH_READERS];
+static uint64_t globalEpoch = 1;
+
+static __thread int readerRecord = -1;
+static pthread_key_t recordKey;
+static pthread_once_t recordKeyOnce = PTHREAD_ONCE_INIT;
+
+/** give a thread's record back when it exits */
+static void
+releaseRecord(void *record)
+{
+	__atomic_store_n(&((EpochRecord *) record)->claimed, 0, __ATOMIC_RELEASE);
+}
+
+static void
+createRecordKey(void)
+{
+	pthread_key_create(&recordKey, releaseRecord);
+}
+
+/** find the calling thread its record, claiming one if need be */
+static int
+claimRecord(void)
+{
+	int i, unclaimed;
+
+	pthread_once(&recordKeyOnce, createRecordKey);
+	for (i = 0; i < EPOCH_READERS; i++) {
+		unclaimed = 0;
+		if (__atomic_compare_exchange_n(&records[i].claimed, &unclaimed, 1,
+				0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			pthread_setspecific(recordKey, &records[i]);
+			readerRecord = i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Mark the calling thread as being inside a lookup.  Whatever the
+ * lookup then finds through a published table stays valid until the
+ * matching epochExit().
+ *
+ *  @return      0 on success, or -1 if every reader record is taken,
+ *				 in which case the caller must lock the table instead
+ */
+int epochEnter(void)
+{
+	uint64_t epoch;
+
+	if (readerRecord < 0 && claimRecord() < 0) {
+		return -1;
+	}
+
+	/**
+	 * the store must be seen by writers before the table pointer is
+	 * loaded, so both it and the writer's epoch advance are seq_cst
+	 */
+	epoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&records[readerRecord].epoch, epoch, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+void epochExit(void)
+{
+	__atomic_store_n(&records[readerRecord].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/** the oldest epoch any lookup under way started in, or UINT64_MAX */
+static uint64_t
+oldestActiveEpoch(void)
+{
+	uint64_t oldest = UINT64_MAX, epoch;
+	int i;
+
+	for (i = 0; i < EPOCH_READERS; i++) {
+		epoch = __atomic_load_n(&records[i].epoch, __ATOMIC_SEQ_CST);
+		if (epoch != 0 && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+	return oldest;
+}
+
+/**
+ * Hand over memory that lookups may still be reading, to be released
+ * once they have all moved on.  It is stamped at the next call to
+ * publishTable(), which callers make once no lookup starting after it
+ * could reach the block.  An array whose
+ * lookups take locks releases the memory straight away.
+ */
+void retireBlock(AssociativeArray *aarray, void *block,
+		void (*release)(void *block))
+{
+	ConcurrencyControl *cc = aarray->concurrency;
+	RetiredBlock *retired;
+	uint64_t epoch;
+
+	if (cc == NULL || ! cc->lockFreeReads) {
+		release(block);
+		return;
+	}
+
+	retired = (RetiredBlock *) malloc(sizeof(RetiredBlock));
+	if (retired == NULL) {
+		/** with no memory to track the block, wait out the readers now */
+		publishTable(aarray);
+		epoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+		while (oldestActiveEpoch() < epoch) {
+			;
+		}
+		reclaimRetired(aarray, 0);
+		release(block);
+		return;
+	}
+
+	retired->block = block;
+	retired->release = release;
+	retired->epoch = 0;
+	retired->next = cc->retired;
+	cc->retired = retired;
+	cc->nRetired++;
+}
+
+/**
+ * Make the current table the one that lookups taking no locks search,
+ * and stamp everything retired up to now with the epoch that follows.
+ */
+void publishTable(AssociativeArray *aarray)
+{
+	ConcurrencyControl *cc = aarray->concurrency;
+	RetiredBlock *retired;
+	uint64_t epoch;
+
+	if (cc == NULL || ! cc->lockFreeReads) {
+		return;
+	}
+
+	__atomic_store_n(&cc->published, aarray->table, __ATOMIC_SEQ_CST);
+	epoch = __atomic_add_fetch(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+	for (retired = cc->retired; retired != NULL; retired = retired->next) {
+		if (retired->epoch == 0) {
+			retired->epoch = epoch;
+		}
+	}
+	reclaimRetired(aarray, 0);
+}
+
+/**
+ * Release the retired blocks that no lookup can be reading any more.
+ * Writers call this with the table held.
+ *
+ *  @param  everything  release every block, as when the array itself
+ *				is deleted and so no lookups may be under way
+ */
+void reclaimRetired(AssociativeArray *aarray, int everything)
+{
+	ConcurrencyControl *cc = aarray->concurrency;
+	RetiredBlock **link, *retired;
+	uint64_t oldest;
+
+	if (cc == NULL || cc->retired == NULL) {
+		return;
+	}
+
+	oldest = everything ? UINT64_MAX : oldestActiveEpoch();
+	link = &cc->retired;
+	while ((retired = *link) != NULL) {
+		if (everything || (retired->epoch != 0 && retired->epoch <= oldest)) {
+			*link = retired->next;
+			retired->release(retired->block);
+			free(retired);
+			cc->nRetired--;
+		} else {
+			link = &retired->next;
+		}
+	}
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+
+#include "hashtools.h"
+
+/**
+ * Robin Hood probing: the "robinhood" probing strategy.
+ *
+ * Entries are probed for in the same order as linear probing, but an
+ * insert that meets an entry closer to its home slot than the new one
+ * is to its own takes that slot, and carries on to find a place for
+ * the entry it displaced.  The distances of the entries along any probe
+ * chain then never fall by more than one from one slot to the next, so
+ * probe lengths vary far less than with plain linear probing, and a
+ * search can stop as soon as it passes an entry nearer its home than
+ * the key would be -- the key would have taken that slot.
+ *
+ * Deleting shifts the entries that follow back by one slot, until an
+ * empty slot or an entry already in its home slot is reached, so no
+ * tombstones are ever left in the current table.  The table being
+ * drained during growth still gets tombstones, as its entries are
+ * leaving it anyway.
+ *
+ * Distances are worked out from the full hash kept in each slot, so
+ * nothing more needs to be stored.
+ */
+
+/** how far the entry in slot index is from its home slot */
+static inline HashIndex
+probeDistance(const SlotTable *table, HashIndex index, HashIndex hash)
+{
+	HashIndex home = tableIndex(table, hash);
+
+	return index >= home ? index - home : index + table->size - home;
+}
+
+/**
+ * Place an entry, displacing any entry that is closer to home than the
+ * one being placed is at that slot.
+ *
+ *  @return      the slot the new entry went to, or (HashIndex) -1 if
+ *				 the table is full
+ *  @see    HashPlace
+ */
+HashIndex robinHoodPlace(AssociativeArray *aarray, KeyDataPair *entry, int *cost)
+{
+	SlotTable *table = aarray->table;
+	KeyDataPair carried = *entry, displaced;
+	HashIndex index, distance = 0, residentDistance;
+	HashIndex placed = (HashIndex) -1;
+
+	/** with a free slot somewhere, the loop below always ends */
+	if (table->nUsed >= table->size) {
+		fprintf(stderr, "Hash table full\n");
+		return (HashIndex) -1;
+	}
+
+	index = tableIndex(table, carried.hash);
+	(*cost)++;
+
+	while (HASH_IS_USED(table->ctrl[index])) {
+		residentDistance = probeDistance(table, index, table->slots[index].hash);
+		if (residentDistance < distance) {
+			displaced = table->slots[index];
+			table->slots[index] = carried;
+			setCtrl(table, index, hashFragment(carried.hash));
+			if (placed == (HashIndex) -1) {
+				placed = index;
+			}
+			carried = displaced;
+			distance = residentDistance;
+		}
+
+		index = nextTableIndex(table, index);
+		distance++;
+		(*cost)++;
+	}
+
+	/** deletes never leave tombstones here, but a slot may be reused */
+	if (table->ctrl[index] == HASH_DELETED) {
+		table->nDeleted--;
+	}
+	table->slots[index] = carried;
+	setCtrl(table, index, hashFragment(carried.hash));
+	table->nUsed++;
+
+	return placed == (HashIndex) -1 ? index : placed;
+}
+
+/**
+ * Locate the slot holding the given key.  The search ends at an empty
+ * slot, or at an entry nearer its home than the key would be.
+ * Tombstones (only found in a table being drained) are stepped over.
+ *
+ *  @see    HashSearch
+ */
+HashIndex robinHoodSearch(AssociativeArray *aarray, SlotTable *table,
+		AAKeyType key, size_t keylen, HashIndex hash, int *cost)
+{
+	HashIndex index = tableIndex(table, hash);
+	HashIndex distance = 0;
+	unsigned char fragment = hashFragment(hash);
+	unsigned char ctrl;
+
+	(*cost)++;
+	while ((ctrl = table->ctrl[index]) != HASH_EMPTY) {
+		if (HASH_IS_USED(ctrl)) {
+			if (ctrl == fragment
+					&& slotMatches(aarray, table, index, key, keylen, hash)) {
+				return index;
+			}
+			if (probeDistance(table, index, table->slots[index].hash) < distance) {
+				break;
+			}
+		}
+
+		index = nextTableIndex(table, index);
+		if (++distance >= table->size) {
+			break; // The entire table has been searched
+		}
+		(*cost)++;
+	}
+
+	return (HashIndex) -1;
+}
+
+/**
+ * Empty the slot at index by shifting the entries after it back by one,
+ * up to an empty slot or an entry that is already in its home slot.
+ *
+ *  @see    HashRemove
+ */
+void robinHoodRemove(AssociativeArray *aarray, SlotTable *table, HashIndex index)
+{
+	HashIndex next;
+
+	/** the table being drained just keeps its chains intact */
+	if (table != aarray->table) {
+		setCtrl(table, index, HASH_DELETED);
+		table->nUsed--;
+		table->nDeleted++;
+		return;
+	}
+
+	for (;;) {
+		next = nextTableIndex(table, index);
+		if ( ! HASH_IS_USED(table->ctrl[next])
+				|| probeDistance(table, next, table->slots[next].hash) == 0) {
+			break;
+		}
+		table->slots[index] = table->slots[next];
+		setCtrl(table, index, table->ctrl[next]);
+		index = next;
+	}
+
+	setCtrl(table, index, HASH_EMPTY);
+	table->nUsed--;
+}
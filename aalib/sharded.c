@@ -0,0 +1,172 @@
+/**
+ * Sharding: an array split into independent sub-arrays.
+ *
+ * Once aaSetShards() has been called, the array itself holds nothing.
+ * Every key is hashed as usual and passed, hash and all, to the shard
+ * its hash picks (see shardFor()), so the interface of the array does
+ * not change.  Each shard is a complete array of its own: it grows,
+ * compacts and, in concurrent mode, locks on its own.  Threads working
+ * on keys in different shards never meet, and growing a shard moves
+ * only the entries of that shard.
+ *
+ * All shards share the strategies, settings and hash seed of the
+ * array; the aaSet calls made on the array afterwards are passed on
+ * to each shard.
+ */
+
+#include <stdlib.h>
+
+#include "hashtools.h"
+
+/**
+ * Split an empty array into nShards independent sub-arrays, each
+ * starting out with an even part of the array's room.  This must be
+ * done before anything is inserted, and before aaSetConcurrency() or
+ * aaSetLockFreeReads(), which then apply to each shard.
+ *
+ *  @param  nShards  the number of sub-arrays to make
+ *  @return      0 on success, or a negative number if the array is in
+ *				 use or already sharded, or the shards cannot be made
+ */
+int
+aaSetShards(AssociativeArray *aarray, int nShards)
+{
+	AssociativeArray *shard;
+	HashIndex size;
+	int i;
+
+	if (nShards <= 0) {
+		fprintf(stderr, "Invalid shard count %d - must be positive\n", nShards);
+		return -1;
+	}
+	if (aarray->shards != NULL || aarray->concurrency != NULL
+			|| aarray->nEntries != 0 || aarray->draining != NULL
+			|| aarray->table->nDeleted != 0 || aarray->snapshot != NULL) {
+		fprintf(stderr, "Can only shard an unused array that is not yet shared\n");
+		return -1;
+	}
+
+	aarray->shards = (AssociativeArray **)
+			calloc(nShards, sizeof(AssociativeArray *));
+	if (aarray->shards == NULL) {
+		fprintf(stderr, "Cannot allocate %d shards\n", nShards);
+		return -1;
+	}
+	aarray->nShards = nShards;
+
+	/** the chained engine counted its buckets, not entries */
+	size = aarray->table->size * (aarray->chained ? CHAIN_NODE_ENTRIES : 1);
+	for (i = 0; i < nShards; i++) {
+		shard = aaCreateAssociativeArray(size / nShards + 1,
+				aarray->probeName, aarray->hashNamePrimary,
+				aarray->hashNameSecondary);
+		if (shard == NULL) {
+			shardsDestroy(aarray);
+			return -1;
+		}
+		aarray->shards[i] = shard;
+
+		shard->maxLoadFactor = aarray->maxLoadFactor;
+		shard->maxTombstoneFactor = aarray->maxTombstoneFactor;
+		if (aarray->powerOfTwoSizes) {
+			aaSetSizePolicy(shard, "pow2");
+		}
+		shard->hashSeed = aarray->hashSeed;
+		shard->hashSeedPinned = aarray->hashSeedPinned;
+		shard->latencyPeriod = aarray->latencyPeriod;
+	}
+	return 0;
+}
+
+/** delete the shards of an array, leaving it unsharded */
+void shardsDestroy(AssociativeArray *aarray)
+{
+	int i;
+
+	if (aarray->shards == NULL) {
+		return;
+	}
+
+	for (i = 0; i < aarray->nShards; i++) {
+		aaDeleteAssociativeArray(aarray->shards[i]);
+	}
+	free(aarray->shards);
+	aarray->shards = NULL;
+	aarray->nShards = 0;
+}
+
+void shardsPrintContents(FILE *fp, AssociativeArray *aarray, char *tag)
+{
+	int i;
+
+	for (i = 0; i < aarray->nShards; i++) {
+		fprintf(fp, "%sShard %d of %d:\n", tag, i, aarray->nShards);
+		aaPrintContents(fp, aarray->shards[i], tag);
+	}
+}
+
+/**
+ * Print the summary of a sharded array: the totals over every shard,
+ * followed by a line for each shard, so that an uneven spread or a
+ * shard that grew more than the others stands out
+ */
+void shardsPrintSummary(FILE *fp, AssociativeArray *aarray)
+{
+	AssociativeArray *shard;
+	AAMemoryUsage usage;
+	AAStats stats;
+	int i;
+
+	aaGetStats(aarray, &stats);
+	fprintf(fp, "Associative array contains %zu entries in %d shards of %zu total size\n",
+			stats.nEntries, aarray->nShards, stats.tableSize);
+	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
+			aarray->hashNamePrimary, aarray->hashNameSecondary, aarray->probeName);
+	fprintf(fp, "Hash seed is %s (%016llx%016llx)\n",
+			aarray->hashSeedPinned ? "pinned" : "random",
+			(unsigned long long) aarray->hashSeed.k0,
+			(unsigned long long) aarray->hashSeed.k1);
+	fprintf(fp, "Each shard grows past a load of %.2f; %zu tombstones in use\n",
+			aarray->maxLoadFactor, stats.nTombstones);
+	fprintf(fp, "Tombstones are cleared past %.2f of a shard; cleared %llu times\n",
+			aarray->maxTombstoneFactor,
+			(unsigned long long) stats.compactions);
+	statsPrintSummary(fp, &stats);
+	aaMemoryUsage(aarray, &usage);
+	memoryPrintSummary(fp, &usage);
+
+	for (i = 0; i < aarray->nShards; i++) {
+		shard = aarray->shards[i];
+		lockTable(shard);
+		fprintf(fp, "  Shard %3d : %zu entries in a table of %zu size%s\n",
+				i, shard->nEntries, shard->table->size,
+				shard->draining != NULL ? ", growing" : "");
+		unlockTable(shard);
+	}
+}
+
+/**
+ * Which shard a key is stored in, so that a loader can give each of
+ * its threads shards of their own: as no two threads then touch the
+ * same shard, they need no locks between them.
+ *
+ *  @return      the shard number, from 0 up to the number of shards;
+ *				 0 for an array that is not sharded
+ */
+int aaShardOf(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	if (aarray->shards == NULL) {
+		return 0;
+	}
+	return shardIndex(aarray,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->hashSeed));
+}
+
+/** the shard an integer key stored with aaInsertU32() is kept in */
+int aaShardOfU32(AssociativeArray *aarray, uint32_t key)
+{
+	if (aarray->shards == NULL) {
+		return 0;
+	}
+	return shardIndex(aarray, mixInteger(key ^ aarray->hashSeed.k0));
+}
@@ -0,0 +1,589 @@
+/**
+ * Snapshots: an array saved to a file in a form that is searched
+ * where it lies once the file is mapped back in.
+ *
+ * Loading a snapshot reads nothing up front.  The file is mapped and
+ * its header checked, and lookups then probe the mapped table itself,
+ * so pages are read in only as they are touched, and are shared with
+ * every other process that maps the same file.  Nothing in the file is
+ * a pointer: keys and values are found by their offset from its start,
+ * so it may be mapped at any address.
+ *
+ * Whatever strategy the saved array used, the table in the file is a
+ * simple one of its own: a power of two number of slots, at most half
+ * full, probed linearly from mixInteger() of the stored hash, with a
+ * control byte per slot as in the tables in memory.  The hash names
+ * and seed are saved as well, so a key is hashed just as the saved
+ * array hashed it, integer keys included.  A key inserted more than
+ * once is saved once for each time, as the array holds it.
+ *
+ * An array loaded from a snapshot cannot be changed: inserts and
+ * deletes fail, and the values it returns point into the read only
+ * mapping.  The layout is that of the machine that wrote it, which a
+ * machine of the other byte order refuses.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for close() */
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+
+#include "hashtools.h"
+
+#define	SNAPSHOT_MAGIC		"AASNAPSH"
+#define	SNAPSHOT_VERSION	1
+#define	SNAPSHOT_BYTE_ORDER	0x01020304
+#define	SNAPSHOT_NAME_BYTES	32
+
+/** the smallest table in a file, and the most of it that is used */
+#define	SNAPSHOT_MIN_SLOTS	16
+#define	SNAPSHOT_MAX_LOAD	2	// slots per entry, at the least
+
+/** the control bytes and slots start on a cache line, values on a word */
+#define	SNAPSHOT_TABLE_ALIGN	64
+#define	SNAPSHOT_VALUE_ALIGN	8
+
+typedef struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	uint32_t hashSeedPinned;
+	char probeName[SNAPSHOT_NAME_BYTES];
+	char hashNamePrimary[SNAPSHOT_NAME_BYTES];
+	char hashNameSecondary[SNAPSHOT_NAME_BYTES];
+	uint64_t hashSeedK0;
+	uint64_t hashSeedK1;
+	uint64_t nEntries;
+	uint64_t tableSize;
+	uint64_t ctrlOffset;
+	uint64_t slotOffset;
+	uint64_t blobOffset;
+	uint64_t fileSize;
+} SnapshotHeader;
+
+/**
+ * A used slot of the table in the file.  The key is followed by a NUL
+ * in the file, as keys in memory are; a NULL value has offset 0.
+ */
+typedef struct SnapshotSlot {
+	uint64_t hash;
+	uint64_t keyOffset;
+	uint64_t valueOffset;
+	uint32_t keylen;
+	uint32_t valuelen;
+} SnapshotSlot;
+
+struct Snapshot {
+	const unsigned char *data;
+	size_t size;
+	const SnapshotHeader *header;
+	const unsigned char *ctrl;
+	const SnapshotSlot *slots;
+	HashIndex mask;
+};
+
+/** what the passes over the array while it is saved share */
+typedef struct SnapshotWriter {
+	FILE *fp;
+	size_t (*valueSize)(void *value);
+	unsigned char *ctrl;
+	SnapshotSlot *slots;
+	HashIndex mask;
+	uint64_t nEntries;
+	uint64_t blobOffset;
+	uint64_t blobSize;
+} SnapshotWriter;
+
+static uint64_t
+alignUp(uint64_t offset, uint64_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+/** the number of bytes of a value to save */
+static size_t
+savedValueSize(SnapshotWriter *writer, void *value)
+{
+	if (value == NULL) {
+		return 0;
+	}
+	if (writer->valueSize == NULL) {
+		return strlen((char *) value) + 1;
+	}
+	return writer->valueSize(value);
+}
+
+/**
+ * Lay out the next entry in the blob: the key and its NUL, then the
+ * value on a word boundary.  Both passes lay out entries this way, so
+ * the offsets the second pass writes are those the first one counted.
+ */
+static void
+layOutEntry(SnapshotWriter *writer, size_t keylen, size_t valuelen,
+		uint64_t *keyOffset, uint64_t *valueOffset)
+{
+	*keyOffset = writer->blobOffset + writer->blobSize;
+	writer->blobSize += keylen + 1;
+
+	*valueOffset = 0;
+	if (valuelen > 0) {
+		writer->blobSize = alignUp(writer->blobOffset + writer->blobSize,
+				SNAPSHOT_VALUE_ALIGN) - writer->blobOffset;
+		*valueOffset = writer->blobOffset + writer->blobSize;
+		writer->blobSize += valuelen;
+	}
+}
+
+/** the first pass: count the entries, and the room their bytes take */
+static int
+countEntry(AAKeyType key, size_t keylen, HashIndex hash, void *value,
+		void *userdata)
+{
+	SnapshotWriter *writer = (SnapshotWriter *) userdata;
+	uint64_t keyOffset, valueOffset;
+	size_t valuelen = savedValueSize(writer, value);
+
+	if (keylen > UINT32_MAX || valuelen > UINT32_MAX) {
+		fprintf(stderr, "Cannot save a key or value of 4GB or more\n");
+		return -1;
+	}
+	layOutEntry(writer, keylen, valuelen, &keyOffset, &valueOffset);
+	writer->nEntries++;
+	return 0;
+}
+
+/** write n zero bytes, to pad the file out to an offset */
+static void
+writePadding(FILE *fp, uint64_t n)
+{
+	while (n-- > 0) {
+		fputc(0, fp);
+	}
+}
+
+/**
+ * The second pass: place the entry in the table, and write its key
+ * and value to the blob, which is written in order as entries come
+ */
+static int
+writeEntry(AAKeyType key, size_t keylen, HashIndex hash, void *value,
+		void *userdata)
+{
+	SnapshotWriter *writer = (SnapshotWriter *) userdata;
+	SnapshotSlot *slot;
+	HashIndex index;
+	uint64_t keyOffset, valueOffset, position;
+	size_t valuelen = savedValueSize(writer, value);
+
+	/** the table was sized for the entries counted, and no more */
+	if (writer->nEntries * SNAPSHOT_MAX_LOAD >= writer->mask + 1) {
+		fprintf(stderr, "Array changed while it was being saved\n");
+		return -1;
+	}
+
+	index = mixInteger(hash) & writer->mask;
+	while (writer->ctrl[index] != HASH_EMPTY) {
+		index = (index + 1) & writer->mask;
+	}
+
+	position = writer->blobOffset + writer->blobSize;
+	layOutEntry(writer, keylen, valuelen, &keyOffset, &valueOffset);
+
+	writer->ctrl[index] = hashFragment(hash);
+	slot = &writer->slots[index];
+	slot->hash = hash;
+	slot->keyOffset = keyOffset;
+	slot->valueOffset = valueOffset;
+	slot->keylen = (uint32_t) keylen;
+	slot->valuelen = (uint32_t) valuelen;
+
+	fwrite(key, 1, keylen, writer->fp);
+	fputc(0, writer->fp);
+	if (valueOffset != 0) {
+		writePadding(writer->fp, valueOffset - (position + keylen + 1));
+		fwrite(value, 1, valuelen, writer->fp);
+	}
+	writer->nEntries++;
+	return 0;
+}
+
+/**
+ * Save every entry of the array to a file, along with how its keys are
+ * hashed, in the form aaLoadSnapshot() maps back in.  The file is
+ * written under a temporary name and renamed into place, so a process
+ * that has the old file mapped keeps it whole.  The array must not be
+ * changed while it is saved.
+ *
+ *  @param  valueSize  gives the number of bytes of a value to save, or
+ *				is NULL if the values are C strings
+ *  @return      the number of entries saved, or -1 on failure
+ */
+int
+aaSaveSnapshot(AssociativeArray *aarray, const char *filename,
+		size_t (*valueSize)(void *value))
+{
+	SnapshotHeader header;
+	SnapshotWriter writer;
+	HashIndex tableSize = SNAPSHOT_MIN_SLOTS;
+	char *tempname;
+	int failed;
+
+	if (strlen(aarray->probeName) >= SNAPSHOT_NAME_BYTES
+			|| strlen(aarray->hashNamePrimary) >= SNAPSHOT_NAME_BYTES
+			|| strlen(aarray->hashNameSecondary) >= SNAPSHOT_NAME_BYTES) {
+		fprintf(stderr, "Cannot save strategy names of %d bytes or more\n",
+				SNAPSHOT_NAME_BYTES);
+		return -1;
+	}
+
+	memset(&writer, 0, sizeof(writer));
+	writer.valueSize = valueSize;
+	if (visitEntries(aarray, countEntry, &writer) < 0) {
+		return -1;
+	}
+	while (tableSize < writer.nEntries * SNAPSHOT_MAX_LOAD + 1) {
+		tableSize *= 2;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.headerSize = sizeof(SnapshotHeader);
+	header.hashSeedPinned = aarray->hashSeedPinned;
+	strcpy(header.probeName, aarray->probeName);
+	strcpy(header.hashNamePrimary, aarray->hashNamePrimary);
+	strcpy(header.hashNameSecondary, aarray->hashNameSecondary);
+	header.hashSeedK0 = aarray->hashSeed.k0;
+	header.hashSeedK1 = aarray->hashSeed.k1;
+	header.nEntries = writer.nEntries;
+	header.tableSize = tableSize;
+	header.ctrlOffset = alignUp(sizeof(header), SNAPSHOT_TABLE_ALIGN);
+	header.slotOffset = alignUp(header.ctrlOffset + tableSize,
+			SNAPSHOT_TABLE_ALIGN);
+	header.blobOffset = header.slotOffset + tableSize * sizeof(SnapshotSlot);
+
+	tempname = (char *) malloc(strlen(filename) + 5);
+	writer.ctrl = (unsigned char *) malloc(tableSize);
+	writer.slots = (SnapshotSlot *) calloc(tableSize, sizeof(SnapshotSlot));
+	if (tempname == NULL || writer.ctrl == NULL || writer.slots == NULL) {
+		fprintf(stderr, "Cannot allocate a snapshot table of size %zu\n",
+				tableSize);
+		free(tempname);
+		free(writer.ctrl);
+		free(writer.slots);
+		return -1;
+	}
+	memset(writer.ctrl, HASH_EMPTY, tableSize);
+	writer.mask = tableSize - 1;
+	writer.blobOffset = header.blobOffset;
+	writer.blobSize = 0;
+	writer.nEntries = 0;
+
+	sprintf(tempname, "%s.tmp", filename);
+	writer.fp = fopen(tempname, "wb");
+	if (writer.fp == NULL) {
+		fprintf(stderr, "Cannot create snapshot file '%s' : %s\n",
+				tempname, strerror(errno));
+		free(tempname);
+		free(writer.ctrl);
+		free(writer.slots);
+		return -1;
+	}
+
+	/** the blob goes last, but is written first, while the table fills */
+	failed = (fseek(writer.fp, (long) header.blobOffset, SEEK_SET) != 0
+			|| visitEntries(aarray, writeEntry, &writer) < 0
+			|| writer.nEntries != header.nEntries);
+	header.fileSize = header.blobOffset + writer.blobSize;
+
+	if ( ! failed) {
+		rewind(writer.fp);
+		fwrite(&header, sizeof(header), 1, writer.fp);
+		writePadding(writer.fp, header.ctrlOffset - sizeof(header));
+		fwrite(writer.ctrl, 1, tableSize, writer.fp);
+		writePadding(writer.fp, header.slotOffset - header.ctrlOffset - tableSize);
+		fwrite(writer.slots, sizeof(SnapshotSlot), tableSize, writer.fp);
+	}
+	failed = ferror(writer.fp) || fclose(writer.fp) != 0 || failed;
+
+	if (failed || rename(tempname, filename) < 0) {
+		fprintf(stderr, "Failed writing snapshot file '%s' : %s\n",
+				filename, strerror(errno));
+		remove(tempname);
+		failed = 1;
+	}
+	free(tempname);
+	free(writer.ctrl);
+	free(writer.slots);
+	return failed ? -1 : (int) header.nEntries;
+}
+
+/** are the names, offsets and sizes in the header those of this file? */
+static int
+checkHeader(const SnapshotHeader *header, size_t size)
+{
+	if (size < sizeof(SnapshotHeader)
+			|| memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "Not a snapshot file\n");
+		return -1;
+	}
+	if (header->version != SNAPSHOT_VERSION
+			|| header->byteOrder != SNAPSHOT_BYTE_ORDER
+			|| header->headerSize != sizeof(SnapshotHeader)) {
+		fprintf(stderr, "Snapshot was written by another version or machine\n");
+		return -1;
+	}
+	if (header->fileSize != size
+			|| memchr(header->probeName, 0, SNAPSHOT_NAME_BYTES) == NULL
+			|| memchr(header->hashNamePrimary, 0, SNAPSHOT_NAME_BYTES) == NULL
+			|| memchr(header->hashNameSecondary, 0, SNAPSHOT_NAME_BYTES) == NULL
+			|| header->tableSize == 0 || header->tableSize > size
+			|| (header->tableSize & (header->tableSize - 1)) != 0
+			|| header->nEntries >= header->tableSize
+			|| header->ctrlOffset < sizeof(SnapshotHeader)
+			|| header->slotOffset < header->ctrlOffset + header->tableSize
+			|| header->slotOffset % SNAPSHOT_VALUE_ALIGN != 0
+			|| header->blobOffset < header->slotOffset
+					+ header->tableSize * sizeof(SnapshotSlot)
+			|| header->blobOffset > size) {
+		fprintf(stderr, "Snapshot file is damaged\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Map a snapshot written by aaSaveSnapshot() into a new array, which
+ * may only be searched.  The array hashes keys as the saved one did,
+ * and is deleted with aaDeleteAssociativeArray() as usual, which
+ * unmaps the file.
+ *
+ *  @return      the array, or NULL (with a message) on failure
+ */
+AssociativeArray *
+aaLoadSnapshot(const char *filename)
+{
+	AssociativeArray *aarray;
+	struct Snapshot *snapshot;
+	const SnapshotHeader *header;
+	struct stat status;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open snapshot file '%s' : %s\n",
+				filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &status) < 0 || status.st_size < (off_t) sizeof(SnapshotHeader)) {
+		fprintf(stderr, "Snapshot file '%s' is too short\n", filename);
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Cannot map snapshot file '%s' : %s\n",
+				filename, strerror(errno));
+		return NULL;
+	}
+
+	header = (const SnapshotHeader *) data;
+	if (checkHeader(header, status.st_size) < 0) {
+		munmap(data, status.st_size);
+		return NULL;
+	}
+
+	snapshot = (struct Snapshot *) malloc(sizeof(struct Snapshot));
+	aarray = aaCreateAssociativeArray(1, (char *) header->probeName,
+			(char *) header->hashNamePrimary,
+			(char *) header->hashNameSecondary);
+	if (snapshot == NULL || aarray == NULL) {
+		free(snapshot);
+		aaDeleteAssociativeArray(aarray);
+		munmap(data, status.st_size);
+		return NULL;
+	}
+
+	snapshot->data = (const unsigned char *) data;
+	snapshot->size = status.st_size;
+	snapshot->header = header;
+	snapshot->ctrl = snapshot->data + header->ctrlOffset;
+	snapshot->slots = (const SnapshotSlot *) (snapshot->data + header->slotOffset);
+	snapshot->mask = header->tableSize - 1;
+
+	aarray->snapshot = snapshot;
+	aarray->nEntries = header->nEntries;
+	aarray->hashSeed.k0 = header->hashSeedK0;
+	aarray->hashSeed.k1 = header->hashSeedK1;
+	aarray->hashSeedPinned = header->hashSeedPinned;
+	return aarray;
+}
+
+/**
+ * The n bytes of the file at offset, or NULL if they run past its end;
+ * the offsets in a slot are checked as they are used, rather than every
+ * slot being read when the file is loaded
+ */
+static const unsigned char *
+snapshotBytes(const struct Snapshot *snapshot, uint64_t offset, uint64_t n)
+{
+	if (offset > snapshot->size || n > snapshot->size - offset) {
+		return NULL;
+	}
+	return snapshot->data + offset;
+}
+
+static void *
+slotValue(const struct Snapshot *snapshot, const SnapshotSlot *slot)
+{
+	if (slot->valueOffset == 0) {
+		return NULL;
+	}
+	return (void *) snapshotBytes(snapshot, slot->valueOffset, slot->valuelen);
+}
+
+/** search the mapped table for a key, hashed as the saved array did */
+void *
+snapshotLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashIndex hash, int *cost)
+{
+	const struct Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	const unsigned char *stored;
+	unsigned char fragment = hashFragment(hash);
+	HashIndex index = mixInteger(hash) & snapshot->mask;
+	HashIndex nProbes;
+	void *value = NULL;
+
+	/** a damaged file may have no empty slot to stop at */
+	for (nProbes = 1; nProbes <= snapshot->mask + 1; nProbes++) {
+		if (snapshot->ctrl[index] == HASH_EMPTY) {
+			break;
+		}
+		if (snapshot->ctrl[index] == fragment) {
+			slot = &snapshot->slots[index];
+			if (slot->hash == hash && slot->keylen == keylen) {
+				STATS_ADD(aarray, statsBlock(aarray)->keyCompares, 1);
+				stored = snapshotBytes(snapshot, slot->keyOffset, keylen);
+				if (stored != NULL && memcmp(stored, key, keylen) == 0) {
+					value = slotValue(snapshot, slot);
+					break;
+				}
+			} else {
+				STATS_ADD(aarray, statsBlock(aarray)->hashMismatches, 1);
+			}
+		}
+		index = (index + 1) & snapshot->mask;
+	}
+
+	*cost += (int) nProbes;
+	return value;
+}
+
+/** the number of slots in the mapped table */
+HashIndex
+snapshotTableSize(const AssociativeArray *aarray)
+{
+	return aarray->snapshot->mask + 1;
+}
+
+/** the bytes of the mapped file */
+size_t
+snapshotMappedBytes(const AssociativeArray *aarray)
+{
+	return aarray->snapshot->size;
+}
+
+/** visit each entry in the mapped table, with its stored hash */
+int
+snapshotVisit(AssociativeArray *aarray, EntryVisitor visitor, void *userdata)
+{
+	const struct Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	const unsigned char *key;
+	HashIndex i;
+
+	for (i = 0; i <= snapshot->mask; i++) {
+		if ( ! HASH_IS_USED(snapshot->ctrl[i])) {
+			continue;
+		}
+		slot = &snapshot->slots[i];
+		key = snapshotBytes(snapshot, slot->keyOffset, slot->keylen);
+		if (key == NULL) {
+			continue;
+		}
+		if ((*visitor)((AAKeyType) key, slot->keylen, slot->hash,
+				slotValue(snapshot, slot), userdata) < 0) {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+void
+snapshotPrintContents(FILE *fp, AssociativeArray *aarray, char *tag)
+{
+	const struct Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	const unsigned char *key;
+	char keybuffer[128];
+	HashIndex i;
+
+	fprintf(fp, "%sDumping snapshot of %zu entries:\n", tag, snapshot->mask + 1);
+	for (i = 0; i <= snapshot->mask; i++) {
+		fprintf(fp, "%s  ", tag);
+		if ( ! HASH_IS_USED(snapshot->ctrl[i])) {
+			fprintf(fp, "%zu : empty (NULL)\n", i);
+			continue;
+		}
+		slot = &snapshot->slots[i];
+		key = snapshotBytes(snapshot, slot->keyOffset, slot->keylen);
+		if (key == NULL) {
+			fprintf(fp, "%zu : damaged\n", i);
+			continue;
+		}
+		printableKey(keybuffer, 128, (AAKeyType) key, slot->keylen);
+		fprintf(fp, "%zu : in use : '%s'\n", i, keybuffer);
+	}
+}
+
+void
+snapshotPrintSummary(FILE *fp, AssociativeArray *aarray)
+{
+	const struct Snapshot *snapshot = aarray->snapshot;
+	AAMemoryUsage usage;
+	AAStats stats;
+
+	fprintf(fp, "Associative array contains %zu entries in a snapshot table of %zu size\n",
+			aarray->nEntries, snapshot->mask + 1);
+	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
+			aarray->hashNamePrimary, aarray->hashNameSecondary, aarray->probeName);
+	fprintf(fp, "Hash seed is %s (%016llx%016llx)\n",
+			aarray->hashSeedPinned ? "pinned" : "random",
+			(unsigned long long) aarray->hashSeed.k0,
+			(unsigned long long) aarray->hashSeed.k1);
+	fprintf(fp, "Mapped read only from a snapshot of %zu bytes, probed linearly\n",
+			snapshot->size);
+	aaGetStats(aarray, &stats);
+	statsPrintSummary(fp, &stats);
+	aaMemoryUsage(aarray, &usage);
+	memoryPrintSummary(fp, &usage);
+}
+
+/** unmap the snapshot behind an array, if it has one */
+void
+snapshotRelease(AssociativeArray *aarray)
+{
+	if (aarray->snapshot == NULL) {
+		return;
+	}
+	munmap((void *) aarray->snapshot->data, aarray->snapshot->size);
+	free(aarray->snapshot);
+	aarray->snapshot = NULL;
+}
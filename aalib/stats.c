@@ -0,0 +1,436 @@
+/**
+ * Operation statistics.
+ *
+ * Each array counts the inserts, lookups and deletes made on it, with
+ * whether each found (or stored) its key, and how many probes it took,
+ * both in total and as a histogram, so that a few very long probe
+ * sequences are not hidden by a good average.  The counts are 64 bits
+ * wide and are kept with SHARED_ADD(), so they cost a plain addition
+ * unless the array is shared between threads.  Each thread sharing it
+ * then counts in a block of its own, which the atomic additions find
+ * in its own cache, and aaGetStats() sums the blocks.  Lookups that
+ * take no locks write nothing to the array, so they are not counted.
+ *
+ * Timing every operation would cost more than many of the operations
+ * themselves, so after aaSetLatencySampling() only one operation in
+ * each period of a thread is timed, with the clock_gettime() of the
+ * vDSO; the count of operations since the last one timed is kept per
+ * thread, so that threads do not contend for it.
+ *
+ * Building with -DAA_STATS=0 leaves out every update to the counts.
+ *
+ * The memory an array holds is not counted as it goes, but worked out
+ * from its tables, key store and node pool when aaMemoryUsage() asks.
+ */
+
+#include <stdlib.h>
+
+#include "hashtools.h"
+
+/** operations made by this thread since it last timed one */
+static __thread unsigned int latencyCount;
+
+/** the block of counts this thread adds to in concurrent mode */
+__thread int statsSlot = -1;
+static int nextStatsSlot;
+
+/**
+ * Give the calling thread its block of counts, the one after that of
+ * the thread before it; the same one is used in every array
+ *
+ *  @return      the index of the block
+ */
+int
+claimStatsSlot(void)
+{
+	statsSlot = __atomic_fetch_add(&nextStatsSlot, 1, __ATOMIC_RELAXED)
+			% STATS_BLOCKS;
+	return statsSlot;
+}
+
+/**
+ * Time one operation in every period, on each thread; 0 stops timing.
+ * A sharded array passes the period on to each of its shards.
+ *
+ *  @return      0 on success, or a negative number if the library was
+ *				 built without statistics
+ */
+int
+aaSetLatencySampling(AssociativeArray *aarray, unsigned int period)
+{
+	int i;
+
+	if ( ! AA_STATS) {
+		fprintf(stderr, "Cannot time operations - statistics are not built"
+				" into this library\n");
+		return -1;
+	}
+	aarray->latencyPeriod = period;
+	for (i = 0; i < aarray->nShards; i++) {
+		aarray->shards[i]->latencyPeriod = period;
+	}
+	return 0;
+}
+
+/** is the operation this thread is starting one to time? */
+int
+latencySampleDue(unsigned int period)
+{
+	if (++latencyCount < period) {
+		return 0;
+	}
+	latencyCount = 0;
+	return 1;
+}
+
+/** count the time taken by an operation started at start */
+void
+recordLatency(AssociativeArray *aarray, int operation,
+		const struct timespec *start)
+{
+	AAOperationStats *stats = &statsBlock(aarray)->operations[operation];
+	struct timespec now;
+	uint64_t elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000
+			+ now.tv_nsec - start->tv_nsec;
+
+	SHARED_ADD(aarray, stats->latencySamples, 1);
+	SHARED_ADD(aarray, stats->latencyNanoseconds, elapsed);
+	SHARED_ADD(aarray, stats->latencyHistogram[statsBucket(elapsed)], 1);
+	SHARED_MAX(aarray, stats->maxLatencyNanoseconds, elapsed);
+}
+
+/** read a count that other threads may be adding to */
+static uint64_t
+loadCount(const uint64_t *count)
+{
+	return __atomic_load_n(count, __ATOMIC_RELAXED);
+}
+
+static void
+addOperationStats(AAOperationStats *total, const AAOperationStats *part)
+{
+	uint64_t maximum;
+	int i;
+
+	total->hits += loadCount(&part->hits);
+	total->misses += loadCount(&part->misses);
+	total->probes += loadCount(&part->probes);
+	maximum = loadCount(&part->maxProbes);
+	if (maximum > total->maxProbes) {
+		total->maxProbes = maximum;
+	}
+	total->latencySamples += loadCount(&part->latencySamples);
+	total->latencyNanoseconds += loadCount(&part->latencyNanoseconds);
+	maximum = loadCount(&part->maxLatencyNanoseconds);
+	if (maximum > total->maxLatencyNanoseconds) {
+		total->maxLatencyNanoseconds = maximum;
+	}
+	for (i = 0; i < AA_STATS_BUCKETS; i++) {
+		total->probeHistogram[i] += loadCount(&part->probeHistogram[i]);
+		total->latencyHistogram[i] += loadCount(&part->latencyHistogram[i]);
+	}
+}
+
+/** add up one block of counts */
+static void
+addStatsBlock(AAStats *stats, const StatsBlock *block)
+{
+	addOperationStats(&stats->inserts, &block->operations[STATS_INSERTS]);
+	addOperationStats(&stats->lookups, &block->operations[STATS_LOOKUPS]);
+	addOperationStats(&stats->deletes, &block->operations[STATS_DELETES]);
+	stats->keyCompares += loadCount(&block->keyCompares);
+	stats->hashMismatches += loadCount(&block->hashMismatches);
+}
+
+/**
+ * Add the counts of an unsharded array to stats, along with those its
+ * threads have kept in concurrent mode.
+ *
+ *  @return      the number of entries the array holds at a load of one
+ */
+static size_t
+gatherStats(AssociativeArray *aarray, AAStats *stats)
+{
+	size_t size;
+	int i;
+
+	lockTableShared(aarray);
+	addStatsBlock(stats, &aarray->counts);
+	if (aarray->concurrency != NULL) {
+		for (i = 0; i < STATS_BLOCKS; i++) {
+			addStatsBlock(stats, &aarray->concurrency->threadStats[i].counts);
+		}
+	}
+	stats->rehashesAvoided += aarray->rehashesAvoided;
+	stats->compactions += aarray->compactions;
+
+	stats->nEntries += __atomic_load_n(&aarray->nEntries, __ATOMIC_RELAXED);
+	if (aarray->snapshot != NULL) {
+		size = snapshotTableSize(aarray);
+	} else {
+		size = aarray->table->size;
+		/** writers sharing the table may be adding tombstones */
+		stats->nTombstones += __atomic_load_n(&aarray->table->nDeleted,
+				__ATOMIC_RELAXED);
+		if (aarray->draining != NULL) {
+			stats->nTombstones += aarray->draining->nDeleted;
+		}
+	}
+	stats->tableSize += size;
+	unlockTable(aarray);
+
+	/** the chained engine counts its buckets, not entries */
+	return size * (aarray->chained ? CHAIN_NODE_ENTRIES : 1);
+}
+
+/**
+ * Fill in stats for the array, summing the counts of every shard.  The
+ * load factor is that of the current tables, as the growth limit sees
+ * it, and the tombstones include any in a table still being drained.
+ *
+ *  @return      0 on success
+ */
+int
+aaGetStats(AssociativeArray *aarray, AAStats *stats)
+{
+	size_t capacity = 0;
+	int i;
+
+	memset(stats, 0, sizeof(AAStats));
+	stats->enabled = AA_STATS;
+
+	if (aarray->shards != NULL) {
+		for (i = 0; i < aarray->nShards; i++) {
+			capacity += gatherStats(aarray->shards[i], stats);
+		}
+	} else {
+		capacity = gatherStats(aarray, stats);
+	}
+
+	if (capacity > 0) {
+		stats->loadFactor = (double) stats->nEntries / capacity;
+	}
+	return 0;
+}
+
+/** the bytes of one generation of the table, whichever engine made it */
+static size_t
+slotTableBytes(const SlotTable *table)
+{
+	if (table->buckets != NULL) {
+		return chainTableBytes(table);
+	}
+	if (table->packed != NULL) {
+		return compactTableBytes(table);
+	}
+	return table->size + GROUP_CLONES
+			+ (table->size + STASH_SLOTS) * sizeof(KeyDataPair);
+}
+
+/** add the memory of an array, and of any shards it has, to usage */
+static void
+gatherMemory(AssociativeArray *aarray, AAMemoryUsage *usage)
+{
+	size_t inUse, reserved;
+	int i;
+
+	lockTable(aarray);
+	usage->nEntries += aarray->nEntries;
+	usage->overheadBytes += sizeof(AssociativeArray) + 2 * sizeof(SlotTable)
+			+ strlen(aarray->hashNamePrimary) + strlen(aarray->hashNameSecondary)
+			+ strlen(aarray->probeName) + 3
+			+ aarray->nShards * sizeof(AssociativeArray *);
+	if (aarray->concurrency != NULL) {
+		usage->overheadBytes += sizeof(ConcurrencyControl)
+				+ aarray->concurrency->nStripes * sizeof(StripeLock)
+				+ STATS_BLOCKS * sizeof(ThreadStats);
+	}
+
+	usage->slotBytes += slotTableBytes(aarray->table);
+	if (aarray->draining != NULL) {
+		usage->slotBytes += slotTableBytes(aarray->draining);
+	}
+
+	usage->keyBytes += aarray->keys.bytesLive;
+	usage->slackBytes += aarray->keys.bytesReserved - aarray->keys.bytesLive;
+	if (aarray->drainingKeys != NULL) {
+		usage->keyBytes += aarray->drainingKeys->bytesLive;
+		usage->slackBytes += aarray->drainingKeys->bytesReserved
+				- aarray->drainingKeys->bytesLive;
+	}
+	usage->keyBytes += aarray->heap.bytesLive;
+	if (aarray->heap.bytesReserved > 0) {
+		usage->slackBytes += aarray->heap.bytesReserved - aarray->heap.bytesLive;
+	}
+
+	chainPoolBytes(&aarray->nodes, &inUse, &reserved);
+	usage->slotBytes += inUse;
+	usage->slackBytes += reserved - inUse;
+
+	if (aarray->snapshot != NULL) {
+		usage->mappedBytes += snapshotMappedBytes(aarray);
+	}
+	unlockTable(aarray);
+
+	for (i = 0; i < aarray->nShards; i++) {
+		gatherMemory(aarray->shards[i], usage);
+	}
+}
+
+/**
+ * Fill in the memory held by the array, over every shard.  Tables and
+ * key arenas replaced while lookups took no locks, and not yet freed,
+ * are not counted.
+ *
+ *  @return      0 on success
+ */
+int
+aaMemoryUsage(AssociativeArray *aarray, AAMemoryUsage *usage)
+{
+	memset(usage, 0, sizeof(AAMemoryUsage));
+	gatherMemory(aarray, usage);
+
+	usage->totalBytes = usage->slotBytes + usage->keyBytes
+			+ usage->slackBytes + usage->overheadBytes + usage->mappedBytes;
+	if (usage->nEntries > 0) {
+		usage->bytesPerEntry = (double) usage->totalBytes / usage->nEntries;
+	}
+	return 0;
+}
+
+/** print the memory found by aaMemoryUsage(), after the statistics */
+void
+memoryPrintSummary(FILE *fp, const AAMemoryUsage *usage)
+{
+	fprintf(fp, "Memory held : %zu bytes, %.1f per entry\n",
+			usage->totalBytes, usage->bytesPerEntry);
+	fprintf(fp, "  Slots     : %zu\n", usage->slotBytes);
+	fprintf(fp, "  Keys      : %zu\n", usage->keyBytes);
+	fprintf(fp, "  Slack     : %zu\n", usage->slackBytes);
+	fprintf(fp, "  Overhead  : %zu\n", usage->overheadBytes);
+	if (usage->mappedBytes > 0) {
+		fprintf(fp, "  Mapped    : %zu\n", usage->mappedBytes);
+	}
+}
+
+static double
+meanOf(uint64_t total, uint64_t count)
+{
+	return count == 0 ? 0.0 : (double) total / count;
+}
+
+/** print one histogram bucket's range of values, as in "4-7" */
+static void
+printBucketRange(FILE *fp, int bucket)
+{
+	char range[48];
+
+	if (bucket <= 1) {
+		snprintf(range, sizeof(range), "%d", bucket);
+	} else if (bucket == AA_STATS_BUCKETS - 1) {
+		snprintf(range, sizeof(range), "%llu+", 1ULL << (bucket - 1));
+	} else {
+		snprintf(range, sizeof(range), "%llu-%llu", 1ULL << (bucket - 1),
+				(1ULL << bucket) - 1);
+	}
+	fprintf(fp, "  %-21s :", range);
+}
+
+/**
+ * Print the histograms of the three operations side by side, from the
+ * first bucket to the last that any of them uses
+ */
+static void
+printHistograms(FILE *fp, const uint64_t *inserts, const uint64_t *lookups,
+		const uint64_t *deletes)
+{
+	int bucket, first = -1, last = -1;
+
+	for (bucket = 0; bucket < AA_STATS_BUCKETS; bucket++) {
+		if (inserts[bucket] + lookups[bucket] + deletes[bucket] != 0) {
+			if (first < 0) {
+				first = bucket;
+			}
+			last = bucket;
+		}
+	}
+
+	fprintf(fp, "  %-21s : %12s %12s %12s\n", "",
+			"Insertion", "Search", "Deletion");
+	for (bucket = first; bucket >= 0 && bucket <= last; bucket++) {
+		printBucketRange(fp, bucket);
+		fprintf(fp, " %12llu %12llu %12llu\n",
+				(unsigned long long) inserts[bucket],
+				(unsigned long long) lookups[bucket],
+				(unsigned long long) deletes[bucket]);
+	}
+}
+
+static void
+printOperation(FILE *fp, const char *name, const AAOperationStats *op,
+		const char *hits, const char *misses)
+{
+	fprintf(fp, "  %-9s : %llu %s, %llu %s; %.2f probes on average,"
+			" %llu at most\n", name,
+			(unsigned long long) op->hits, hits,
+			(unsigned long long) op->misses, misses,
+			meanOf(op->probes, op->hits + op->misses),
+			(unsigned long long) op->maxProbes);
+}
+
+static void
+printLatency(FILE *fp, const char *name, const AAOperationStats *op)
+{
+	fprintf(fp, "  %-9s : %llu timed, %.1f ns on average, %llu ns at most\n",
+			name, (unsigned long long) op->latencySamples,
+			meanOf(op->latencyNanoseconds, op->latencySamples),
+			(unsigned long long) op->maxLatencyNanoseconds);
+}
+
+/**
+ * Print the statistics gathered by aaGetStats(), as the end of the
+ * summary of an array of any kind
+ */
+void
+statsPrintSummary(FILE *fp, const AAStats *stats)
+{
+	if ( ! stats->enabled) {
+		fprintf(fp, "Operation statistics are not kept (built with AA_STATS=0)\n");
+		return;
+	}
+
+	fprintf(fp, "Costs accrued due to probing:\n");
+	fprintf(fp, "  Insertion : %llu\n", (unsigned long long) stats->inserts.probes);
+	fprintf(fp, "  Search    : %llu\n", (unsigned long long) stats->lookups.probes);
+	fprintf(fp, "  Deletion  : %llu\n", (unsigned long long) stats->deletes.probes);
+	fprintf(fp, "Key comparisons made with memcmp : %llu\n",
+			(unsigned long long) stats->keyCompares);
+	fprintf(fp, "Key comparisons skipped by stored hash : %llu\n",
+			(unsigned long long) stats->hashMismatches);
+	fprintf(fp, "Entries moved on growth without rehashing : %llu\n",
+			(unsigned long long) stats->rehashesAvoided);
+	fprintf(fp, "Load factor is %.3f\n", stats->loadFactor);
+
+	fprintf(fp, "Operations made:\n");
+	printOperation(fp, "Insertion", &stats->inserts, "stored", "refused");
+	printOperation(fp, "Search", &stats->lookups, "found", "not found");
+	printOperation(fp, "Deletion", &stats->deletes, "found", "not found");
+	fprintf(fp, "Probe sequence lengths:\n");
+	printHistograms(fp, stats->inserts.probeHistogram,
+			stats->lookups.probeHistogram, stats->deletes.probeHistogram);
+
+	if (stats->inserts.latencySamples + stats->lookups.latencySamples
+			+ stats->deletes.latencySamples == 0) {
+		return;
+	}
+	fprintf(fp, "Sampled latencies:\n");
+	printLatency(fp, "Insertion", &stats->inserts);
+	printLatency(fp, "Search", &stats->lookups);
+	printLatency(fp, "Deletion", &stats->deletes);
+	fprintf(fp, "Sampled latencies in nanoseconds:\n");
+	printHistograms(fp, stats->inserts.latencyHistogram,
+			stats->lookups.latencyHistogram, stats->deletes.latencyHistogram);
+}
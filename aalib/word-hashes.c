@@ -0,0 +1,282 @@
+/**
+ * Hash functions that consume the key a machine word at a time,
+ * rather than a byte at a time as those in hash-functions.c do:
+ *
+ *	"wyhash"	: after Wang Yi's wyhash, 16 bytes per step, each
+ *				  pair of words folded with a 64x64->128 bit multiply
+ *	"murmur"	: Austin Appleby's MurmurHash64A, 8 bytes per step
+ *	"sip"		: SipHash-1-3, a keyed pseudorandom function, 8 bytes
+ *				  per step
+ *
+ * All of them mix every bit of the key into every bit of the result, so
+ * any bits may be used to choose the slot, and the table reduces the
+ * full 64-bit result into its own size only once, at the end.
+ *
+ * All of them are seeded with the array's HashSeed.  Only SipHash is
+ * designed so that the seed cannot be recovered from the way keys
+ * collide, and so it is the one to use for keys an attacker controls.
+ *
+ * Words are read with memcpy(), which compiles to a single (possibly
+ * unaligned) load; the hash values assume a little-endian machine.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>	// for getentropy()
+
+#include "hashtools.h"
+
+/** read 8, 4 or up to 3 bytes of the key as an integer */
+static inline uint64_t
+readWord64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+readWord32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+readBytes3(const unsigned char *p, size_t len)
+{
+	return ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+}
+
+
+/** the wyhash constants */
+static const uint64_t sWyPrime[4] = {
+	UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db),
+	UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3)
+};
+
+/** the full 128-bit product of a and b, returned as its two halves */
+static inline void
+multiply128(uint64_t *a, uint64_t *b)
+{
+#ifdef	__SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128) *a * *b;
+
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), lo, carry;
+
+	carry = t < rl;
+	lo = t + (rm1 << 32);
+	carry += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+/** fold the 128-bit product of a and b into 64 bits */
+static inline uint64_t
+wyMix(uint64_t a, uint64_t b)
+{
+	multiply128(&a, &b);
+	return a ^ b;
+}
+
+/**
+ * The wyhash of a key under the given seed
+ */
+static uint64_t
+wyhashSeeded(AAKeyType key, size_t keylen, uint64_t seed)
+{
+	const unsigned char *p = key;
+	uint64_t a, b;
+	size_t i;
+
+	seed ^= wyMix(seed ^ sWyPrime[0], sWyPrime[1]);
+
+	if (keylen <= 16) {
+		if (keylen >= 4) {
+			/** two overlapping pairs of 4-byte reads cover 4..16 bytes */
+			a = (readWord32(p) << 32) | readWord32(p + ((keylen >> 3) << 2));
+			b = (readWord32(p + keylen - 4) << 32)
+					| readWord32(p + keylen - 4 - ((keylen >> 3) << 2));
+		} else if (keylen > 0) {
+			a = readBytes3(p, keylen);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		for (i = keylen; i > 16; i -= 16, p += 16) {
+			seed = wyMix(readWord64(p) ^ sWyPrime[1], readWord64(p + 8) ^ seed);
+		}
+		/** the last 16 bytes, which may overlap those already mixed in */
+		a = readWord64(p + i - 16);
+		b = readWord64(p + i - 8);
+	}
+
+	a ^= sWyPrime[1];
+	b ^= seed;
+	multiply128(&a, &b);
+	return wyMix(a ^ sWyPrime[0] ^ keylen, b ^ sWyPrime[1]);
+}
+
+/**
+ * Calculate a hash value with wyhash
+ *
+ *  @see    HashAlgorithm
+ */
+HashIndex wyhash(AAKeyType key, size_t keylen, const HashSeed *seed)
+{
+	return (HashIndex) wyhashSeeded(key, keylen, seed->k0);
+}
+
+
+/**
+ * The MurmurHash64A of a key under the given seed
+ */
+static uint64_t
+murmurSeeded(AAKeyType key, size_t keylen, uint64_t seed)
+{
+	const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+	const int r = 47;
+	const unsigned char *p = key;
+	const unsigned char *end = p + (keylen & ~(size_t) 7);
+	uint64_t h = seed ^ (keylen * m);
+	uint64_t k;
+
+	for ( ; p != end; p += 8) {
+		k = readWord64(p);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	/** the last 0..7 bytes */
+	switch (keylen & 7) {
+	case 7: h ^= (uint64_t) p[6] << 48;	/* FALLTHROUGH */
+	case 6: h ^= (uint64_t) p[5] << 40;	/* FALLTHROUGH */
+	case 5: h ^= (uint64_t) p[4] << 32;	/* FALLTHROUGH */
+	case 4: h ^= (uint64_t) p[3] << 24;	/* FALLTHROUGH */
+	case 3: h ^= (uint64_t) p[2] << 16;	/* FALLTHROUGH */
+	case 2: h ^= (uint64_t) p[1] << 8;	/* FALLTHROUGH */
+	case 1: h ^= (uint64_t) p[0];
+			h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+/**
+ * Calculate a hash value with MurmurHash64A
+ *
+ *  @see    HashAlgorithm
+ */
+HashIndex murmurHash(AAKeyType key, size_t keylen, const HashSeed *seed)
+{
+	return (HashIndex) murmurSeeded(key, keylen, seed->k0);
+}
+
+
+/** one round of the SipHash permutation */
+#define	ROTL64(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define	SIPROUND(v0, v1, v2, v3)	\
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+/**
+ * SipHash with the given number of compression and finalization rounds
+ */
+static inline uint64_t
+sipHash(AAKeyType key, size_t keylen, uint64_t k0, uint64_t k1,
+		int cRounds, int dRounds)
+{
+	uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+	uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+	const unsigned char *p = key;
+	const unsigned char *end = p + (keylen & ~(size_t) 7);
+	uint64_t m;
+	int i;
+
+	for ( ; p != end; p += 8) {
+		m = readWord64(p);
+		v3 ^= m;
+		for (i = 0; i < cRounds; i++) {
+			SIPROUND(v0, v1, v2, v3);
+		}
+		v0 ^= m;
+	}
+
+	/** the last 0..7 bytes, with the length in the top byte */
+	m = (uint64_t) keylen << 56;
+	switch (keylen & 7) {
+	case 7: m |= (uint64_t) p[6] << 48;	/* FALLTHROUGH */
+	case 6: m |= (uint64_t) p[5] << 40;	/* FALLTHROUGH */
+	case 5: m |= (uint64_t) p[4] << 32;	/* FALLTHROUGH */
+	case 4: m |= (uint64_t) p[3] << 24;	/* FALLTHROUGH */
+	case 3: m |= (uint64_t) p[2] << 16;	/* FALLTHROUGH */
+	case 2: m |= (uint64_t) p[1] << 8;	/* FALLTHROUGH */
+	case 1: m |= (uint64_t) p[0];
+	}
+	v3 ^= m;
+	for (i = 0; i < cRounds; i++) {
+		SIPROUND(v0, v1, v2, v3);
+	}
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	for (i = 0; i < dRounds; i++) {
+		SIPROUND(v0, v1, v2, v3);
+	}
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * Calculate a hash value with SipHash-1-3, keyed by the array's seed:
+ * one compression round per word and three to finish, the variant
+ * used for hash tables by Rust and CPython
+ *
+ *  @see    HashAlgorithm
+ */
+HashIndex sipHash13(AAKeyType key, size_t keylen, const HashSeed *seed)
+{
+	return (HashIndex) sipHash(key, keylen, seed->k0, seed->k1, 1, 3);
+}
+
+/**
+ * Fill a seed with random bits from the operating system.  Should
+ * that fail, fall back on the time and the address of the seed,
+ * which vary between runs but are far easier to guess.
+ */
+void randomHashSeed(HashSeed *seed)
+{
+	struct timespec now;
+
+	if (getentropy(seed, sizeof(*seed)) == 0) {
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	seed->k0 = mixInteger((uint64_t) now.tv_sec * 1000000000u + now.tv_nsec);
+	seed->k1 = mixInteger(seed->k0 ^ (uint64_t) (uintptr_t) seed);
+}
@@ -2,6 +2,7 @@
 #define	__ASSOCIATIVE_ARRAY_TOOLS_HEADER__
 
 #include <stdio.h>
+#include <stdint.h>
 
 typedef unsigned char *AAKeyType;
 typedef size_t AAIndexType;
@@ -25,6 +26,63 @@ AssociativeArray *aaCreateAssociativeArray(
 		);
 void aaDeleteAssociativeArray(AssociativeArray *array);
 
+/**
+ * The table grows on its own once the load factor is passed; a
+ * bulk loader can instead reserve room for its entries up front
+ */
+int aaSetMaxLoadFactor(AssociativeArray *array, double loadFactor);
+int aaReserve(AssociativeArray *array, size_t nEntries);
+
+/**
+ * deletes leave tombstones, which are cleared out once they fill too
+ * much of the table; aaCompact() clears them (and the space of the
+ * deleted keys) straight away
+ */
+int aaSetMaxTombstoneFactor(AssociativeArray *array, double fraction);
+int aaCompact(AssociativeArray *array);
+
+/** choose "prime" (the default) or "pow2" table sizes */
+int aaSetSizePolicy(AssociativeArray *array, char *policy);
+
+/**
+ * keyed hashes use a seed chosen at random for each array; pin it
+ * (before anything is inserted) to make a run reproducible
+ */
+int aaSetHashSeed(AssociativeArray *array, uint64_t seed);
+
+/**
+ * let several threads use the array at once; the "chain", "linear"
+ * and "simd" strategies let writers in different stripes of the table
+ * run in parallel, but every other one still runs its writers one at
+ * a time
+ */
+int aaSetConcurrency(AssociativeArray *array, int nStripes);
+
+/**
+ * split an unused array into independent shards, picked by the high
+ * bits of each key's hash once mixed; each grows and locks on its own,
+ * and the other calls here work across all of them
+ */
+int aaSetShards(AssociativeArray *array, int nShards);
+int aaShardOf(AssociativeArray *array, AAKeyType key, size_t keylength);
+int aaShardOfU32(AssociativeArray *array, uint32_t key);
+
+/**
+ * for tables that are loaded once and then mostly read: lookups take
+ * no locks at all ("linear" and "simd" strategies only)
+ */
+int aaSetLockFreeReads(AssociativeArray *array);
+
+/**
+ * write the whole array to a file that aaLoadSnapshot() maps straight
+ * back in, ready for lookups; valueSize gives the number of bytes to
+ * save for each value, or is NULL for values that are C strings
+ */
+int aaSaveSnapshot(AssociativeArray *array, const char *filename,
+		size_t (*valueSize)(void *value));
+AssociativeArray *aaLoadSnapshot(const char *filename);
+
+/** keys are passed with their length; they are also NUL terminated */
 int aaIterateAction(
 		AssociativeArray *array,
 		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
@@ -37,6 +95,107 @@ int aaInsert(AssociativeArray *array,
 void *aaLookup(AssociativeArray *array, AAKeyType key, size_t keylength);
 void *aaDelete(AssociativeArray *array, AAKeyType key, size_t keylength);
 
+/**
+ * the same operations on n keys at once, which overlaps the cache
+ * misses of several keys; the values found or deleted are stored in
+ * values[], and each call returns the number of keys it succeeded on
+ */
+size_t aaInsertBatch(AssociativeArray *array,
+		AAKeyType keys[], size_t keylengths[],
+		void *values[], size_t n);
+size_t aaLookupBatch(AssociativeArray *array,
+		AAKeyType keys[], size_t keylengths[],
+		size_t n, void *values[]);
+size_t aaDeleteBatch(AssociativeArray *array,
+		AAKeyType keys[], size_t keylengths[],
+		size_t n, void *values[]);
+
+/**
+ * the same operations for integer keys, which are kept in the slot
+ * and hashed with an integer mixer; a key stored with these must
+ * also be looked up and deleted with them
+ */
+int aaInsertU64(AssociativeArray *array, uint64_t key, void *value);
+void *aaLookupU64(AssociativeArray *array, uint64_t key);
+void *aaDeleteU64(AssociativeArray *array, uint64_t key);
+int aaInsertU32(AssociativeArray *array, uint32_t key, void *value);
+void *aaLookupU32(AssociativeArray *array, uint32_t key);
+void *aaDeleteU32(AssociativeArray *array, uint32_t key);
+
+/**
+ * Counts kept of each kind of operation.  A probe is one slot looked
+ * at (or one group, bucket or chain node, for the strategies that work
+ * in those), the key's home slot counting as the first, so an insert,
+ * lookup or delete settled at home takes one probe.  Probe lengths and
+ * sampled latencies are kept as histograms of power of two buckets:
+ * bucket 0 counts zeroes, and bucket b counts values from 2^(b-1) to
+ * 2^b - 1, with the last bucket taking everything larger.
+ */
+#define	AA_STATS_BUCKETS	32
+
+typedef struct AAOperationStats {
+	/** keys found (or, for inserts, stored) and keys not */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t probes;
+	uint64_t maxProbes;
+	uint64_t probeHistogram[AA_STATS_BUCKETS];
+	uint64_t latencySamples;
+	uint64_t latencyNanoseconds;
+	uint64_t maxLatencyNanoseconds;
+	uint64_t latencyHistogram[AA_STATS_BUCKETS];
+} AAOperationStats;
+
+typedef struct AAStats {
+	/** zero if the library was built without statistics */
+	int enabled;
+	AAOperationStats inserts;
+	AAOperationStats lookups;
+	AAOperationStats deletes;
+	uint64_t keyCompares;
+	uint64_t hashMismatches;
+	uint64_t rehashesAvoided;
+	uint64_t compactions;
+	size_t nEntries;
+	size_t tableSize;
+	size_t nTombstones;
+	double loadFactor;
+} AAStats;
+
+/**
+ * gather the statistics of the array (over all of its shards); every
+ * period-th operation of each thread is also timed, if a period is set
+ */
+int aaGetStats(AssociativeArray *array, AAStats *stats);
+int aaSetLatencySampling(AssociativeArray *array, unsigned int period);
+
+/**
+ * The memory an array holds, in bytes.  The values belong to the
+ * caller and are not counted, nor is the malloc() header of each block.
+ */
+typedef struct AAMemoryUsage {
+	size_t nEntries;
+	/** the slot arrays, empty slots and control bytes included, and chain nodes in use */
+	size_t slotBytes;
+	/** the keys kept outside the slots, in the key arena or heap */
+	size_t keyBytes;
+	/** held but storing nothing: unused ends of arena chunks and heap, deleted keys, free nodes */
+	size_t slackBytes;
+	/** the array's own records: its header, names and locks */
+	size_t overheadBytes;
+	/** the file mapped by an array loaded from a snapshot */
+	size_t mappedBytes;
+	size_t totalBytes;
+	double bytesPerEntry;
+} AAMemoryUsage;
+
+/**
+ * account for the memory of the array (over all of its shards); the
+ * "compact" strategy keeps entries in the fewest bytes, about half
+ * those of "linear" for short keys, but its lookups are slower
+ */
+int aaMemoryUsage(AssociativeArray *array, AAMemoryUsage *usage);
+
 /** print out the data, prefixing each line with the lineLeader */
 void aaPrintContents(FILE *fp, AssociativeArray *array, char *lineLeader);
 void aaPrintSummary(FILE *fp, AssociativeArray *array);
@@ -0,0 +1,1299 @@
+/**
+ * Verification and benchmarking of every combination of hash and
+ * probing strategy the library offers.
+ *
+ * In verify mode (the default) each combination, with both prime and
+ * power of two table sizes, is put through a long random sequence of
+ * inserts, lookups and deletes, and every answer is checked against a
+ * reference map kept alongside.  The keys are drawn from a fixed pool,
+ * so the reference map is simply an array indexed by the key's place
+ * in the pool.  Some keys are long enough to go to the key arena and a
+ * quarter are integer keys, and the tables start small, so that they
+ * grow, drain and compact while the checks go on.
+ *
+ * In benchmark mode (-b) each combination is measured instead, under
+ * each distribution of keys and at each of a range of load factors:
+ * the time, probes and heap bytes taken per operation are written out
+ * as CSV, or as JSON (-j), a row per operation, so that runs can be
+ * compared to find regressions.
+ *
+ * In threaded mode (-T) each combination is instead worked on by
+ * several threads at once, and the operations per second of lookups,
+ * updates, both together and churn are written out for each thread
+ * count, with lookups taking locks and, where they can, without.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h> /* for getopt() */
+#include <time.h> /* for clock_gettime() */
+#include <math.h> /* for pow() */
+#include <malloc.h> /* for mallinfo2() */
+#include <pthread.h>
+
+#include "aarray.h"
+
+static char *hashNames[] = {
+	"sum", "length", "custom", "wyhash", "murmur", "sip", NULL
+};
+static char *probeNames[] = {
+	"linear", "quadratic", "doublehash", "robinhood", "cuckoo", "simd",
+	"chain", "compact", NULL
+};
+static char *sizePolicies[] = { "prime", "pow2", NULL };
+static char *distributionNames[] = {
+	"uniform", "zipf", "sequential", "short", "url", NULL
+};
+static double loadFactors[] = { 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0 };
+
+/** the most threads of a threaded run */
+#define	MAX_THREADS	256
+
+/** the most keys in a pool, as a key's place is kept in its values */
+#define	MAX_POOL	(1 << 24)
+#define	VALUE_SERIAL_SHIFT	24
+
+/**
+ * The keys of a run.  Every integerEvery-th key (none if it is 0) is
+ * an integer key, stored with aaInsertU64(); the rest are strings.
+ */
+typedef struct KeyPool {
+	char **keys;
+	size_t *keylens;
+	uint64_t *intkeys;
+	int nKeys;
+	int integerEvery;
+} KeyPool;
+
+/** the reference map: what the array should hold for each key */
+typedef struct Reference {
+	char *present;
+	void **values;
+	size_t nPresent;
+	uint64_t serial;
+} Reference;
+
+typedef struct VerifyResult {
+	long nOps;
+	long nRefused;
+	long nErrors;
+} VerifyResult;
+
+/** a small generator of our own, so that runs repeat from the seed */
+static uint64_t
+nextRandom(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+static int
+isIntegerKey(const KeyPool *pool, int i)
+{
+	return pool->integerEvery != 0 && i % pool->integerEvery == 0;
+}
+
+/**
+ * Make nKeys distinct keys to verify with, a quarter of them integers.
+ * String keys are mostly short enough to be kept inline, but one in
+ * five is long enough for the key arena.
+ */
+static int
+createKeyPool(KeyPool *pool, int nKeys, const char *prefix, uint64_t seed)
+{
+	char buffer[128];
+	uint64_t state = seed;
+	int i, padding;
+
+	pool->nKeys = nKeys;
+	pool->integerEvery = 4;
+	pool->keys = (char **) calloc(nKeys, sizeof(char *));
+	pool->keylens = (size_t *) calloc(nKeys, sizeof(size_t));
+	pool->intkeys = (uint64_t *) calloc(nKeys, sizeof(uint64_t));
+	if (pool->keys == NULL || pool->keylens == NULL || pool->intkeys == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < nKeys; i++) {
+		if (isIntegerKey(pool, i)) {
+			/** the prefix keeps the pools of hits and misses apart */
+			pool->intkeys[i] = ((uint64_t) prefix[0] << 56) | i;
+			continue;
+		}
+		padding = (i % 5 == 0) ? 24 + (int) (nextRandom(&state) % 40)
+				: (int) (nextRandom(&state) % 8);
+		snprintf(buffer, sizeof(buffer), "%s%d-%.*s", prefix, i, padding,
+				"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+		pool->keys[i] = strdup(buffer);
+		pool->keylens[i] = strlen(buffer);
+		if (pool->keys[i] == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+destroyKeyPool(KeyPool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nKeys; i++) {
+		free(pool->keys[i]);
+	}
+	free(pool->keys);
+	free(pool->keylens);
+	free(pool->intkeys);
+}
+
+static int
+insertKey(AssociativeArray *aarray, KeyPool *pool, int i, void *value)
+{
+	if (isIntegerKey(pool, i)) {
+		return aaInsertU64(aarray, pool->intkeys[i], value);
+	}
+	return aaInsert(aarray, (AAKeyType) pool->keys[i], pool->keylens[i], value);
+}
+
+static void *
+lookupKey(AssociativeArray *aarray, KeyPool *pool, int i)
+{
+	if (isIntegerKey(pool, i)) {
+		return aaLookupU64(aarray, pool->intkeys[i]);
+	}
+	return aaLookup(aarray, (AAKeyType) pool->keys[i], pool->keylens[i]);
+}
+
+static void *
+deleteKey(AssociativeArray *aarray, KeyPool *pool, int i)
+{
+	if (isIntegerKey(pool, i)) {
+		return aaDeleteU64(aarray, pool->intkeys[i]);
+	}
+	return aaDelete(aarray, (AAKeyType) pool->keys[i], pool->keylens[i]);
+}
+
+/**
+ * The values stored are never dereferenced; each is a number, unique
+ * to its insert, that also records which key it was stored under
+ */
+static void *
+makeValue(Reference *reference, int i)
+{
+	reference->serial++;
+	return (void *) (uintptr_t) ((reference->serial << VALUE_SERIAL_SHIFT) | i);
+}
+
+static int
+valueKey(void *value)
+{
+	return (int) ((uintptr_t) value & (MAX_POOL - 1));
+}
+
+/** report a difference from the reference map */
+static void
+mismatch(VerifyResult *result, const char *what, KeyPool *pool, int i,
+		void *expected, void *found)
+{
+	if (result->nErrors++ < 5) {
+		if (isIntegerKey(pool, i)) {
+			fprintf(stderr, "    %s of integer key %llu", what,
+					(unsigned long long) pool->intkeys[i]);
+		} else {
+			fprintf(stderr, "    %s of key '%s'", what, pool->keys[i]);
+		}
+		fprintf(stderr, " gave %p, expected %p\n", found, expected);
+	}
+}
+
+/** check one entry found by iterating over the array */
+typedef struct IterateCheck {
+	Reference *reference;
+	size_t nVisited;
+	long nErrors;
+} IterateCheck;
+
+static int
+checkVisited(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	IterateCheck *check = (IterateCheck *) userdata;
+	int i = valueKey(value);
+
+	check->nVisited++;
+	if ( ! check->reference->present[i]
+			|| check->reference->values[i] != value) {
+		check->nErrors++;
+	}
+	return 0;
+}
+
+/**
+ * Check every key of the pool against the reference map, and that
+ * iterating over the array visits exactly the entries it should
+ */
+static void
+checkAll(AssociativeArray *aarray, KeyPool *pool, Reference *reference,
+		VerifyResult *result, const char *when)
+{
+	IterateCheck check;
+	void *expected, *found;
+	int i;
+
+	for (i = 0; i < pool->nKeys; i++) {
+		expected = reference->present[i] ? reference->values[i] : NULL;
+		found = lookupKey(aarray, pool, i);
+		if (found != expected) {
+			mismatch(result, when, pool, i, expected, found);
+		}
+	}
+
+	check.reference = reference;
+	check.nVisited = 0;
+	check.nErrors = 0;
+	aaIterateAction(aarray, checkVisited, &check);
+	if (check.nVisited != reference->nPresent || check.nErrors != 0) {
+		if (result->nErrors++ < 5) {
+			fprintf(stderr, "    %s: iterating visited %zu entries (%ld wrong),"
+					" expected %zu\n", when, check.nVisited, check.nErrors,
+					reference->nPresent);
+		}
+	}
+}
+
+/**
+ * Run one combination through nOps random operations, checking each
+ * against the reference map, then check every key after the array is
+ * compacted and once it has been emptied again
+ */
+static void
+verifyCombination(VerifyResult *result, char *hash, char *secondary,
+		char *probe, char *sizePolicy, KeyPool *pool, long nOps,
+		uint64_t seed)
+{
+	AssociativeArray *aarray;
+	Reference reference;
+	uint64_t state = seed;
+	void *value, *expected;
+	long op;
+	int i, choice;
+
+	memset(result, 0, sizeof(VerifyResult));
+	aarray = aaCreateAssociativeArray(16, probe, hash, secondary);
+	reference.present = (char *) calloc(pool->nKeys, sizeof(char));
+	reference.values = (void **) calloc(pool->nKeys, sizeof(void *));
+	if (aarray == NULL || reference.present == NULL || reference.values == NULL) {
+		fprintf(stderr, "Error: cannot allocate the arrays to verify\n");
+		exit(1);
+	}
+	reference.nPresent = 0;
+	reference.serial = 0;
+	aaSetSizePolicy(aarray, sizePolicy);
+	aaSetHashSeed(aarray, seed);
+
+	for (op = 0; op < nOps; op++) {
+		i = (int) (nextRandom(&state) % pool->nKeys);
+		choice = (int) (nextRandom(&state) % 100);
+
+		if (choice < 45 && ! reference.present[i]) {
+			/** insert a key that is not already there */
+			value = makeValue(&reference, i);
+			if (insertKey(aarray, pool, i, value) < 0) {
+				result->nRefused++;
+				continue;
+			}
+			reference.present[i] = 1;
+			reference.values[i] = value;
+			reference.nPresent++;
+
+		} else if (choice < 75) {
+			expected = reference.present[i] ? reference.values[i] : NULL;
+			value = deleteKey(aarray, pool, i);
+			if (value != expected) {
+				mismatch(result, "delete", pool, i, expected, value);
+			}
+			if (reference.present[i]) {
+				reference.present[i] = 0;
+				reference.nPresent--;
+			}
+
+		} else {
+			expected = reference.present[i] ? reference.values[i] : NULL;
+			value = lookupKey(aarray, pool, i);
+			if (value != expected) {
+				mismatch(result, "lookup", pool, i, expected, value);
+			}
+		}
+		result->nOps++;
+	}
+
+	checkAll(aarray, pool, &reference, result, "lookup after the run");
+	aaCompact(aarray);
+	checkAll(aarray, pool, &reference, result, "lookup after compaction");
+
+	for (i = 0; i < pool->nKeys; i++) {
+		if (reference.present[i]) {
+			value = deleteKey(aarray, pool, i);
+			if (value != reference.values[i]) {
+				mismatch(result, "final delete", pool, i,
+						reference.values[i], value);
+			}
+			reference.present[i] = 0;
+			reference.nPresent--;
+		}
+	}
+	checkAll(aarray, pool, &reference, result, "lookup once emptied");
+
+	aaDeleteAssociativeArray(aarray);
+	free(reference.present);
+	free(reference.values);
+}
+
+/**
+ * The secondary hash gives the step of double hashing and the second
+ * bucket of cuckoo hashing, so it must differ from the primary one
+ */
+static char *
+secondaryHashFor(char *hash)
+{
+	return strcmp(hash, "wyhash") == 0 ? "murmur" : "wyhash";
+}
+
+static int
+isSelected(char *name, char *selected)
+{
+	return selected == NULL || strncmp(name, selected, 3) == 0;
+}
+
+static int
+verifyAll(char *selectedHash, char *selectedProbe, int nKeys, long nOps,
+		uint64_t seed)
+{
+	VerifyResult result;
+	KeyPool pool;
+	long nFailed = 0, nRun = 0;
+	int h, p, s;
+
+	if (createKeyPool(&pool, nKeys, "k", seed) < 0) {
+		fprintf(stderr, "Error: cannot allocate %d keys\n", nKeys);
+		return -1;
+	}
+
+	for (h = 0; hashNames[h] != NULL; h++) {
+		if ( ! isSelected(hashNames[h], selectedHash)) continue;
+		for (p = 0; probeNames[p] != NULL; p++) {
+			if ( ! isSelected(probeNames[p], selectedProbe)) continue;
+			for (s = 0; sizePolicies[s] != NULL; s++) {
+				verifyCombination(&result, hashNames[h],
+						secondaryHashFor(hashNames[h]), probeNames[p],
+						sizePolicies[s], &pool, nOps, seed);
+				printf("%-8s %-11s %-6s : %ld operations, %ld inserts refused, %ld errors%s\n",
+						hashNames[h], probeNames[p], sizePolicies[s],
+						result.nOps, result.nRefused, result.nErrors,
+						result.nErrors ? "  FAILED" : "");
+				nRun++;
+				if (result.nErrors != 0) {
+					nFailed++;
+				}
+			}
+		}
+	}
+
+	printf("%ld of %ld combinations failed\n", nFailed, nRun);
+	destroyKeyPool(&pool);
+	return nFailed == 0 ? 0 : -1;
+}
+
+static double
+elapsedNanoseconds(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * The bytes the allocator has handed out, in small blocks and mapped
+ * ones, so that the growth of the heap over building an array is what
+ * the array takes
+ */
+static size_t
+heapInUse(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Make the keys of one of the benchmark's distributions:
+ *	"uniform"	: integer keys drawn at random from all 64-bit values
+ *	"zipf"		: strings such as "item-1234", of which a few are
+ *				looked up far more often than the rest
+ *	"sequential": the integer keys 0, 1, 2 ...
+ *	"short"		: strings of 4 to 12 letters
+ *	"url"		: strings of 50 to 120 bytes, in the shape of URLs
+ * The keys of a missing pool are made so that none is in the other.
+ */
+static int
+createDistribution(KeyPool *pool, const char *distribution, int nKeys,
+		int missing, uint64_t seed)
+{
+	static const char *sections[] = {
+		"news", "sport", "business", "technology", "science", "culture"
+	};
+	char buffer[160];
+	uint64_t state = seed ^ (missing ? UINT64_C(0x5DEECE66D) : 0);
+	int i, j, length, width, value;
+
+	pool->nKeys = nKeys;
+	pool->integerEvery = (strncmp(distribution, "uni", 3) == 0
+			|| strncmp(distribution, "seq", 3) == 0) ? 1 : 0;
+	pool->keys = (char **) calloc(nKeys, sizeof(char *));
+	pool->keylens = (size_t *) calloc(nKeys, sizeof(size_t));
+	pool->intkeys = (uint64_t *) calloc(nKeys, sizeof(uint64_t));
+	if (pool->keys == NULL || pool->keylens == NULL || pool->intkeys == NULL) {
+		return -1;
+	}
+
+	/** short keys start with the key's number in letters, to keep them apart */
+	for (width = 1, value = 26; value < nKeys; width++, value *= 26)
+		;
+
+	for (i = 0; i < nKeys; i++) {
+		if (strncmp(distribution, "uni", 3) == 0) {
+			pool->intkeys[i] = nextRandom(&state);
+			continue;
+		} else if (strncmp(distribution, "seq", 3) == 0) {
+			pool->intkeys[i] = missing ? (uint64_t) nKeys + i : (uint64_t) i;
+			continue;
+		} else if (strncmp(distribution, "zip", 3) == 0) {
+			snprintf(buffer, sizeof(buffer), "%s-%d", missing ? "miss" : "item", i);
+		} else if (strncmp(distribution, "sho", 3) == 0) {
+			length = 4 + (int) (nextRandom(&state) % 9);
+			if (length < width) {
+				length = width;
+			}
+			for (j = 0, value = i; j < width; j++, value /= 26) {
+				buffer[j] = (missing ? 'A' : 'a') + value % 26;
+			}
+			for ( ; j < length; j++) {
+				buffer[j] = 'a' + (int) (nextRandom(&state) % 26);
+			}
+			buffer[length] = '\0';
+		} else {
+			length = snprintf(buffer, sizeof(buffer),
+					"%s://www.site%d.example.com/%s/%d/article-%d",
+					missing ? "http" : "https",
+					(int) (nextRandom(&state) % 1000),
+					sections[nextRandom(&state) % 6],
+					2000 + (int) (nextRandom(&state) % 25), i);
+			/** pad out to the lengths of real tracking parameters */
+			snprintf(buffer + length, sizeof(buffer) - length, "?ref=%.*s",
+					(int) (nextRandom(&state) % 60),
+					"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567");
+		}
+		pool->keys[i] = strdup(buffer);
+		pool->keylens[i] = strlen(buffer);
+		if (pool->keys[i] == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** the probability weight of the keys in a Zipfian distribution */
+#define	ZIPF_EXPONENT	0.99
+
+/**
+ * The order in which the keys are looked up and churned: under the
+ * Zipfian distribution the key of rank r comes up in proportion to
+ * 1 / r^ZIPF_EXPONENT, and under the others every key is as likely.
+ */
+static int *
+createAccessOrder(const char *distribution, int nKeys, uint64_t seed)
+{
+	uint64_t state = seed ^ UINT64_C(0xA5A5A5A5A5A5A5A5);
+	double *cumulative = NULL, total = 0.0, u;
+	int *order, i, low, high, middle;
+
+	order = (int *) malloc(nKeys * sizeof(int));
+	if (order == NULL) {
+		return NULL;
+	}
+	if (strncmp(distribution, "zip", 3) != 0) {
+		for (i = 0; i < nKeys; i++) {
+			order[i] = (int) (nextRandom(&state) % nKeys);
+		}
+		return order;
+	}
+
+	cumulative = (double *) malloc(nKeys * sizeof(double));
+	if (cumulative == NULL) {
+		free(order);
+		return NULL;
+	}
+	for (i = 0; i < nKeys; i++) {
+		total += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+		cumulative[i] = total;
+	}
+	for (i = 0; i < nKeys; i++) {
+		u = (nextRandom(&state) >> 11) * (1.0 / 9007199254740992.0) * total;
+		low = 0;
+		high = nKeys - 1;
+		while (low < high) {
+			middle = (low + high) / 2;
+			if (cumulative[middle] < u) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		order[i] = low;
+	}
+	free(cumulative);
+	return order;
+}
+
+/** what the benchmark is restricted to, if anything */
+typedef struct Selection {
+	char *hash;
+	char *probe;
+	char *distribution;
+	double loadFactor;
+	int json;
+} Selection;
+
+/** one row of results: an operation timed on one configuration */
+typedef struct Measurement {
+	const char *hash;
+	const char *probe;
+	const char *distribution;
+	double targetLoad;
+	double actualLoad;
+	int nKeys;
+	const char *operation;
+	double nanoseconds;
+	long nOps;
+	long long probes;
+	double bytesPerEntry;
+	int nRefused;
+} Measurement;
+
+static long nRowsWritten = 0;
+
+static void
+writeMeasurement(const Measurement *m, int json)
+{
+	double probesPerOp = m->probes < 0 ? -1.0 : (double) m->probes / m->nOps;
+
+	if (json) {
+		printf("%s  {\"hash\": \"%s\", \"probe\": \"%s\", \"distribution\": \"%s\","
+				" \"target_load\": %.2f, \"load\": %.4f, \"keys\": %d,"
+				" \"operation\": \"%s\", \"ns_per_op\": %.2f,",
+				nRowsWritten == 0 ? "[\n" : ",\n",
+				m->hash, m->probe, m->distribution, m->targetLoad,
+				m->actualLoad, m->nKeys, m->operation, m->nanoseconds / m->nOps);
+		if (probesPerOp < 0) {
+			printf(" \"probes_per_op\": null,");
+		} else {
+			printf(" \"probes_per_op\": %.3f,", probesPerOp);
+		}
+		printf(" \"bytes_per_entry\": %.1f, \"refused\": %d}",
+				m->bytesPerEntry, m->nRefused);
+	} else {
+		if (nRowsWritten == 0) {
+			printf("hash,probe,distribution,target_load,load,keys,operation,"
+					"ns_per_op,probes_per_op,bytes_per_entry,refused\n");
+		}
+		printf("%s,%s,%s,%.2f,%.4f,%d,%s,%.2f,", m->hash, m->probe,
+				m->distribution, m->targetLoad, m->actualLoad, m->nKeys,
+				m->operation, m->nanoseconds / m->nOps);
+		if (probesPerOp >= 0) {
+			printf("%.3f", probesPerOp);
+		}
+		printf(",%.1f,%d\n", m->bytesPerEntry, m->nRefused);
+	}
+	nRowsWritten++;
+	fflush(stdout);
+}
+
+/** the probes counted since before, by the operations given */
+static long long
+probesSince(AssociativeArray *aarray, const AAStats *before,
+		int inserts, int lookups, int deletes)
+{
+	AAStats after;
+	long long probes = 0;
+
+	aaGetStats(aarray, &after);
+	if ( ! after.enabled) {
+		return -1;
+	}
+	if (inserts) probes += after.inserts.probes - before->inserts.probes;
+	if (lookups) probes += after.lookups.probes - before->lookups.probes;
+	if (deletes) probes += after.deletes.probes - before->deletes.probes;
+	return probes;
+}
+
+static int
+countEntry(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	(*(size_t *) userdata) += (uintptr_t) value;
+	return 0;
+}
+
+/**
+ * Measure one configuration.  The table is sized up front so that the
+ * keys fill it to the target load factor, which is also the point at
+ * which it would grow; as table sizes come from a ladder, the load
+ * reached is reported alongside, as are the inserts that the strategy
+ * refused.  The operations are timed in turn:
+ *	insert		: every key once
+ *	hit			: a lookup of each key in the access order
+ *	miss		: a lookup of each missing key
+ *	churn		: a delete and reinsert of each key in the access order,
+ *				timed per operation
+ *	iterate		: a visit of every entry, timed per entry
+ *	delete		: a delete of every key
+ */
+static void
+benchmarkCombination(char *hash, char *probe, char *distribution,
+		double loadFactor, KeyPool *keys, KeyPool *missing, int *order,
+		uint64_t seed, int json)
+{
+	AssociativeArray *aarray;
+	Measurement m;
+	AAStats stats;
+	struct timespec start;
+	size_t heapBefore, sum = 0;
+	int i;
+
+	heapBefore = heapInUse();
+	aarray = aaCreateAssociativeArray(16, probe, hash, secondaryHashFor(hash));
+	if (aarray == NULL) {
+		fprintf(stderr, "Error: cannot allocate the array to measure\n");
+		exit(1);
+	}
+	aaSetHashSeed(aarray, seed);
+	aaSetMaxLoadFactor(aarray, loadFactor);
+	aaReserve(aarray, keys->nKeys);
+
+	memset(&m, 0, sizeof(m));
+	m.hash = hash;
+	m.probe = probe;
+	m.distribution = distribution;
+	m.targetLoad = loadFactor;
+	m.nKeys = keys->nKeys;
+
+	aaGetStats(aarray, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < keys->nKeys; i++) {
+		if (insertKey(aarray, keys, i, (void *) (uintptr_t) 1) < 0) {
+			m.nRefused++;
+		}
+	}
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = probesSince(aarray, &stats, 1, 0, 0);
+	m.bytesPerEntry = (double) (heapInUse() - heapBefore) / keys->nKeys;
+	aaGetStats(aarray, &stats);
+	m.actualLoad = stats.loadFactor;
+	m.operation = "insert";
+	m.nOps = keys->nKeys;
+	writeMeasurement(&m, json);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < keys->nKeys; i++) {
+		lookupKey(aarray, keys, order[i]);
+	}
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = probesSince(aarray, &stats, 0, 1, 0);
+	m.operation = "hit";
+	writeMeasurement(&m, json);
+
+	aaGetStats(aarray, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < missing->nKeys; i++) {
+		lookupKey(aarray, missing, i);
+	}
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = probesSince(aarray, &stats, 0, 1, 0);
+	m.operation = "miss";
+	m.nOps = missing->nKeys;
+	writeMeasurement(&m, json);
+
+	aaGetStats(aarray, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < keys->nKeys; i++) {
+		if (deleteKey(aarray, keys, order[i]) != NULL) {
+			insertKey(aarray, keys, order[i], (void *) (uintptr_t) 1);
+		}
+	}
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = probesSince(aarray, &stats, 1, 0, 1);
+	m.operation = "churn";
+	m.nOps = 2L * keys->nKeys;
+	writeMeasurement(&m, json);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	aaIterateAction(aarray, countEntry, &sum);
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = -1;
+	m.operation = "iterate";
+	m.nOps = sum > 0 ? (long) sum : 1;
+	writeMeasurement(&m, json);
+
+	aaGetStats(aarray, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < keys->nKeys; i++) {
+		deleteKey(aarray, keys, i);
+	}
+	m.nanoseconds = elapsedNanoseconds(&start);
+	m.probes = probesSince(aarray, &stats, 0, 0, 1);
+	m.operation = "delete";
+	m.nOps = keys->nKeys;
+	writeMeasurement(&m, json);
+
+	aaDeleteAssociativeArray(aarray);
+}
+
+static int
+benchmarkAll(Selection *selection, int nKeys, uint64_t seed)
+{
+	double chosenLoad[2] = { selection->loadFactor, 0 };
+	double *loads = selection->loadFactor > 0 ? chosenLoad : loadFactors;
+	KeyPool keys, missing;
+	int *order;
+	int d, l, h, p;
+
+	for (d = 0; distributionNames[d] != NULL; d++) {
+		if ( ! isSelected(distributionNames[d], selection->distribution)) continue;
+
+		order = createAccessOrder(distributionNames[d], nKeys, seed);
+		if (order == NULL
+				|| createDistribution(&keys, distributionNames[d], nKeys, 0, seed) < 0
+				|| createDistribution(&missing, distributionNames[d], nKeys, 1, seed) < 0) {
+			fprintf(stderr, "Error: cannot allocate %d keys\n", nKeys);
+			return -1;
+		}
+
+		for (l = 0; loads[l] > 0; l++) {
+			for (h = 0; hashNames[h] != NULL; h++) {
+				if ( ! isSelected(hashNames[h], selection->hash)) continue;
+				for (p = 0; probeNames[p] != NULL; p++) {
+					if ( ! isSelected(probeNames[p], selection->probe)) continue;
+					benchmarkCombination(hashNames[h], probeNames[p],
+							distributionNames[d], loads[l],
+							&keys, &missing, order, seed, selection->json);
+				}
+			}
+		}
+
+		destroyKeyPool(&keys);
+		destroyKeyPool(&missing);
+		free(order);
+	}
+
+	if (selection->json) {
+		printf("%s]\n", nRowsWritten == 0 ? "[\n" : "\n");
+	}
+	return 0;
+}
+
+/**
+ * Threaded mode (-T): each combination is loaded in concurrent mode
+ * and then worked on by 1, 2, 4 ... threads, up to the number asked
+ * for, and the operations made per second by all of them together are
+ * written out, a row per operation and thread count:
+ *	lookup		: every thread looks up keys in the access order
+ *	update		: every thread deletes and reinserts keys of its own
+ *	mixed		: as many threads looking up keys as updating them,
+ *				all at once (from two threads up)
+ *	churn		: every thread inserts missing keys of its own, looking
+ *				each up along with a loaded key, and then deletes
+ *				them all again
+ * A key keeps its value through an update, so every answer a lookup
+ * gets can be checked; the wrong ones are counted as errors.  Inserts
+ * the strategy refuses are counted apart, as in the other modes, and
+ * their keys are then left alone.
+ *
+ * Churn grows the table and then fills it with tombstones, so old
+ * tables and key arenas are retired while other threads may still be
+ * reading them; built with -fsanitize=thread, this is a test of the
+ * locking and of their reclamation as well.  Strategies whose lookups
+ * can take no locks are run both with and without them, as lock_free
+ * 1 and 0.
+ */
+#define	THREAD_STRIPES	64
+#define	DEFAULT_THREADED_LOAD	0.75
+
+typedef struct ThreadRun {
+	const char *hash;
+	const char *probe;
+	const char *distribution;
+	int json;
+	AssociativeArray *aarray;
+	KeyPool *keys;
+	KeyPool *missing;
+	int *order;
+	char *present;
+	char *stored;
+	int lockFree;
+	long nOpsEach;
+	int updating;
+	pthread_barrier_t start;
+} ThreadRun;
+
+/** one thread of a run, and what it did */
+typedef struct Worker {
+	ThreadRun *run;
+	pthread_t thread;
+	int id;
+	int nPeers;
+	long nOps;
+	long nErrors;
+	long nRefused;
+} Worker;
+
+static void *
+checkedValue(int i)
+{
+	return (void *) (uintptr_t) (i + 1);
+}
+
+/** is key i of the loaded keys in the array, as far as its updater knows? */
+static int
+isPresent(ThreadRun *run, int i)
+{
+	return __atomic_load_n(&run->present[i], __ATOMIC_RELAXED);
+}
+
+/** look up keys in the access order, each thread from its own place */
+static void *
+lookupWorker(void *arg)
+{
+	Worker *self = (Worker *) arg;
+	ThreadRun *run = self->run;
+	int nKeys = run->keys->nKeys, i;
+	long n;
+	void *value;
+
+	pthread_barrier_wait(&run->start);
+	for (n = 0; n < run->nOpsEach; n++) {
+		i = run->order[(n + (long) self->id * nKeys / self->nPeers) % nKeys];
+		value = lookupKey(run->aarray, run->keys, i);
+		/** a key being updated may be missing for a moment */
+		if (value != (isPresent(run, i) ? checkedValue(i) : NULL)
+				&& (value != NULL || ! run->updating)) {
+			self->nErrors++;
+		}
+	}
+	self->nOps = run->nOpsEach;
+	return NULL;
+}
+
+/** delete and reinsert the keys that fall to this thread alone */
+static void *
+updateWorker(void *arg)
+{
+	Worker *self = (Worker *) arg;
+	ThreadRun *run = self->run;
+	int nOwned = run->keys->nKeys / self->nPeers, i;
+	long n;
+
+	pthread_barrier_wait(&run->start);
+	for (n = 0; n < run->nOpsEach / 2; n++) {
+		i = (int) (n % nOwned) * self->nPeers + self->id;
+		if ( ! isPresent(run, i)) {
+			continue;
+		}
+		if (deleteKey(run->aarray, run->keys, i) != checkedValue(i)) {
+			self->nErrors++;
+		}
+		if (insertKey(run->aarray, run->keys, i, checkedValue(i)) < 0) {
+			__atomic_store_n(&run->present[i], 0, __ATOMIC_RELAXED);
+			self->nRefused++;
+		}
+		self->nOps += 2;
+	}
+	return NULL;
+}
+
+/**
+ * Insert, look up and delete the missing keys that fall to this thread
+ * alone, looking up a loaded key with each, as many times over as its
+ * share of the operations allows
+ */
+static void *
+churnWorker(void *arg)
+{
+	Worker *self = (Worker *) arg;
+	ThreadRun *run = self->run;
+	int nKeys = run->keys->nKeys;
+	int nOwned = run->missing->nKeys / self->nPeers, i, k;
+	long nRounds = run->nOpsEach / (4L * nOwned), round, n;
+	void *value;
+
+	pthread_barrier_wait(&run->start);
+	for (round = 0; round < nRounds || round == 0; round++) {
+		for (n = 0; n < nOwned; n++) {
+			k = run->order[(n + round + (long) self->id * nKeys / self->nPeers) % nKeys];
+			value = lookupKey(run->aarray, run->keys, k);
+			if (value != (isPresent(run, k) ? checkedValue(k) : NULL)) {
+				self->nErrors++;
+			}
+
+			i = (int) n * self->nPeers + self->id;
+			run->stored[i] = (insertKey(run->aarray, run->missing, i,
+					checkedValue(i)) >= 0);
+			if ( ! run->stored[i]) {
+				self->nRefused++;
+			} else if (lookupKey(run->aarray, run->missing, i) != checkedValue(i)) {
+				self->nErrors++;
+			}
+		}
+		for (n = 0; n < nOwned; n++) {
+			i = (int) n * self->nPeers + self->id;
+			value = deleteKey(run->aarray, run->missing, i);
+			if (value != (run->stored[i] ? checkedValue(i) : NULL)) {
+				self->nErrors++;
+			}
+		}
+		self->nOps += 4L * nOwned;
+	}
+	return NULL;
+}
+
+static void
+writeThroughput(const ThreadRun *run, int nThreads, const char *operation,
+		double opsPerSecond, long nRefused, long nErrors)
+{
+	if (run->json) {
+		printf("%s  {\"hash\": \"%s\", \"probe\": \"%s\", \"distribution\": \"%s\","
+				" \"keys\": %d, \"lock_free\": %d, \"threads\": %d,"
+				" \"operation\": \"%s\", \"ops_per_sec\": %.0f,"
+				" \"refused\": %ld, \"errors\": %ld}",
+				nRowsWritten == 0 ? "[\n" : ",\n",
+				run->hash, run->probe, run->distribution, run->keys->nKeys,
+				run->lockFree, nThreads, operation, opsPerSecond,
+				nRefused, nErrors);
+	} else {
+		if (nRowsWritten == 0) {
+			printf("hash,probe,distribution,keys,lock_free,threads,operation,"
+					"ops_per_sec,refused,errors\n");
+		}
+		printf("%s,%s,%s,%d,%d,%d,%s,%.0f,%ld,%ld\n", run->hash, run->probe,
+				run->distribution, run->keys->nKeys, run->lockFree, nThreads,
+				operation, opsPerSecond, nRefused, nErrors);
+	}
+	nRowsWritten++;
+	fflush(stdout);
+}
+
+/**
+ * Run nReaders lookup threads and nUpdaters threads of the given kind
+ * at once on the array, timed from when they are all ready to go, and
+ * write out what they did as the given operation
+ *
+ *  @return      the number of errors the threads found
+ */
+static long
+runThreads(ThreadRun *run, int nReaders, int nUpdaters,
+		void *(*updater)(void *), const char *operation)
+{
+	Worker workers[MAX_THREADS];
+	struct timespec start;
+	double nanoseconds;
+	long nOps = 0, nRefused = 0, nErrors = 0;
+	int nThreads = nReaders + nUpdaters, t;
+
+	run->updating = (nUpdaters > 0);
+	pthread_barrier_init(&run->start, NULL, nThreads + 1);
+	for (t = 0; t < nThreads; t++) {
+		memset(&workers[t], 0, sizeof(Worker));
+		workers[t].run = run;
+		workers[t].id = t < nReaders ? t : t - nReaders;
+		workers[t].nPeers = t < nReaders ? nReaders : nUpdaters;
+		if (pthread_create(&workers[t].thread, NULL,
+				t < nReaders ? lookupWorker : updater, &workers[t]) != 0) {
+			fprintf(stderr, "Error: cannot start benchmark thread\n");
+			exit(1);
+		}
+	}
+	/** the threads are made, but none can start before the clock does */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_barrier_wait(&run->start);
+	for (t = 0; t < nThreads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		nOps += workers[t].nOps;
+		nRefused += workers[t].nRefused;
+		nErrors += workers[t].nErrors;
+	}
+	nanoseconds = elapsedNanoseconds(&start);
+	pthread_barrier_destroy(&run->start);
+
+	writeThroughput(run, nThreads, operation, nOps / (nanoseconds / 1e9),
+			nRefused, nErrors);
+	return nErrors;
+}
+
+/** the thread counts run: the powers of two below the most, then it */
+static int
+nextThreadCount(int nThreads, int maxThreads)
+{
+	if (nThreads == maxThreads) {
+		return maxThreads + 1;
+	}
+	return 2 * nThreads < maxThreads ? 2 * nThreads : maxThreads;
+}
+
+/** can lookups on this strategy run without locks? */
+static int
+offersLockFreeReads(const char *probe)
+{
+	return strncmp(probe, "lin", 3) == 0 || strncmp(probe, "sim", 3) == 0;
+}
+
+/**
+ * Measure one configuration on each thread count.  The array is loaded
+ * once, by this thread, and every run leaves it holding the same keys.
+ *
+ *  @return      the number of errors found
+ */
+static long
+threadedCombination(char *hash, char *probe, char *distribution,
+		double loadFactor, KeyPool *keys, KeyPool *missing, int *order,
+		int lockFree, int maxThreads, long nOpsEach, uint64_t seed, int json)
+{
+	ThreadRun run;
+	long nErrors = 0;
+	int nThreads, i;
+
+	run.aarray = aaCreateAssociativeArray(16, probe, hash, secondaryHashFor(hash));
+	run.present = (char *) calloc(keys->nKeys, sizeof(char));
+	run.stored = (char *) calloc(missing->nKeys, sizeof(char));
+	if (run.aarray == NULL || run.present == NULL || run.stored == NULL
+			|| aaSetConcurrency(run.aarray, THREAD_STRIPES) < 0
+			|| (lockFree && aaSetLockFreeReads(run.aarray) < 0)) {
+		fprintf(stderr, "Error: cannot allocate the array to measure\n");
+		exit(1);
+	}
+	aaSetHashSeed(run.aarray, seed);
+	aaSetMaxLoadFactor(run.aarray, loadFactor);
+	aaReserve(run.aarray, keys->nKeys);
+	for (i = 0; i < keys->nKeys; i++) {
+		run.present[i] = (insertKey(run.aarray, keys, i, checkedValue(i)) >= 0);
+	}
+
+	run.hash = hash;
+	run.probe = probe;
+	run.distribution = distribution;
+	run.json = json;
+	run.lockFree = lockFree;
+	run.keys = keys;
+	run.missing = missing;
+	run.order = order;
+	run.nOpsEach = nOpsEach;
+	for (nThreads = 1; nThreads <= maxThreads;
+			nThreads = nextThreadCount(nThreads, maxThreads)) {
+		nErrors += runThreads(&run, nThreads, 0, NULL, "lookup");
+		nErrors += runThreads(&run, 0, nThreads, updateWorker, "update");
+		if (nThreads >= 2) {
+			nErrors += runThreads(&run, nThreads / 2, nThreads - nThreads / 2,
+					updateWorker, "mixed");
+		}
+		nErrors += runThreads(&run, 0, nThreads, churnWorker, "churn");
+	}
+
+	aaDeleteAssociativeArray(run.aarray);
+	free(run.present);
+	free(run.stored);
+	return nErrors;
+}
+
+static int
+threadedAll(Selection *selection, int nKeys, int maxThreads, long nOpsEach,
+		uint64_t seed)
+{
+	double loadFactor = selection->loadFactor > 0 ? selection->loadFactor
+			: DEFAULT_THREADED_LOAD;
+	KeyPool keys, missing;
+	int *order;
+	int d, h, p, lockFree;
+	long nErrors = 0;
+
+	for (d = 0; distributionNames[d] != NULL; d++) {
+		if ( ! isSelected(distributionNames[d], selection->distribution)) continue;
+
+		order = createAccessOrder(distributionNames[d], nKeys, seed);
+		if (order == NULL
+				|| createDistribution(&keys, distributionNames[d], nKeys, 0, seed) < 0
+				|| createDistribution(&missing, distributionNames[d], nKeys, 1, seed) < 0) {
+			fprintf(stderr, "Error: cannot allocate %d keys\n", nKeys);
+			return -1;
+		}
+
+		for (h = 0; hashNames[h] != NULL; h++) {
+			if ( ! isSelected(hashNames[h], selection->hash)) continue;
+			for (p = 0; probeNames[p] != NULL; p++) {
+				if ( ! isSelected(probeNames[p], selection->probe)) continue;
+				for (lockFree = 0; lockFree <= offersLockFreeReads(probeNames[p]);
+						lockFree++) {
+					nErrors += threadedCombination(hashNames[h], probeNames[p],
+							distributionNames[d], loadFactor, &keys, &missing,
+							order, lockFree, maxThreads, nOpsEach, seed,
+							selection->json);
+				}
+			}
+		}
+
+		destroyKeyPool(&keys);
+		destroyKeyPool(&missing);
+		free(order);
+	}
+
+	if (selection->json) {
+		printf("%s]\n", nRowsWritten == 0 ? "[\n" : "\n");
+	}
+	if (nErrors > 0) {
+		fprintf(stderr, "%ld wrong answers under threads\n", nErrors);
+		return -1;
+	}
+	return 0;
+}
+
+#define	DEFAULT_VERIFY_KEYS	2000
+#define	DEFAULT_VERIFY_OPS	20000
+#define	DEFAULT_BENCH_KEYS	10000
+#define	DEFAULT_THREADED_OPS	200000
+#define	DEFAULT_SEED		1
+#define OPTIONLEN	10
+
+/** print out the help */
+void usage(char *progname)
+{
+	fprintf(stderr, "%s [<OPTIONS>]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Checks every combination of hash and probing strategy against a\n");
+	fprintf(stderr, "reference map, or measures the time each takes per operation.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options: \n");
+	fprintf(stderr, "%-*s: Print this help.\n", OPTIONLEN, "-h");
+	fprintf(stderr, "%-*s: Verify each combination (the default).\n", OPTIONLEN, "-v");
+	fprintf(stderr, "%-*s: Measure each combination instead of verifying it, under\n",
+			OPTIONLEN, "-b");
+	fprintf(stderr, "%-*s: each distribution and load factor, writing CSV.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Measure each combination on 1, 2, 4 ... up to <N> threads\n",
+			OPTIONLEN, "-T <N>");
+	fprintf(stderr, "%-*s: at once instead, writing the operations per second;\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: build with -fsanitize=thread to check the locking too.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Write the measurements as JSON rather than CSV.\n",
+			OPTIONLEN, "-j");
+	fprintf(stderr, "%-*s: Use <N> keys, default %d to verify and %d to measure.\n",
+			OPTIONLEN, "-n <N>", DEFAULT_VERIFY_KEYS, DEFAULT_BENCH_KEYS);
+	fprintf(stderr, "%-*s: Make <N> random operations on each to verify, default %d,\n",
+			OPTIONLEN, "-o <N>", DEFAULT_VERIFY_OPS);
+	fprintf(stderr, "%-*s: or <N> on each thread under -T, default %d.\n",
+			OPTIONLEN, "", DEFAULT_THREADED_OPS);
+	fprintf(stderr, "%-*s: Only use the hash <ALG>.\n", OPTIONLEN, "-H <ALG>");
+	fprintf(stderr, "%-*s: Only use the probing strategy <ALG>.\n", OPTIONLEN, "-P <ALG>");
+	fprintf(stderr, "%-*s: Only measure keys drawn from <DIST>: \"uniform\", \"zipf\",\n",
+			OPTIONLEN, "-D <DIST>");
+	fprintf(stderr, "%-*s: \"sequential\", \"short\" or \"url\".\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Only measure tables filled to <LOAD>.\n", OPTIONLEN, "-l <LOAD>");
+	fprintf(stderr, "%-*s: Seed the keys, operations and hashes, default %d.\n",
+			OPTIONLEN, "-S <SEED>", DEFAULT_SEED);
+	fprintf(stderr, "\n");
+	exit (1);
+}
+
+/**
+ * Program mainline -- verifies or measures the strategies chosen.
+ * Uses getopt(3) to parse arguments.
+ */
+int
+main(int argc, char **argv)
+{
+	char *programname = argv[0];
+	Selection selection;
+	unsigned long long seed = DEFAULT_SEED;
+	long nOps = -1;
+	int nKeys = 0, benchmark = 0, nThreads = 0;
+	int c;
+
+	memset(&selection, 0, sizeof(selection));
+	while ((c = getopt(argc, argv, "hvbjT:n:o:H:P:D:l:S:")) != -1) {
+		if (c == 'v') {
+			benchmark = 0;
+		} else if (c == 'b') {
+			benchmark = 1;
+		} else if (c == 'j') {
+			selection.json = 1;
+		} else if (c == 'T') {
+			if (sscanf(optarg, "%d", &nThreads) != 1
+					|| nThreads < 1 || nThreads > MAX_THREADS) {
+				fprintf(stderr, "Error: cannot parse thread count from '%s'\n", optarg);
+				usage(programname);
+			}
+		} else if (c == 'n') {
+			if (sscanf(optarg, "%d", &nKeys) != 1 || nKeys < 1 || nKeys >= MAX_POOL) {
+				fprintf(stderr, "Error: cannot parse key count from '%s'\n", optarg);
+				usage(programname);
+			}
+		} else if (c == 'o') {
+			if (sscanf(optarg, "%ld", &nOps) != 1 || nOps < 0) {
+				fprintf(stderr, "Error: cannot parse operation count from '%s'\n", optarg);
+				usage(programname);
+			}
+		} else if (c == 'H') {
+			selection.hash = optarg;
+		} else if (c == 'P') {
+			selection.probe = optarg;
+		} else if (c == 'D') {
+			selection.distribution = optarg;
+		} else if (c == 'l') {
+			if (sscanf(optarg, "%lf", &selection.loadFactor) != 1
+					|| selection.loadFactor <= 0 || selection.loadFactor >= 1) {
+				fprintf(stderr, "Error: cannot parse load factor from '%s'\n", optarg);
+				usage(programname);
+			}
+		} else if (c == 'S') {
+			if (sscanf(optarg, "%llu", &seed) != 1) {
+				fprintf(stderr, "Error: cannot parse seed from '%s'\n", optarg);
+				usage(programname);
+			}
+		} else {
+			usage(programname);
+		}
+	}
+
+	if (nThreads > 0) {
+		if (nKeys == 0) {
+			nKeys = DEFAULT_BENCH_KEYS;
+		}
+		if (nKeys < nThreads) {
+			fprintf(stderr, "Error: each thread needs a key of its own\n");
+			usage(programname);
+		}
+		return threadedAll(&selection, nKeys, nThreads,
+				nOps > 0 ? nOps : DEFAULT_THREADED_OPS, seed) < 0 ? 1 : 0;
+	}
+	if (benchmark) {
+		return benchmarkAll(&selection,
+				nKeys > 0 ? nKeys : DEFAULT_BENCH_KEYS, seed) < 0 ? 1 : 0;
+	}
+	return verifyAll(selection.hash, selection.probe,
+			nKeys > 0 ? nKeys : DEFAULT_VERIFY_KEYS,
+			nOps >= 0 ? nOps : DEFAULT_VERIFY_OPS, seed) < 0 ? 1 : 0;
+}
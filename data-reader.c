@@ -1,104 +1,120 @@
 #include <stdio.h>
 #include <stdlib.h> /* for malloc()/free() */
-#include <string.h> /* for strlen(), strdup() */
+#include <string.h> /* for strerror() */
 #include <ctype.h> /* for isprint() */
+#include <errno.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for close() */
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
 
 #include "data-reader.h"
 
-
-/* forward references */
-static char *stripNonPrinting(char *s);
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 /**
- * Read in an attribute/value pair from a file
+ * Map a data file into memory, read only.  The mapping is shared, so
+ * the pages are those of the page cache, and several processes reading
+ * the same file use one copy of it.
  *
- * QUESTION: where does the memory come from that is being
- * managed in this function.  Is it from the STACK or the HEAP?
- * Where does it get allocated?  Where does it get deallocated?
+ *  @return      the open file, or NULL (with a message) on failure
  */
-int
-readDataLine(
-			FILE *dataFP,
-			char *line,
-			int maxlinelen,
-			char **key,
-			char **value
-		)
+DataFile *
+openDataFile(const char *filename)
 {
-	char *delimiterPosition = NULL;
-
-	/** read the file until empty */
-	if (fgets(line, maxlinelen, dataFP) == NULL) {
-		return 0;
+	DataFile *file;
+	struct stat status;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error: Failed to open input file '%s' : %s\n",
+				filename, strerror(errno));
+		return NULL;
 	}
-
-	/** find the delimiter */
-	delimiterPosition = strchr(line, DELIMITER_CHAR);
-	if (delimiterPosition == NULL) {
-		/**
-		 * You can "continue" a string in C by simply having
-		 * two double-quoted strings right after each other,
-		 * so this call really has a single long string argument
-		 * as the (concatenated) second argument.
-		 */
-		fprintf(stderr,
-				"Error: Input line does not contain"
-				"delimiter char '%c': '%s'\n",
-				DELIMITER_CHAR, line);
-		return -1;
+	if (fstat(fd, &status) < 0) {
+		fprintf(stderr, "Error: Failed to examine input file '%s' : %s\n",
+				filename, strerror(errno));
+		close(fd);
+		return NULL;
 	}
 
-	/**
-	 * At this point, the string starting one character
-	 * _after_ the delimiter is our value, and the string
-	 * up to the delimiter is our integer key.  If we
-	 * cut the string here, sscanf will give us the key,
-	 * and we can compute the value as simply this position
-	 * plus one
-	 */
-	*delimiterPosition = '\0';
-
-	/* assign the pointer to the key */
-	(*key) = stripNonPrinting(line);
-
+	file = (DataFile *) malloc(sizeof(DataFile));
+	if (file == NULL) {
+		close(fd);
+		return NULL;
+	}
+	file->size = (size_t) status.st_size;
+	file->position = 0;
+	file->lineNumber = 0;
+	file->filename = filename;
+	file->data = NULL;
+
+	/** an empty file cannot be mapped, but has no lines to read either */
+	if (file->size > 0) {
+		file->data = (const char *) mmap(NULL, file->size, PROT_READ,
+				MAP_SHARED, fd, 0);
+		if (file->data == (const char *) MAP_FAILED) {
+			fprintf(stderr, "Error: Failed to map input file '%s' : %s\n",
+					filename, strerror(errno));
+			close(fd);
+			free(file);
+			return NULL;
+		}
+		madvise((void *) file->data, file->size, MADV_SEQUENTIAL);
+	}
 
-	/**
-	 * use the line from one character after the delimiter
-	 * as the value we want to keep -- after cleaning up
-	 * that portion of the line by removing any non-printable
-	 * or 'blank' characters from beginning and end of the string
-	 */
-	(*value) = stripNonPrinting(&delimiterPosition[1]);
+	/** the mapping keeps the file open */
+	close(fd);
+	return file;
+}
 
-	return 1;
+void
+closeDataFile(DataFile *file)
+{
+	if (file == NULL) {
+		return;
+	}
+	if (file->data != NULL) {
+		munmap((void *) file->data, file->size);
+	}
+	free(file);
 }
 
 
 /**
- * Read in an attribute/value pair from a file
- *
- * QUESTION: where does the memory come from that is being
- * managed in this function.  Is it from the STACK or the HEAP?
- * Where does it get allocated?  Where does it get deallocated?
+ * Find the first tab or newline at or after p and before end, or end
+ * if there is none.  With SSE2, 16 bytes are compared against both at
+ * once, and only the bytes of the file are ever read.
  */
-int
-readPlainLine(
-			FILE *dataFP,
-			char *line,
-			int maxlinelen,
-			char **value
-		)
+static const char *
+findDelimiter(const char *p, const char *end, int stopAtTab)
 {
-	/** read the file until empty */
-	if (fgets(line, maxlinelen, dataFP) == NULL) {
-		return 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8(stopAtTab ? DELIMITER_CHAR : '\n');
+	__m128i block;
+	int mask;
+
+	while (end - p >= 16) {
+		block = _mm_loadu_si128((const __m128i *) p);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(block, newline),
+				_mm_cmpeq_epi8(block, tab)));
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
 	}
+#endif
 
-	/* assign the pointer to the key */
-	(*value) = stripNonPrinting(line);
-
-	return 1;
+	while (p < end && *p != '\n' && ! (stopAtTab && *p == DELIMITER_CHAR)) {
+		p++;
+	}
+	return p;
 }
 
 
@@ -120,33 +136,118 @@ dataCharacter(char c)
 	if ((c == ' ') || (c == '\t'))	return 0;
 
 	/* otherwise, return  isprint() */
-	return ( isprint(c) );
+	return ( isprint((unsigned char) c) );
 
 }
 
 /**
- * Strip any non-printing characters from the beginning and end of
- * the provided string
+ * Narrow the view [*start, end) to leave out any non-printing
+ * characters at its beginning and end; the file itself is untouched.
  *
- * N.B.: this function modifies the string in place to achieve this
+ *  @return      the length of the narrowed view
  */
-static char *
-stripNonPrinting(char *s)
+static size_t
+stripNonPrinting(const char **start, const char *end)
 {
-	int i;
+	const char *s = *start;
 
-	/** first walk up the string until we come to a printable byte */
-	while ( ( *s != '\0' ) && ( ! dataCharacter(*s) )) {
+	/** first walk up the view until we come to a printable byte */
+	while (s < end && ! dataCharacter(*s)) {
 		s++;
 	}
 
-	/** walk backwards from end, wiping out all non-printing character */
+	/** then walk backwards from its end in the same way */
+	while (end > s && ! dataCharacter(end[-1])) {
+		end--;
+	}
+
+	*start = s;
+	return (size_t) (end - s);
+}
+
 
-	i = strlen(s);
-	while ((i >=0) && ( ! dataCharacter(s[i]) ) ) {
-		s[i--] = 0;
+/**
+ * Read in an attribute/value pair from a data file, as views into the
+ * mapping.  The key runs up to the first tab, and the value from there
+ * to the end of the line; blanks and non-printing characters around
+ * each are left out.
+ *
+ *  @return      1 if a line was read, 0 at the end of the file, or -1
+ *				 (with a message) for a line with no delimiter
+ */
+int
+nextDataLine(
+			DataFile *file,
+			const char **key,
+			size_t *keylen,
+			const char **value,
+			size_t *valuelen
+		)
+{
+	const char *line, *delimiterPosition, *lineEnd;
+	const char *end = file->data + file->size;
+
+	/** read the file until empty */
+	if (file->position >= file->size) {
+		return 0;
+	}
+
+	line = file->data + file->position;
+	delimiterPosition = findDelimiter(line, end, 1);
+	lineEnd = delimiterPosition;
+	if (delimiterPosition < end && *delimiterPosition == DELIMITER_CHAR) {
+		lineEnd = findDelimiter(delimiterPosition + 1, end, 0);
 	}
 
-	return s;
+	file->position = (size_t) (lineEnd - file->data) + 1;
+	file->lineNumber++;
+
+	if (delimiterPosition == end || *delimiterPosition != DELIMITER_CHAR) {
+		fprintf(stderr,
+				"Error: Input line %zu of '%s' does not contain"
+				" delimiter char '%c': '%.*s'\n",
+				file->lineNumber, file->filename, DELIMITER_CHAR,
+				(int) (lineEnd - line), line);
+		return -1;
+	}
+
+	*key = line;
+	*keylen = stripNonPrinting(key, delimiterPosition);
+
+	*value = delimiterPosition + 1;
+	*valuelen = stripNonPrinting(value, lineEnd);
+
+	return 1;
 }
 
+
+/**
+ * Read in a whole line from a file, as a view into the mapping, with
+ * blanks and non-printing characters around it left out
+ *
+ *  @return      1 if a line was read, or 0 at the end of the file
+ */
+int
+nextPlainLine(
+			DataFile *file,
+			const char **value,
+			size_t *valuelen
+		)
+{
+	const char *line, *lineEnd;
+
+	/** read the file until empty */
+	if (file->position >= file->size) {
+		return 0;
+	}
+
+	line = file->data + file->position;
+	lineEnd = findDelimiter(line, file->data + file->size, 0);
+	file->position = (size_t) (lineEnd - file->data) + 1;
+	file->lineNumber++;
+
+	*value = line;
+	*valuelen = stripNonPrinting(value, lineEnd);
+
+	return 1;
+}
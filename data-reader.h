@@ -1,12 +1,31 @@
 #ifndef	__DATA_READER_HEADER__
+#define	__DATA_READER_HEADER__
+
+#include <stddef.h>
 
 #define	DELIMITER_CHAR	'\t'
 
-int readDataLine(FILE *dataFP,
-		char *linebuffer, int maxlinelen,
-		char **key, char **value);
-int readPlainLine(FILE *dataFP,
-		char *linebuffer, int maxlinelen,
-		char **value);
-	
+/**
+ * A data file mapped into memory.  The lines are handed out as views
+ * into the mapping, so nothing is copied and no line is too long; the
+ * views are not NUL terminated, and stay valid until the file is
+ * closed.
+ */
+typedef struct DataFile {
+	const char *data;
+	size_t size;
+	size_t position;
+	size_t lineNumber;
+	const char *filename;
+} DataFile;
+
+DataFile *openDataFile(const char *filename);
+void closeDataFile(DataFile *file);
+
+int nextDataLine(DataFile *file,
+		const char **key, size_t *keylen,
+		const char **value, size_t *valuelen);
+int nextPlainLine(DataFile *file,
+		const char **value, size_t *valuelen);
+
 #endif
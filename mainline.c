@@ -4,192 +4,852 @@
 #include <unistd.h> /* for getopt() */
 #include <ctype.h>  /* for isdigit() */
 #include <errno.h>
+#include <pthread.h>
 
 #include "aarray.h"
 #include "data-reader.h"
 
-#define	LINE_MAX	128
+/**
+ * The values of the data files, copied out of their mappings so that
+ * they outlive them, each with a NUL after it.  A file's values take
+ * at most its size, so each file gets one block, kept until exit.
+ */
+typedef struct ValueBlock {
+	struct ValueBlock *next;
+	size_t used;
+	char values[];
+} ValueBlock;
+
+static ValueBlock *valueBlocks = NULL;
+
+/** make a block big enough for the values of the given file */
+static ValueBlock *
+newValueBlock(DataFile *file)
+{
+	ValueBlock *block;
+
+	block = (ValueBlock *) malloc(sizeof(ValueBlock) + file->size + 1);
+	if (block == NULL) {
+		fprintf(stderr, "Error: out of memory reading '%s'\n", file->filename);
+		return NULL;
+	}
+	block->next = NULL;
+	block->used = 0;
+	return block;
+}
+
+/** keep a block until exit, once its values are in the array */
+static void
+keepValueBlock(ValueBlock *block)
+{
+	block->next = valueBlocks;
+	valueBlocks = block;
+}
+
+static void
+freeValueBlocks(void)
+{
+	ValueBlock *block;
+
+	while ((block = valueBlocks) != NULL) {
+		valueBlocks = block->next;
+		free(block);
+	}
+}
+
+static char *
+copyValue(ValueBlock *block, const char *value, size_t valuelen)
+{
+	char *copy = &block->values[block->used];
+
+	memcpy(copy, value, valuelen);
+	copy[valuelen] = '\0';
+	block->used += valuelen + 1;
+	return copy;
+}
+
+/**
+ * Should this key be stored as an integer?  It is if it starts with a
+ * digit, or a minus sign and a digit, and its leading digits are then
+ * read as sscanf("%d") would read them from a whole line, giving the
+ * bits of a signed int.  Returns -1, having said so, for a number that
+ * does not fit in an int.
+ */
+static int
+isIntKey(int useIntKey, const char *key, size_t keylen, uint32_t *intkey)
+{
+	int64_t number = 0;
+	size_t i = 0;
+	int negative;
+
+	if ( ! useIntKey || keylen == 0) {
+		return 0;
+	}
+	negative = (key[0] == '-');
+	if (negative) {
+		i++;
+	}
+	if (i >= keylen || ! isdigit((unsigned char) key[i])) {
+		return 0;
+	}
+	for (; i < keylen && isdigit((unsigned char) key[i]); i++) {
+		number = number * 10 + (key[i] - '0');
+		if (number > (int64_t) INT32_MAX + negative) {
+			fprintf(stderr, "Error: integer key '%.*s' is out of range\n",
+					(int) keylen, key);
+			return -1;
+		}
+	}
+	*intkey = (uint32_t) (int32_t) (negative ? -number : number);
+	return 1;
+}
 
 /**
- * Load the assocArray of attribute value entries
+ * Load the assocArray of attribute value entries.  The keys are passed
+ * to the array straight from the mapped file, which copies them.
  */
 static int
 loadAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
-	int nEntries = 0;
-	int intkey;
-	FILE *fp = NULL;
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open input file '%s' : %s",
-				filename, strerror(errno));
+	const char *strkey = NULL, *value = NULL;
+	size_t keylen, valuelen;
+	int nEntries = 0, isInt;
+	uint32_t intkey;
+	DataFile *file;
+	ValueBlock *block;
+
+	file = openDataFile(filename);
+	if (file == NULL) {
 		return -1;
 	}
+	block = newValueBlock(file);
+	if (block == NULL) {
+		closeDataFile(file);
+		return -1;
+	}
+	keepValueBlock(block);
 
-	while (readDataLine(fp, linebuffer, LINE_MAX, &strkey, &value) > 0) {
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
-			}
-			if (aaInsert(assocArray,
-						(AAKeyType) &intkey, sizeof(int),
-						strdup(value)) < 0) {
-				fprintf(stderr, "Failed to add key '%d' to assocArray\n", intkey);
+	while (nextDataLine(file, &strkey, &keylen, &value, &valuelen) > 0) {
+		isInt = isIntKey(useIntKey, strkey, keylen, &intkey);
+		if (isInt < 0) {
+			closeDataFile(file);
+			return -1;
+		} else if (isInt) {
+			if (aaInsertU32(assocArray, intkey,
+						copyValue(block, value, valuelen)) < 0) {
+				fprintf(stderr, "Failed to add key '%d' to assocArray\n",
+						(int) intkey);
+				closeDataFile(file);
 				return -1;
 			}
 		} else {
 
 			if (aaInsert(assocArray,
-						(AAKeyType) strkey, strlen(strkey),
-						strdup(value)) < 0) {
-				fprintf(stderr, "Failed to add key '%s' to assocArray\n", strkey);
+						(AAKeyType) strkey, keylen,
+						copyValue(block, value, valuelen)) < 0) {
+				fprintf(stderr, "Failed to add key '%.*s' to assocArray\n",
+						(int) keylen, strkey);
+				closeDataFile(file);
 				return -1;
 			}
 		}
 		nEntries++;
 	}
 
-	fclose(fp);
+	closeDataFile(file);
 	return nEntries;
 }
 
 /**
- * Query the array with all the values in the given file
+ * One line of a data file, parsed ahead of being inserted.  The key is
+ * a view into the mapped file; an integer key has no string key.
+ */
+typedef struct LoadRecord {
+	const char *strkey;
+	size_t keylen;
+	uint32_t intkey;
+	char *value;
+} LoadRecord;
+
+/**
+ * the lines of one data file, grouped by the shard their key goes to;
+ * the file stays mapped until they have all been inserted
  */
+typedef struct ParsedFile {
+	char *filename;
+	DataFile *file;
+	ValueBlock *values;
+	LoadRecord **records;
+	int *nRecords;
+	int *maxRecords;
+} ParsedFile;
+/** what the threads of a parallel load share */
+typedef struct ParallelLoad {
+	AssociativeArray *assocArray;
+	ParsedFile *files;
+	int nFiles;
+	int nShards;
+	int nThreads;
+	int useIntKey;
+	int nextFile;
+	int failed;
+	pthread_barrier_t parsed;
+} ParallelLoad;
+
+typedef struct LoadThread {
+	ParallelLoad *load;
+	pthread_t thread;
+	int id;
+	int nEntries;
+} LoadThread;
+
+/** keep a parsed line with the other lines bound for its shard */
 static int
-queryAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
+addRecord(ParsedFile *file, int shard, const char *strkey, size_t keylen,
+		uint32_t intkey, char *value)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
-	int intkey;
-	FILE *fp = NULL;
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open query input file '%s' : %s",
-				filename, strerror(errno));
-		return -1;
+	LoadRecord *grown;
+	int newMax;
+
+	if (file->nRecords[shard] == file->maxRecords[shard]) {
+		newMax = file->maxRecords[shard] == 0 ? 64 : 2 * file->maxRecords[shard];
+		grown = (LoadRecord *) realloc(file->records[shard],
+				newMax * sizeof(LoadRecord));
+		if (grown == NULL) {
+			return -1;
+		}
+		file->records[shard] = grown;
+		file->maxRecords[shard] = newMax;
 	}
+	file->records[shard][file->nRecords[shard]].strkey = strkey;
+	file->records[shard][file->nRecords[shard]].keylen = keylen;
+	file->records[shard][file->nRecords[shard]].intkey = intkey;
+	file->records[shard][file->nRecords[shard]].value = value;
+	file->nRecords[shard]++;
+	return 0;
+}
 
-	while (readPlainLine(fp, linebuffer, LINE_MAX, &strkey)) {
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
-			}
+/**
+ * Read every line of a data file, just as loadAssociativeArray() does,
+ * but keep the lines rather than inserting them
+ */
+static int
+parseDataFile(ParallelLoad *load, ParsedFile *file)
+{
+	const char *strkey = NULL, *value = NULL;
+	size_t keylen, valuelen;
+	int shard, result, isInt;
+	uint32_t intkey;
 
-			value = aaLookup(assocArray, (AAKeyType) &intkey, sizeof(int));
-			if (value == NULL) {
-				printf("LOOKUP: key (%d) produced no value\n", intkey);
-			} else {
-				printf("LOOKUP: key (%d) produced value '%s'\n", intkey, value);
-			}
+	file->file = openDataFile(file->filename);
+	if (file->file == NULL) {
+		return -1;
+	}
+	file->values = newValueBlock(file->file);
+	if (file->values == NULL) {
+		return -1;
+	}
 
+	while (nextDataLine(file->file, &strkey, &keylen, &value, &valuelen) > 0) {
+		isInt = isIntKey(load->useIntKey, strkey, keylen, &intkey);
+		if (isInt < 0) {
+			return -1;
+		} else if (isInt) {
+			shard = aaShardOfU32(load->assocArray, intkey);
+			result = addRecord(file, shard, NULL, 0, intkey,
+					copyValue(file->values, value, valuelen));
 		} else {
-			value = aaLookup(assocArray, (AAKeyType) strkey, strlen(strkey));
-			if (value == NULL) {
-				printf("LOOKUP: key '%s' produced no value\n", strkey);
-			} else {
-				printf("LOOKUP: key '%s' produced value '%s'\n", strkey, value);
-			}
+			shard = aaShardOf(load->assocArray, (AAKeyType) strkey, keylen);
+			result = addRecord(file, shard, strkey, keylen, 0,
+					copyValue(file->values, value, valuelen));
+		}
+		if (result < 0) {
+			fprintf(stderr, "Error: out of memory reading '%s'\n", file->filename);
+			return -1;
 		}
 	}
 
-	fclose(fp);
-	return 1;
+	return 0;
+}
+
+/**
+ * The work of each loading thread: first parse whichever files are
+ * still to be read, then, once every file is parsed, insert the lines
+ * bound for the shards this thread owns.  Those are taken file by file
+ * and line by line, so that each shard is built by exactly the inserts
+ * a serial load would make to it, in the same order.
+ */
+static void *
+loadThread(void *arg)
+{
+	LoadThread *self = (LoadThread *) arg;
+	ParallelLoad *load = self->load;
+	LoadRecord *record;
+	int f, shard, i, result;
+
+	while ((f = __atomic_fetch_add(&load->nextFile, 1, __ATOMIC_RELAXED))
+			< load->nFiles) {
+		if (parseDataFile(load, &load->files[f]) < 0) {
+			fprintf(stderr, "Error: failed loading from file '%s'\n",
+					load->files[f].filename);
+			__atomic_store_n(&load->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	pthread_barrier_wait(&load->parsed);
+	if (__atomic_load_n(&load->failed, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	for (shard = self->id; shard < load->nShards; shard += load->nThreads) {
+		for (f = 0; f < load->nFiles; f++) {
+			for (i = 0; i < load->files[f].nRecords[shard]; i++) {
+				record = &load->files[f].records[shard][i];
+				if (record->strkey == NULL) {
+					result = aaInsertU32(load->assocArray, record->intkey,
+							record->value);
+				} else {
+					result = aaInsert(load->assocArray,
+							(AAKeyType) record->strkey, record->keylen,
+							record->value);
+				}
+				if (result < 0) {
+					fprintf(stderr, "Failed to add key from '%s' to assocArray\n",
+							load->files[f].filename);
+					__atomic_store_n(&load->failed, 1, __ATOMIC_RELAXED);
+					return NULL;
+				}
+				self->nEntries++;
+			}
+		}
+	}
+	return NULL;
 }
 
 /**
- * Delete the selected values from the array.  Note that we free the values
- * as otherwise they are memory leaks as we are managing the memory for
- * these values outside of the library
+ * Load all the data files on nThreads threads.  The array must have
+ * been split into shards; each thread inserts into its own shards
+ * only, so no locking is needed, and the array ends up exactly as a
+ * serial load would leave it.
+ *
+ *  @return      the number of entries loaded, or -1 on any error
  */
 static int
-deleteFromAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
+loadAssociativeArrayParallel(AssociativeArray *assocArray,
+		char **filenames, int nFiles, int nShards, int nThreads,
+		int useIntKey)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
-	int intkey;
-	FILE *fp = NULL;
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open query input file '%s' : %s",
-				filename, strerror(errno));
+	ParallelLoad load;
+	LoadThread *threads;
+	int nEntries = 0, f, shard, t;
+
+	load.assocArray = assocArray;
+	load.nFiles = nFiles;
+	load.nShards = nShards;
+	load.nThreads = nThreads;
+	load.useIntKey = useIntKey;
+	load.nextFile = 0;
+	load.failed = 0;
+
+	load.files = (ParsedFile *) calloc(nFiles, sizeof(ParsedFile));
+	threads = (LoadThread *) calloc(nThreads, sizeof(LoadThread));
+	if (load.files == NULL || threads == NULL) {
+		free(load.files);
+		free(threads);
 		return -1;
 	}
+	for (f = 0; f < nFiles; f++) {
+		load.files[f].filename = filenames[f];
+		load.files[f].records = (LoadRecord **) calloc(nShards, sizeof(LoadRecord *));
+		load.files[f].nRecords = (int *) calloc(nShards, sizeof(int));
+		load.files[f].maxRecords = (int *) calloc(nShards, sizeof(int));
+		if (load.files[f].records == NULL || load.files[f].nRecords == NULL
+				|| load.files[f].maxRecords == NULL) {
+			load.failed = 1;
+		}
+	}
 
-	while (readPlainLine(fp, linebuffer, LINE_MAX, &strkey)) {
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
+	if ( ! load.failed) {
+		pthread_barrier_init(&load.parsed, NULL, nThreads);
+		for (t = 0; t < nThreads; t++) {
+			threads[t].load = &load;
+			threads[t].id = t;
+			if (pthread_create(&threads[t].thread, NULL, loadThread,
+					&threads[t]) != 0) {
+				fprintf(stderr, "Error: cannot start loading thread\n");
+				exit(1);
 			}
+		}
+		for (t = 0; t < nThreads; t++) {
+			pthread_join(threads[t].thread, NULL);
+			nEntries += threads[t].nEntries;
+		}
+		pthread_barrier_destroy(&load.parsed);
 
-			value = aaDelete(assocArray, (AAKeyType) &intkey, sizeof(int));
-			if (value == NULL) {
-				printf("DELETE: key (%d) produced no value\n", intkey);
-			} else {
-				printf("DELETE: key (%d) produced value '%s'\n", intkey, value);
-				free(value);
+		/** how evenly the shards shared the work out */
+		if ( ! load.failed) {
+			printf("Loaded %d entries on %d threads:", nEntries, nThreads);
+			for (t = 0; t < nThreads; t++) {
+				printf(" %d", threads[t].nEntries);
 			}
+			printf("\n");
+		}
+	}
 
-		} else {
-			value = aaDelete(assocArray, (AAKeyType) strkey, strlen(strkey));
-			if (value == NULL) {
-				printf("DELETE: key '%s' produced no value\n", strkey);
-			} else {
-				printf("DELETE: key '%s' produced value '%s'\n", strkey, value);
-				free(value);
+	/** the keys were copied into the array, so the files can go */
+	for (f = 0; f < nFiles; f++) {
+		closeDataFile(load.files[f].file);
+		if (load.files[f].values != NULL) {
+			keepValueBlock(load.files[f].values);
+		}
+		for (shard = 0; load.files[f].records != NULL && shard < nShards; shard++) {
+			free(load.files[f].records[shard]);
+		}
+		free(load.files[f].records);
+		free(load.files[f].nRecords);
+		free(load.files[f].maxRecords);
+	}
+	free(load.files);
+	free(threads);
+
+	return load.failed ? -1 : nEntries;
+}
+
+/**
+ * How the results of queries and deletes are written: a line per key
+ * (the default), only the number of keys that did and did not produce
+ * a value, or a binary stream of a record per key
+ */
+#define	RESULTS_TEXT	0
+#define	RESULTS_COUNT	1
+#define	RESULTS_BINARY	2
+
+/** in the binary stream, the length recorded for a key with no value */
+#define	RESULT_NO_VALUE	UINT32_MAX
+
+/** the size of the buffer results are gathered in before each write */
+#define	RESULT_BUFFER_BYTES	(1024 * 1024)
+
+typedef struct ResultWriter {
+	FILE *fp;
+	int mode;
+	const char *label;
+	char *buffer;
+	size_t used;
+	size_t nHits;
+	size_t nMisses;
+} ResultWriter;
+
+static void
+flushResults(ResultWriter *writer)
+{
+	if (writer->used > 0) {
+		fwrite(writer->buffer, 1, writer->used, writer->fp);
+		writer->used = 0;
+	}
+}
+
+/** add bytes to the results, writing the buffer out as it fills */
+static void
+appendResult(ResultWriter *writer, const void *bytes, size_t n)
+{
+	if (writer->used + n > RESULT_BUFFER_BYTES) {
+		flushResults(writer);
+		if (n > RESULT_BUFFER_BYTES) {
+			fwrite(bytes, 1, n, writer->fp);
+			return;
+		}
+	}
+	memcpy(&writer->buffer[writer->used], bytes, n);
+	writer->used += n;
+}
+
+static void
+appendString(ResultWriter *writer, const char *string)
+{
+	appendResult(writer, string, strlen(string));
+}
+
+/** add an integer in decimal, as "%d" would print it */
+static void
+appendInteger(ResultWriter *writer, int value)
+{
+	char digits[16];
+	int i = sizeof(digits);
+	unsigned int magnitude = value < 0 ? - (unsigned int) value : value;
+
+	do {
+		digits[--i] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0) {
+		digits[--i] = '-';
+	}
+	appendResult(writer, &digits[i], sizeof(digits) - i);
+}
+
+/**
+ * Write the result for one key.  The text is that of a printf() per
+ * key, but is put together by hand, as formatting it was most of the
+ * time spent on a large query file.
+ */
+static void
+writeResult(ResultWriter *writer, const char *strkey, size_t keylen,
+		int isInt, uint32_t intkey, char *value)
+{
+	uint32_t valuelen;
+
+	if (value == NULL) {
+		writer->nMisses++;
+	} else {
+		writer->nHits++;
+	}
+
+	if (writer->mode == RESULTS_COUNT) {
+		return;
+	}
+	if (writer->mode == RESULTS_BINARY) {
+		valuelen = (value == NULL) ? RESULT_NO_VALUE : (uint32_t) strlen(value);
+		appendResult(writer, &valuelen, sizeof(valuelen));
+		if (value != NULL) {
+			appendResult(writer, value, valuelen);
+		}
+		return;
+	}
+
+	appendString(writer, writer->label);
+	if (isInt) {
+		appendString(writer, ": key (");
+		appendInteger(writer, (int) intkey);
+		appendString(writer, ")");
+	} else {
+		appendString(writer, ": key '");
+		appendResult(writer, strkey, keylen);
+		appendString(writer, "'");
+	}
+	if (value == NULL) {
+		appendString(writer, " produced no value\n");
+	} else {
+		appendString(writer, " produced value '");
+		appendString(writer, value);
+		appendString(writer, "'\n");
+	}
+}
+
+/**
+ * Queries and deletes run as a pipeline of three stages, each on its
+ * own thread, passing batches of keys around a ring: one reads keys
+ * from the mapped file (faulting its pages in ahead of the lookups),
+ * one looks them up or deletes them a batch at a time, so that their
+ * cache misses overlap, and one writes the results.  The keys are
+ * views into the mapped file, which stays open until the end.
+ */
+#define	QUERY_BATCH	1024
+#define	QUERY_RING	4
+
+#define	BATCH_EMPTY		0
+#define	BATCH_READ		1
+#define	BATCH_RESOLVED	2
+
+typedef struct QueryBatch {
+	const char *keys[QUERY_BATCH];
+	size_t keylens[QUERY_BATCH];
+	uint32_t intkeys[QUERY_BATCH];
+	char isInt[QUERY_BATCH];
+	char *values[QUERY_BATCH];
+	int n;
+	int last;
+	int stage;
+} QueryBatch;
+
+typedef struct QueryPipeline {
+	AssociativeArray *assocArray;
+	DataFile *file;
+	int useIntKey;
+	int deleting;
+	int failed;
+	ResultWriter *writer;
+	QueryBatch *batches;
+	pthread_mutex_t lock;
+	pthread_cond_t passed;
+} QueryPipeline;
+
+/** wait until batch i of the run has reached the given stage */
+static QueryBatch *
+waitForBatch(QueryPipeline *pipeline, long i, int stage)
+{
+	QueryBatch *batch = &pipeline->batches[i % QUERY_RING];
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (batch->stage != stage) {
+		pthread_cond_wait(&pipeline->passed, &pipeline->lock);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return batch;
+}
+
+/** hand a batch on to the stage that follows */
+static void
+passBatch(QueryPipeline *pipeline, QueryBatch *batch, int stage)
+{
+	pthread_mutex_lock(&pipeline->lock);
+	batch->stage = stage;
+	pthread_cond_broadcast(&pipeline->passed);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/** the first stage: fill batches with the keys of the file */
+static void *
+readKeys(void *arg)
+{
+	QueryPipeline *pipeline = (QueryPipeline *) arg;
+	QueryBatch *batch;
+	long i;
+	int n, isInt;
+
+	for (i = 0; ; i++) {
+		batch = waitForBatch(pipeline, i, BATCH_EMPTY);
+		for (n = 0; n < QUERY_BATCH && nextPlainLine(pipeline->file,
+				&batch->keys[n], &batch->keylens[n]); n++) {
+			isInt = isIntKey(pipeline->useIntKey,
+					batch->keys[n], batch->keylens[n], &batch->intkeys[n]);
+			if (isInt < 0) {
+				pipeline->failed = 1;
+				break;
 			}
+			batch->isInt[n] = (char) isInt;
+		}
+		batch->n = n;
+		batch->last = (n < QUERY_BATCH);
+		passBatch(pipeline, batch, BATCH_READ);
+		if (batch->last) {
+			return NULL;
 		}
 	}
+}
 
-	fclose(fp);
-	return 1;
+/**
+ * The second stage: look up or delete the keys of a batch.  String
+ * keys go through the batch interface together; integer keys are
+ * hashed differently, and so are done one by one.
+ */
+static void
+resolveBatch(QueryPipeline *pipeline, QueryBatch *batch)
+{
+	AAKeyType keys[QUERY_BATCH];
+	size_t keylens[QUERY_BATCH];
+	void *values[QUERY_BATCH];
+	int where[QUERY_BATCH];
+	int i, n = 0;
+
+	for (i = 0; i < batch->n; i++) {
+		if (batch->isInt[i]) {
+			batch->values[i] = pipeline->deleting
+					? aaDeleteU32(pipeline->assocArray, batch->intkeys[i])
+					: aaLookupU32(pipeline->assocArray, batch->intkeys[i]);
+		} else {
+			keys[n] = (AAKeyType) batch->keys[i];
+			keylens[n] = batch->keylens[i];
+			where[n++] = i;
+		}
+	}
+
+	if (pipeline->deleting) {
+		aaDeleteBatch(pipeline->assocArray, keys, keylens, n, values);
+	} else {
+		aaLookupBatch(pipeline->assocArray, keys, keylens, n, values);
+	}
+	for (i = 0; i < n; i++) {
+		batch->values[where[i]] = (char *) values[i];
+	}
 }
 
+/** the last stage: write out the results of each batch, in order */
+static void *
+writeResults(void *arg)
+{
+	QueryPipeline *pipeline = (QueryPipeline *) arg;
+	QueryBatch *batch;
+	long i;
+	int j, last;
+
+	for (i = 0; ; i++) {
+		batch = waitForBatch(pipeline, i, BATCH_RESOLVED);
+		for (j = 0; j < batch->n; j++) {
+			writeResult(pipeline->writer, batch->keys[j], batch->keylens[j],
+					batch->isInt[j], batch->intkeys[j], batch->values[j]);
+		}
+		last = batch->last;
+		passBatch(pipeline, batch, BATCH_EMPTY);
+		if (last) {
+			return NULL;
+		}
+	}
+}
 
+/**
+ * Look up, or delete, every key listed in the given file, one per
+ * line, writing out the results as the writer says
+ */
 static int
-deleteValue(AAKeyType key, size_t keylen, void *value, void *userdata)
+runQueries(AssociativeArray *assocArray, char *filename, int useIntKey,
+		int deleting, ResultWriter *writer)
 {
-	if (value != NULL)	free(value);
-	return 0;
+	QueryPipeline pipeline;
+	QueryBatch *batch;
+	pthread_t reader, resultWriter;
+	long i;
+	int last;
+
+	pipeline.assocArray = assocArray;
+	pipeline.useIntKey = useIntKey;
+	pipeline.deleting = deleting;
+	pipeline.failed = 0;
+	pipeline.writer = writer;
+	pipeline.file = openDataFile(filename);
+	if (pipeline.file == NULL) {
+		return -1;
+	}
+	pipeline.batches = (QueryBatch *) calloc(QUERY_RING, sizeof(QueryBatch));
+	writer->buffer = (char *) malloc(RESULT_BUFFER_BYTES);
+	if (pipeline.batches == NULL || writer->buffer == NULL) {
+		fprintf(stderr, "Error: out of memory querying '%s'\n", filename);
+		free(pipeline.batches);
+		free(writer->buffer);
+		closeDataFile(pipeline.file);
+		return -1;
+	}
+	writer->label = deleting ? "DELETE" : "LOOKUP";
+	writer->used = writer->nHits = writer->nMisses = 0;
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.passed, NULL);
+
+	if (pthread_create(&reader, NULL, readKeys, &pipeline) != 0
+			|| pthread_create(&resultWriter, NULL, writeResults, &pipeline) != 0) {
+		fprintf(stderr, "Error: cannot start query threads\n");
+		exit(1);
+	}
+	for (i = 0; ; i++) {
+		batch = waitForBatch(&pipeline, i, BATCH_READ);
+		resolveBatch(&pipeline, batch);
+		last = batch->last;
+		passBatch(&pipeline, batch, BATCH_RESOLVED);
+		if (last) {
+			break;
+		}
+	}
+	pthread_join(reader, NULL);
+	pthread_join(resultWriter, NULL);
+
+	flushResults(writer);
+	if (writer->mode == RESULTS_COUNT) {
+		fprintf(writer->fp, "%s: %zu keys, %zu produced a value and %zu produced none\n",
+				writer->label, writer->nHits + writer->nMisses,
+				writer->nHits, writer->nMisses);
+	}
+
+	pthread_cond_destroy(&pipeline.passed);
+	pthread_mutex_destroy(&pipeline.lock);
+	free(pipeline.batches);
+	free(writer->buffer);
+	closeDataFile(pipeline.file);
+	return pipeline.failed ? -1 : 1;
+}
+
+/**
+ * Query the array with all the values in the given file
+ */
+static int
+queryAssociativeArray(AssociativeArray *assocArray, char *filename,
+		int useIntKey, ResultWriter *writer)
+{
+	return runQueries(assocArray, filename, useIntKey, 0, writer);
+}
+
+/**
+ * Delete the selected values from the array.  The values themselves
+ * belong to the blocks they were loaded into, and are freed with them
+ * at exit.
+ */
+static int
+deleteFromAssociativeArray(AssociativeArray *assocArray, char *filename,
+		int useIntKey, ResultWriter *writer)
+{
+	return runQueries(assocArray, filename, useIntKey, 1, writer);
 }
 
 #define	DEFAULT_ARRAY_SIZE	100
+#define	DEFAULT_LOAD_FACTOR	0.75
 #define OPTIONLEN	10
 
 /** print out the help */
 void usage(char *progname)
 {
 	fprintf(stderr, "%s [<OPTIONS>] <datafile> [ <datafile> ... ]\n", progname);
+	fprintf(stderr, "%s [<OPTIONS>] -r <snapshot>\n", progname);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Creates an associative array and loads it with values from\n");
 	fprintf(stderr, "the data files given.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options: \n");
 	fprintf(stderr, "%-*s: Print this help.\n", OPTIONLEN, "-h");
-	fprintf(stderr, "%-*s: If a key is made of digits, store it as an int.\n", OPTIONLEN, "-i");
+	fprintf(stderr, "%-*s: If a key starts with digits (or a minus and digits), store it as an int.\n", OPTIONLEN, "-i");
 	fprintf(stderr, "%-*s: Size of table used internally, default %d.\n",
 			OPTIONLEN, "-n <SIZE>", DEFAULT_ARRAY_SIZE);
+	fprintf(stderr, "%-*s: Grow the table past this load factor, default %.2f.\n",
+			OPTIONLEN, "-l <LOAD>", DEFAULT_LOAD_FACTOR);
+	fprintf(stderr, "%-*s: Table size policy, \"prime\" (default) or \"pow2\".\n",
+			OPTIONLEN, "-s <POL>");
+	fprintf(stderr, "%-*s: Seed the keyed hashes with <SEED>, rather than at random.\n",
+			OPTIONLEN, "-S <SEED>");
+	fprintf(stderr, "%-*s: Split the table into <N> independent shards.\n",
+			OPTIONLEN, "-k <N>");
+	fprintf(stderr, "%-*s: Load the data files on <N> threads, into as many shards\n",
+			OPTIONLEN, "-t <N>");
+	fprintf(stderr, "%-*s: unless -k says otherwise; the table is the same as a\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: serial load into that many shards would give.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Time one operation in every <N>, and summarize the times.\n",
+			OPTIONLEN, "-L <N>");
+	fprintf(stderr, "%-*s: Save the table to a snapshot <FILE> once it is loaded.\n",
+			OPTIONLEN, "-w <FILE>");
+	fprintf(stderr, "%-*s: Map the table in from a snapshot <FILE> rather than loading\n",
+			OPTIONLEN, "-r <FILE>");
+	fprintf(stderr, "%-*s: data files; it can then be queried, but not changed.\n",
+			OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Output file to write to, default stdout.\n",
 			OPTIONLEN, "-o <FILE>");
 	fprintf(stderr, "%-*s: Print out the table after processing.\n", OPTIONLEN, "-p");
 	fprintf(stderr, "%-*s: Hash using the given algorithm.  Choices are \"sum\", \"length\",\n",
 			OPTIONLEN, "-H <ALG>");
-	fprintf(stderr, "%-*s: or your own algorithm.\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: \"custom\", \"wyhash\", \"murmur\" or the keyed \"sip\".\n", OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Probe using the given algorithm.  Choices are \"linear\", \"quadratic\",\n",
 			OPTIONLEN, "-P <ALG>");
-	fprintf(stderr, "%-*s: or \"doublehash\".\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: \"doublehash\", \"robinhood\", \"cuckoo\" or \"simd\", or \"chain\"\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: to chain entries outside the table instead of probing.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Or \"compact\" to probe linearly in 16 byte slots, keeping every\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: key in one shared heap, for the fewest bytes per entry.\n",
+			OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Perform queries on all of the keys listed in <FILE> (one per line)\n",
 			OPTIONLEN, "-q <FILE>");
 	fprintf(stderr, "%-*s: Delete all of the keys listed in <FILE> (one per line)\n",
 			OPTIONLEN, "-d <FILE>");
+	fprintf(stderr, "%-*s: Clear out the tombstones left by -d once it is done.\n",
+			OPTIONLEN, "-c");
+	fprintf(stderr, "%-*s: Write the results of -d and -q as \"text\" (default), a\n",
+			OPTIONLEN, "-m <MODE>");
+	fprintf(stderr, "%-*s: \"count\" of the keys that did and did not produce a value,\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: or \"binary\": per key, a 32-bit length in host byte order\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: (0xffffffff for no value) followed by the value's bytes.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Write the results of -d and -q to <FILE>, default stdout.\n",
+			OPTIONLEN, "-R <FILE>");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "The order of the operations controlled by -d, -q and -p are: deletion first,\n");
 	fprintf(stderr, "followed by any queries, and then finally printing (if indicated)\n");
@@ -206,32 +866,89 @@ main(int argc, char **argv)
 {
 	char *programname = NULL;
 	FILE *ofp = stdout;
-	int arraySize = DEFAULT_ARRAY_SIZE;
+	size_t arraySize = DEFAULT_ARRAY_SIZE;
+	double loadFactor = DEFAULT_LOAD_FACTOR;
 	int useIntKey = 0;
 	int printContents = 0;
+	int compactAfterDelete = 0;
+	int nShards = 0, nThreads = 1;
+	unsigned int latencyPeriod = 0;
 	char *queryfile = NULL, *deletefile = NULL;
+	char *snapshotfile = NULL, *savefile = NULL;
+	ResultWriter results;
 	int i, c;
 
 	AssociativeArray *assocArray;
 	char *hash1 = "sum", *hash2 = "len", *probe = "lin";
+	char *sizePolicy = NULL;
+	unsigned long long hashSeed = 0;
+	int pinHashSeed = 0;
 
 	/* save program name before calling getopt() */
 	programname = argv[0];
+	results.fp = stdout;
+	results.mode = RESULTS_TEXT;
 
 	/** use getopt(3) to parse command line */
-	while ((c = getopt(argc, argv, "hpin:o:P:H:2:q:d:")) != -1) {
+	while ((c = getopt(argc, argv, "hpicn:l:s:S:k:t:L:o:P:H:2:q:d:r:w:m:R:")) != -1) {
 		if (c == 'i') {
 			useIntKey = 1;
 		} else if (c == 'p') {
 			printContents = 1;
+		} else if (c == 'c') {
+			compactAfterDelete = 1;
 		} else if (c == 'n') {
-			if (sscanf(optarg, "%d", &arraySize) != 1) {
+			if (sscanf(optarg, "%zu", &arraySize) != 1) {
 				fprintf(stderr,
 						"Error: cannot parse assocArray size requested from '%s'\n",
 						optarg);
 				usage(programname);
 			}
 
+		} else if (c == 'l') {
+			if (sscanf(optarg, "%lf", &loadFactor) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse load factor requested from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 's') {
+			sizePolicy = optarg;
+
+		} else if (c == 'S') {
+			if (sscanf(optarg, "%llu", &hashSeed) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse hash seed requested from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+			pinHashSeed = 1;
+
+		} else if (c == 'k') {
+			if (sscanf(optarg, "%d", &nShards) != 1 || nShards < 1) {
+				fprintf(stderr,
+						"Error: cannot parse shard count requested from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 't') {
+			if (sscanf(optarg, "%d", &nThreads) != 1 || nThreads < 1) {
+				fprintf(stderr,
+						"Error: cannot parse thread count requested from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'L') {
+			if (sscanf(optarg, "%u", &latencyPeriod) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse sampling period requested from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
 		} else if (c == 'H') {
 			hash1 = optarg;
 
@@ -247,6 +964,33 @@ main(int argc, char **argv)
 		} else if (c == 'd') {
 			deletefile = optarg;
 
+		} else if (c == 'r') {
+			snapshotfile = optarg;
+
+		} else if (c == 'w') {
+			savefile = optarg;
+
+		} else if (c == 'm') {
+			if (strncmp(optarg, "tex", 3) == 0) {
+				results.mode = RESULTS_TEXT;
+			} else if (strncmp(optarg, "cou", 3) == 0) {
+				results.mode = RESULTS_COUNT;
+			} else if (strncmp(optarg, "bin", 3) == 0) {
+				results.mode = RESULTS_BINARY;
+			} else {
+				fprintf(stderr, "Error: unknown result mode '%s'\n", optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'R') {
+			results.fp = fopen(optarg, "w");
+			if (results.fp == NULL) {
+				fprintf(stderr,
+						"Error: cannot open requested results file '%s' : %s\n",
+						optarg, strerror(errno));
+				usage(programname);
+			}
+
 		} else if (c == 'o') {
 			ofp = fopen(optarg, "w");
 			if (ofp == NULL) {
@@ -265,37 +1009,103 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 1) {
-		fprintf(stderr, "Error: No data files listed to load!\n");
-		usage(programname);
-	}
+	if (snapshotfile != NULL) {
+		if (argc > 0) {
+			fprintf(stderr, "Error: Data files cannot be loaded into a snapshot!\n");
+			usage(programname);
+		}
+		if (deletefile != NULL) {
+			fprintf(stderr, "Error: Cannot delete from a snapshot!\n");
+			usage(programname);
+		}
+		assocArray = aaLoadSnapshot(snapshotfile);
+		if (assocArray == NULL) {
+			fprintf(stderr, "Error: failed loading snapshot '%s'\n", snapshotfile);
+			return -1;
+		}
+		if (latencyPeriod > 0
+				&& aaSetLatencySampling(assocArray, latencyPeriod) < 0) {
+			usage(programname);
+		}
+	} else {
+		if (argc < 1) {
+			fprintf(stderr, "Error: No data files listed to load!\n");
+			usage(programname);
+		}
 
-	/** allocate the array and fail out if we cannot */
-	assocArray = aaCreateAssociativeArray(arraySize, probe, hash1, hash2);
-	if (assocArray == NULL) {
-		fprintf(stderr, "Error: cannot allocate associative array - exitting\n");
-		return -1;
-	}
+		/** allocate the array and fail out if we cannot */
+		assocArray = aaCreateAssociativeArray(arraySize, probe, hash1, hash2);
+		if (assocArray == NULL) {
+			fprintf(stderr, "Error: cannot allocate associative array - exitting\n");
+			return -1;
+		}
+		if (aaSetMaxLoadFactor(assocArray, loadFactor) < 0) {
+			usage(programname);
+		}
+		if (sizePolicy != NULL && aaSetSizePolicy(assocArray, sizePolicy) < 0) {
+			usage(programname);
+		}
+		if (pinHashSeed && aaSetHashSeed(assocArray, hashSeed) < 0) {
+			usage(programname);
+		}
 
+		/** a parallel load gives each thread shards of its own */
+		if (nShards == 0 && nThreads > 1) {
+			nShards = nThreads;
+		}
+		if (nShards > 1 && aaSetShards(assocArray, nShards) < 0) {
+			usage(programname);
+		}
+		if (latencyPeriod > 0
+				&& aaSetLatencySampling(assocArray, latencyPeriod) < 0) {
+			usage(programname);
+		}
 
-	/** getopt leaves us only "file" arguments left in argv */
-	for (i = 0; i < argc; i++) {
-		if (loadAssociativeArray(assocArray, argv[i], useIntKey) < 0) {
-			fprintf(stderr, "Error: failed loading from file '%s'\n", argv[i]);
-			return -1;
+
+		/** getopt leaves us only "file" arguments left in argv */
+		if (nThreads > 1) {
+			if (loadAssociativeArrayParallel(assocArray, argv, argc,
+					nShards, nThreads, useIntKey) < 0) {
+				fprintf(stderr, "Error: failed loading data files\n");
+				return -1;
+			}
+		} else {
+			for (i = 0; i < argc; i++) {
+				if (loadAssociativeArray(assocArray, argv[i], useIntKey) < 0) {
+					fprintf(stderr, "Error: failed loading from file '%s'\n", argv[i]);
+					return -1;
+				}
+			}
 		}
 	}
 	printf("Associative array loaded\n");
 
 
+	/** save the table as loaded, before anything is deleted */
+	if (savefile != NULL && aaSaveSnapshot(assocArray, savefile, NULL) < 0) {
+		fprintf(stderr, "Error: failed saving snapshot '%s'\n", savefile);
+		return -1;
+	}
+
 	/** delete anything that we were asked to */
 	if (deletefile != NULL) {
-		deleteFromAssociativeArray(assocArray, deletefile, useIntKey);
+		if (deleteFromAssociativeArray(assocArray, deletefile,
+				useIntKey, &results) < 0) {
+			fprintf(stderr, "Error: failed deleting keys from '%s'\n", deletefile);
+			return -1;
+		}
+		if (compactAfterDelete) {
+			aaCompact(assocArray);
+		}
 	}
 
 	/** perform any queries we were asked to */
 	if (queryfile != NULL) {
-		queryAssociativeArray(assocArray, queryfile, useIntKey);
+		if (queryAssociativeArray(assocArray, queryfile,
+				useIntKey, &results) < 0) {
+			fprintf(stderr, "Error: failed querying keys from '%s'\n", queryfile);
+			return -1;
+		}
 	}
 
 	/* print out what we loaded */
@@ -305,8 +1115,8 @@ main(int argc, char **argv)
 	}
 
 	/* clean up before exit */
-	aaIterateAction(assocArray, deleteValue, NULL);
 	aaDeleteAssociativeArray(assocArray);
+	freeValueBlocks();
 
 	/* exit with success if we get here */
 	return 0;